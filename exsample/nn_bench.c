@@ -0,0 +1,1532 @@
+/* --
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2018 Abe Takafumi
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. *
+ *
+ */
+
+// libnnのベンチマーク集。
+// 使い方: sample-nn-bench <ベンチマーク名> [引数...]
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <wq/wq.h>
+#include <nn.h>
+#include <nn_inode.h>
+#include <nn_column.h>
+#include <nn_capture.h>
+#include <nn_wire.h>
+#include <nn_dentry.h>
+#include <nn_relay.h>
+#include <nn_publish.h>
+#include <nn_timer.h>
+#include <nn_notify.h>
+#include <nn_uring.h>
+#include <nn_sensor_data.h>
+#include <nn_motor_data.h>
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// ノードをnodes個、超音波センサを1つずつ持つストアを作る。
+static void
+bench_make_usonic_store(uint32_t nodes)
+{
+	uint32_t i;
+
+	for (i = 0; i < nodes; i++) {
+		uuid_t		uuid;
+		nn_d_uuid_t	*d_uuid;
+		nn_d_object_t	*d_object;
+		int32_t		value = rand() % 4000;
+
+		uuid_generate(uuid);
+		d_uuid = nn_get_duuid(uuid);
+		memcpy(d_uuid->uuid, uuid, sizeof uuid);
+		d_object = nn_get_dobject(d_uuid, 0);
+		nn_set_dobject_type(d_object, NN_OBJTYPE_USONIC);
+		d_object->idx = 0;
+		d_object->size = sizeof(nn_sensor_usonic_t);
+		memcpy(d_object->addr, &value, sizeof value);
+		nn_column_apply(d_object);
+		nn_put_dobject(d_object);
+		nn_put_duuid(d_uuid);
+	}
+}
+
+static void
+bench_report(const char *name, uint64_t ns, uint32_t n, nn_column_stat_t *st)
+{
+	printf("  %-16s %10.2f ns/obj  min=%d max=%d mean=%.2f\n",
+	       name, (double)ns / n, st->min, st->max,
+	       st->count ? (double)st->sum / st->count : 0.0);
+}
+
+// ---------------------------------------------------------------------------
+// column: 超音波センサの min/max/mean を
+//         ポインタを辿る走査とカラムビューで比較する。
+static int
+bench_column(int argc, char **argv)
+{
+	uint32_t		nodes = argc > 0 ? atoi(argv[0]) : 50000;
+	uint32_t		loops = argc > 1 ? atoi(argv[1]) : 100;
+	const nn_column_t	*col;
+	nn_column_stat_t	st;
+	nn_d_object_t		*obj;
+	uuid_t			uuid;
+	uint64_t		start;
+	uint32_t		bins[16];
+	uint32_t		l;
+	int32_t			v;
+
+	nn_init();
+	nn_column_enable(NN_OBJTYPE_USONIC);
+	bench_make_usonic_store(nodes);
+	printf("column: nodes=%u loops=%u\n", nodes, loops);
+
+	// 従来の走査: nn_read_uuids/nn_read_objects で全ノード、全スロットを辿る。
+	memset(&st, 0, sizeof st);
+	st.min = INT32_MAX;
+	st.max = INT32_MIN;
+	memset(uuid, 0, sizeof uuid);
+	start = now_ns();
+	while (nn_read_uuids(uuid) == 0) {
+		for (obj = nn_read_objects(uuid, NULL); obj;
+		     obj = obj->idx + 1 < NN_DUUID_OBJECTS ? nn_read_objects(uuid, obj) : NULL) {
+			if (obj->objtype != NN_OBJTYPE_USONIC) {
+				continue;
+			}
+			memcpy(&v, obj->addr, sizeof v);
+			st.min = v < st.min ? v : st.min;
+			st.max = v > st.max ? v : st.max;
+			st.sum += v;
+			st.count++;
+		}
+	}
+	bench_report("walk(uuids)", now_ns() - start, nodes, &st);
+
+	// タイプ別インデックスを辿る。
+	start = now_ns();
+	nn_store_lock();
+	for (l = 0; l < loops; l++) {
+		memset(&st, 0, sizeof st);
+		st.min = INT32_MAX;
+		st.max = INT32_MIN;
+		for (obj = nn_read_objtype(NN_OBJTYPE_USONIC, NULL); obj;
+		     obj = nn_read_objtype(NN_OBJTYPE_USONIC, obj)) {
+			memcpy(&v, obj->addr, sizeof v);
+			st.min = v < st.min ? v : st.min;
+			st.max = v > st.max ? v : st.max;
+			st.sum += v;
+			st.count++;
+		}
+	}
+	nn_store_unlock();
+	bench_report("walk(typeidx)", (now_ns() - start) / loops, nodes, &st);
+
+	// カラムビュー
+	col = nn_column_read_lock(NN_OBJTYPE_USONIC);
+	if (!col) {
+		return 1;
+	}
+	start = now_ns();
+	for (l = 0; l < loops; l++) {
+		nn_column_minmaxsum(col->field[0], col->rows, &st);
+	}
+	bench_report("column", (now_ns() - start) / loops, col->rows, &st);
+
+	start = now_ns();
+	for (l = 0; l < loops; l++) {
+		memset(bins, 0, sizeof bins);
+		nn_column_histogram(col->field[0], col->rows, 0, 250, bins, 16);
+	}
+	printf("  %-16s %10.2f ns/obj\n", "column(hist)",
+	       (double)(now_ns() - start) / loops / col->rows);
+	nn_column_read_unlock(NN_OBJTYPE_USONIC);
+	return 0;
+}
+
+// ---------------------------------------------------------------------------
+// latency: 自ノードのマルチキャストをループバックで受信し、
+//          nn_update_object()から受信反映までの遅延分布を測る。
+//          受信モード(event/busypoll)の比較に使う。
+#define BENCH_OBJTYPE_LATENCY	(NN_OBJTYPE_USER + 1)
+
+typedef struct bench_lat_obj {
+	nn_context_object_t	header;
+	struct {
+		uint64_t	ts;
+		uint32_t	seq;
+		uint32_t	rsv;
+	} data;
+} bench_lat_obj_t;
+
+static struct {
+	nn_context_t		ctx;
+	bench_lat_obj_t		obj;
+	wq_item_t		timer;
+	uint32_t		period_us;
+	const char		*mode;
+	uint32_t		samples;
+	uint32_t		count;
+	uint64_t		*lat;
+} __lat;
+
+static int
+bench_cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static void
+bench_print_percentiles(const char *name, uint64_t *v, uint32_t n)
+{
+	if (!n) {
+		printf("  %-16s no samples\n", name);
+		return;
+	}
+	qsort(v, n, sizeof v[0], bench_cmp_u64);
+	printf("  %-16s n=%u p50=%.1fus p90=%.1fus p99=%.1fus p99.9=%.1fus max=%.1fus\n",
+	       name, n,
+	       v[n * 50 / 100] / 1000.0, v[n * 90 / 100] / 1000.0,
+	       v[n * 99 / 100] / 1000.0, v[n * 999 / 1000] / 1000.0,
+	       v[n - 1] / 1000.0);
+}
+
+static void
+bench_latency_hook(nn_context_t *ctx, struct nn_object *obj, void *arg)
+{
+	uint64_t ts;
+
+	if (obj->objtype != BENCH_OBJTYPE_LATENCY ||
+	    uuid_compare(obj->d_uuid->uuid, ctx->node.uuid) != 0) {
+		return;
+	}
+	memcpy(&ts, obj->addr, sizeof ts);
+	__lat.lat[__lat.count++] = now_ns() - ts;
+	if (__lat.count == __lat.samples) {
+		int stage;
+
+		printf("latency: mode=%s period=%uus\n", __lat.mode, __lat.period_us);
+		bench_print_percentiles("update->apply", __lat.lat, __lat.count);
+		// ライブラリ内の区間ごとのヒストグラム
+		for (stage = 0; stage < NN_LAT_STAGES; stage++) {
+			const nn_lat_hist_t *hist = nn_get_latency(ctx, stage);
+			printf("  %-18s n=%llu p50=%.1fus p99=%.1fus max=%.1fus\n",
+			       nn_lat_stage_name(stage),
+			       (unsigned long long)hist->count,
+			       nn_lat_hist_percentile(hist, 0.50) / 1000.0,
+			       nn_lat_hist_percentile(hist, 0.99) / 1000.0,
+			       hist->max / 1000.0);
+		}
+		exit(0);
+	}
+}
+
+static void
+bench_latency_timer(wq_item_t *item, wq_arg_t arg)
+{
+	__lat.obj.data.seq++;
+	__lat.obj.data.ts = now_ns();
+	nn_update_object(&__lat.ctx, &__lat.obj.header, 0, sizeof __lat.obj.data);
+	wq_timer_sched(item, WQ_TIME_US(__lat.period_us), bench_latency_timer, NULL);
+}
+
+static int
+bench_latency(int argc, char **argv)
+{
+	nn_busypoll_param_t	param;
+	uuid_t			uuid;
+
+	__lat.mode = argc > 0 ? argv[0] : "event";
+	__lat.samples = argc > 1 ? atoi(argv[1]) : 10000;
+	__lat.period_us = argc > 2 ? atoi(argv[2]) : 1000;
+	__lat.lat = (uint64_t *)calloc(__lat.samples, sizeof(uint64_t));
+
+	uuid_generate(uuid);
+	nn_initialize(&__lat.ctx, &uuid, 12346);
+	nn_set_notify_hook(&__lat.ctx, bench_latency_hook, NULL);
+	nn_latency_enable(&__lat.ctx, 1);
+	nn_start(&__lat.ctx);
+	if (strcmp(__lat.mode, "busypoll") == 0) {
+		nn_busypoll_param_init(&param);
+		param.cpu = argc > 3 ? atoi(argv[3]) : -1;
+		nn_start_busypoll(&__lat.ctx, &param);
+	}
+
+	memset(&__lat.obj, 0, sizeof __lat.obj);
+	nn_context_object_init(&__lat.obj.header, 0, BENCH_OBJTYPE_LATENCY,
+			       sizeof __lat.obj.data);
+	nn_add_object(&__lat.ctx, &__lat.obj.header);
+
+	wq_init_item_prio(&__lat.timer, 0);
+	wq_sched(&__lat.timer, bench_latency_timer, NULL);
+	wq_run();
+	return 0;
+}
+
+// ---------------------------------------------------------------------------
+// write-rtt: 自ノードのタコモータへnn_write_object()で指令を書き込み、
+//            ackを受け取るまでの往復時間を測る。
+static struct {
+	nn_context_t		ctx;
+	nn_upd_motor_tacho_t	motor;
+	wq_item_t		timer;
+	uint32_t		period_us;
+	uint32_t		samples;
+	uint32_t		count;
+	uint32_t		timeouts;
+	uint64_t		*rtt;
+} __wr;
+
+static void
+bench_write_rtt_cb(nn_context_t *ctx, int status, uint64_t rtt_ns, void *arg)
+{
+	if (status) {
+		__wr.timeouts++;
+		return;
+	}
+	__wr.rtt[__wr.count++] = rtt_ns;
+	if (__wr.count == __wr.samples) {
+		printf("write-rtt: period=%uus timeouts=%u\n", __wr.period_us, __wr.timeouts);
+		bench_print_percentiles("write->ack", __wr.rtt, __wr.count);
+		exit(0);
+	}
+}
+
+static void
+bench_write_rtt_timer(wq_item_t *item, wq_arg_t arg)
+{
+	nn_motor_tacho_cmd_t cmd;
+
+	memset(&cmd, 0, sizeof cmd);
+	cmd.seq = __wr.count + __wr.timeouts;
+	cmd.command = NN_MOTOR_CMD_RUN_FOREVER;
+	cmd.speed_sp = 100;
+	nn_motor_tacho_command(&__wr.ctx, __wr.ctx.node.uuid, __wr.motor.header.idx,
+			       &cmd, bench_write_rtt_cb, NULL);
+	wq_timer_sched(item, WQ_TIME_US(__wr.period_us), bench_write_rtt_timer, NULL);
+}
+
+static int
+bench_write_rtt(int argc, char **argv)
+{
+	uuid_t uuid;
+
+	__wr.samples = argc > 0 ? atoi(argv[0]) : 10000;
+	__wr.period_us = argc > 1 ? atoi(argv[1]) : 1000;
+	__wr.rtt = (uint64_t *)calloc(__wr.samples, sizeof(uint64_t));
+
+	uuid_generate(uuid);
+	nn_initialize(&__wr.ctx, &uuid, 12347);
+	nn_start(&__wr.ctx);
+
+	nn_updmotor_tacho_init(&__wr.motor);
+	nn_add_object(&__wr.ctx, &__wr.motor.header);
+
+	wq_init_item_prio(&__wr.timer, 0);
+	wq_sched(&__wr.timer, bench_write_rtt_timer, NULL);
+	wq_run();
+	return 0;
+}
+
+// ---------------------------------------------------------------------------
+// store: センサ3つとタコモータを持つノードをnodes個受信させ、
+//        ノードあたりのメモリ使用量と読み出しの時間を測る。
+//        budget_mbを指定するとメモリ予算を設定し、追い出しの状況を表示する。
+static uint64_t
+bench_rss(void)
+{
+	unsigned long	size = 0, resident = 0;
+	FILE		*fp;
+
+	fp = fopen("/proc/self/statm", "r");
+	if (fp) {
+		if (fscanf(fp, "%lu %lu", &size, &resident) != 2) {
+			resident = 0;
+		}
+		fclose(fp);
+	}
+	return (uint64_t)resident * sysconf(_SC_PAGESIZE);
+}
+
+static uint32_t
+bench_add_updobj(char *buf, uint32_t sz, uint16_t idx, uint16_t type,
+		 const void *data, uint16_t size)
+{
+	nn_msg_updobj_header_t *objh = (nn_msg_updobj_header_t *)&buf[sz];
+
+	objh->idx = nn_wire16(idx);
+	objh->type = nn_wire16(type);
+	objh->offset = 0;
+	objh->size = nn_wire16(size);
+	nn_wire_copy_payload(objh + 1, data, type, 0, size);
+	return sz + sizeof *objh + size;
+}
+
+static int
+bench_store(int argc, char **argv)
+{
+	static nn_context_t	ctx;
+	nn_msg_upd_header_t	*hd;
+	nn_sensor_touch_t	touch = { 1 };
+	nn_sensor_gyro_t	gyro = { 90, 3 };
+	nn_sensor_usonic_t	usonic = { 1200 };
+	nn_motor_tacho_t	motor;
+	nn_d_uuid_t		*d_uuid;
+	nn_d_object_t		*d_object;
+	nn_store_stat_t		stat;
+	uint32_t		nodes, reads, budget_mb;
+	uint64_t		rss, start, sum = 0;
+	char			buf[512];
+	uuid_t			uuid;
+	uint32_t		i, sz;
+
+	nodes = argc > 0 ? atoi(argv[0]) : 100000;
+	reads = argc > 1 ? atoi(argv[1]) : 1000000;
+	budget_mb = argc > 2 ? atoi(argv[2]) : 0;
+
+	uuid_generate(uuid);
+	nn_initialize(&ctx, &uuid, 0);
+	memset(&motor, 0, sizeof motor);
+	memset(buf, 0, sizeof buf);
+	hd = (nn_msg_upd_header_t *)buf;
+	hd->objects = 4;
+	hd->type = NN_MSG_UPDATE;
+	hd->version = NN_WIRE_VERSION;
+	uuid_generate(hd->uuid);
+	sz = sizeof *hd;
+	sz = bench_add_updobj(buf, sz, 0, NN_OBJTYPE_TOUCH, &touch, sizeof touch);
+	sz = bench_add_updobj(buf, sz, 1, NN_OBJTYPE_GYRO, &gyro, sizeof gyro);
+	sz = bench_add_updobj(buf, sz, 2, NN_OBJTYPE_USONIC, &usonic, sizeof usonic);
+	sz = bench_add_updobj(buf, sz, 3, NN_OBJTYPE_TACHO_MOTOR, &motor, sizeof motor);
+
+	nn_set_store_budget((uint64_t)budget_mb * 1024 * 1024);
+	rss = bench_rss();
+	start = now_ns();
+	for (i = 0; i < nodes; i++) {
+		memcpy(&hd->uuid[12], &i, sizeof i);
+		nn_input_datagram(&ctx, buf, sz);
+	}
+	rss = bench_rss() - rss;
+	printf("store: nodes=%u rss=%.1fMB %.0f bytes/node %.2f ns/apply\n",
+	       nodes, rss / 1048576.0, (double)rss / nodes,
+	       (double)(now_ns() - start) / nodes);
+	nn_get_store_stat(&stat);
+	printf("  budget=%lluB memsz=%lluB (%.0f bytes/node) nodes=%llu "
+	       "evictions=%llu evicted=%lluB rejects=%llu\n",
+	       (unsigned long long)stat.budget, (unsigned long long)stat.memsz,
+	       stat.nodes ? (double)stat.memsz / stat.nodes : 0.0,
+	       (unsigned long long)stat.nodes, (unsigned long long)stat.evictions,
+	       (unsigned long long)stat.evicted_bytes, (unsigned long long)stat.rejects);
+	if (budget_mb) {
+		// 追い出されたノードを読むと作り直してしまうので、読み出しは測らない。
+		return 0;
+	}
+
+	// ランダムなノードのジャイロを読む。
+	start = now_ns();
+	for (i = 0; i < reads; i++) {
+		uint32_t n = rand() % nodes;
+		memcpy(&hd->uuid[12], &n, sizeof n);
+		d_uuid = nn_get_duuid(hd->uuid);
+		d_object = nn_get_dobject(d_uuid, 1);
+		sum += ((nn_sensor_gyro_t *)d_object->addr)->angle;
+		nn_put_dobject(d_object);
+		nn_put_duuid(d_uuid);
+	}
+	printf("  read gyro %10.2f ns/read (sum=%llu)\n",
+	       (double)(now_ns() - start) / reads, (unsigned long long)sum);
+	return 0;
+}
+
+// ---------------------------------------------------------------------------
+// names: 名前付きのノードを作り、パス検索とハンドル経由の読み出しを測る。
+
+static uint32_t
+bench_add_name(char *buf, uint32_t sz, uint8_t type, uint64_t ino, const char *name)
+{
+	struct nn_direntry de;
+
+	memset(&de, 0, sizeof de);
+	de.name_len = strlen(name);
+	de.type = type;
+	de.ino = nn_wire64(ino);
+	memcpy(&buf[sz], &de, sizeof de);
+	memcpy(&buf[sz + sizeof de], name, de.name_len);
+	((nn_msg_upd_header_t *)buf)->objects++;
+	return sz + sizeof de + de.name_len;
+}
+
+static int
+bench_names(int argc, char **argv)
+{
+	static nn_context_t	ctx;
+	nn_msg_upd_header_t	*hd, *nhd;
+	nn_sensor_gyro_t	gyro = { 90, 3 };
+	nn_dentry_t		**handle;
+	nn_d_object_t		*d_object;
+	uint32_t		nodes, lookups;
+	uint64_t		start, sum = 0;
+	char			buf[512], nbuf[512], path[128], str[37];
+	uuid_t			uuid;
+	uint32_t		i, sz, nsz, miss = 0;
+
+	nodes = argc > 0 ? atoi(argv[0]) : 10000;
+	lookups = argc > 1 ? atoi(argv[1]) : 1000000;
+
+	uuid_generate(uuid);
+	nn_initialize(&ctx, &uuid, 0);
+	memset(buf, 0, sizeof buf);
+	hd = (nn_msg_upd_header_t *)buf;
+	hd->type = NN_MSG_UPDATE;
+	hd->version = NN_WIRE_VERSION;
+	hd->objects = 1;
+	uuid_generate(hd->uuid);
+	sz = bench_add_updobj(buf, sizeof *hd, 1, NN_OBJTYPE_GYRO, &gyro, sizeof gyro);
+
+	memset(nbuf, 0, sizeof nbuf);
+	nhd = (nn_msg_upd_header_t *)nbuf;
+	nhd->type = NN_MSG_NAME;
+	nhd->version = NN_WIRE_VERSION;
+	memcpy(nhd->uuid, hd->uuid, sizeof nhd->uuid);
+
+	start = now_ns();
+	for (i = 0; i < nodes; i++) {
+		memcpy(&hd->uuid[12], &i, sizeof i);
+		memcpy(&nhd->uuid[12], &i, sizeof i);
+		nhd->objects = 0;
+		snprintf(path, sizeof path, "robot%u", i);
+		nsz = bench_add_name(nbuf, sizeof *nhd, NN_DIRENTRY_TYPE_UUID, 0, path);
+		nsz = bench_add_name(nbuf, nsz, NN_DIRENTRY_TYPE_STRING, 0, "touch");
+		nsz = bench_add_name(nbuf, nsz, NN_DIRENTRY_TYPE_STRING, 1, "gyro");
+		nn_input_datagram(&ctx, nbuf, nsz);
+		nn_input_datagram(&ctx, buf, sz);
+	}
+	printf("names: nodes=%u register %.2f ns/node\n", nodes,
+	       (double)(now_ns() - start) / nodes);
+
+	// 同じ名前の再通知
+	start = now_ns();
+	for (i = 0; i < nodes; i++) {
+		memcpy(&nhd->uuid[12], &i, sizeof i);
+		nhd->objects = 0;
+		snprintf(path, sizeof path, "robot%u", i);
+		nsz = bench_add_name(nbuf, sizeof *nhd, NN_DIRENTRY_TYPE_UUID, 0, path);
+		nsz = bench_add_name(nbuf, nsz, NN_DIRENTRY_TYPE_STRING, 0, "touch");
+		nsz = bench_add_name(nbuf, nsz, NN_DIRENTRY_TYPE_STRING, 1, "gyro");
+		nn_input_datagram(&ctx, nbuf, nsz);
+	}
+	printf("  %-20s %10.2f ns/node\n", "re-announce", (double)(now_ns() - start) / nodes);
+
+	// ノード名でのパス検索
+	start = now_ns();
+	for (i = 0; i < lookups; i++) {
+		nn_dentry_t *dentry;
+		snprintf(path, sizeof path, "/robot%u/gyro", (uint32_t)rand() % nodes);
+		dentry = nn_lookup_path(path);
+		if (!dentry || !(d_object = nn_dentry_get_object(dentry))) {
+			miss++;
+		} else {
+			sum += ((nn_sensor_gyro_t *)d_object->addr)->angle;
+			nn_put_dobject(d_object);
+		}
+		if (dentry) {
+			nn_put_dentry(dentry);
+		}
+	}
+	printf("  %-20s %10.2f ns/lookup (miss=%u)\n", "lookup(/name/obj)",
+	       (double)(now_ns() - start) / lookups, miss);
+
+	// UUIDでのパス検索
+	start = now_ns();
+	for (i = 0; i < lookups; i++) {
+		nn_dentry_t *dentry;
+		uint32_t n = rand() % nodes;
+		memcpy(&hd->uuid[12], &n, sizeof n);
+		uuid_unparse(hd->uuid, str);
+		snprintf(path, sizeof path, "/%s/gyro", str);
+		dentry = nn_lookup_path(path);
+		if (!dentry) {
+			miss++;
+		} else {
+			nn_put_dentry(dentry);
+		}
+	}
+	printf("  %-20s %10.2f ns/lookup (miss=%u)\n", "lookup(/uuid/obj)",
+	       (double)(now_ns() - start) / lookups, miss);
+
+	// 解決済みのハンドルから読む
+	handle = (nn_dentry_t **)calloc(nodes, sizeof *handle);
+	for (i = 0; i < nodes; i++) {
+		snprintf(path, sizeof path, "/robot%u/gyro", i);
+		handle[i] = nn_lookup_path(path);
+	}
+	start = now_ns();
+	for (i = 0; i < lookups; i++) {
+		nn_dentry_t *dentry = handle[(uint32_t)rand() % nodes];
+		if (dentry && (d_object = nn_dentry_get_object(dentry))) {
+			sum += ((nn_sensor_gyro_t *)d_object->addr)->angle;
+			nn_put_dobject(d_object);
+		}
+	}
+	printf("  %-20s %10.2f ns/read (sum=%llu)\n", "read(handle)",
+	       (double)(now_ns() - start) / lookups, (unsigned long long)sum);
+	for (i = 0; i < nodes; i++) {
+		if (handle[i]) {
+			nn_put_dentry(handle[i]);
+		}
+	}
+	free(handle);
+	return miss != 0;
+}
+
+// ---------------------------------------------------------------------------
+// ino: UUIDでの検索とinode番号での検索を比べる。
+
+static int
+bench_ino(int argc, char **argv)
+{
+	static nn_context_t	ctx;
+	nn_msg_upd_header_t	*hd;
+	nn_sensor_gyro_t	gyro = { 90, 3 };
+	nn_store_stat_t		stat;
+	nn_d_uuid_t		*d_uuid;
+	nn_d_object_t		*d_object;
+	uint64_t		*inos;
+	uint32_t		*order;
+	uint32_t		nodes, reads;
+	uint64_t		start, sum = 0;
+	char			buf[512];
+	uuid_t			uuid;
+	uint32_t		i, sz, miss = 0;
+
+	nodes = argc > 0 ? atoi(argv[0]) : 100000;
+	reads = argc > 1 ? atoi(argv[1]) : 1000000;
+
+	uuid_generate(uuid);
+	nn_initialize(&ctx, &uuid, 0);
+	memset(buf, 0, sizeof buf);
+	hd = (nn_msg_upd_header_t *)buf;
+	hd->type = NN_MSG_UPDATE;
+	hd->version = NN_WIRE_VERSION;
+	hd->objects = 1;
+	uuid_generate(hd->uuid);
+	sz = bench_add_updobj(buf, sizeof *hd, 1, NN_OBJTYPE_GYRO, &gyro, sizeof gyro);
+
+	inos = (uint64_t *)malloc(nodes * sizeof *inos);
+	order = (uint32_t *)malloc(reads * sizeof *order);
+	for (i = 0; i < nodes; i++) {
+		memcpy(&hd->uuid[12], &i, sizeof i);
+		nn_input_datagram(&ctx, buf, sz);
+		d_uuid = nn_lookup_duuid(hd->uuid);
+		inos[i] = NN_INO(NN_INO_NODENO(d_uuid->ino), 1);
+	}
+	for (i = 0; i < reads; i++) {
+		order[i] = rand() % nodes;
+	}
+	nn_get_store_stat(&stat);
+	printf("ino: nodes=%u reads=%u memsz=%lluB\n", nodes, reads,
+	       (unsigned long long)stat.memsz);
+
+	// UUIDハッシュ + index
+	start = now_ns();
+	for (i = 0; i < reads; i++) {
+		memcpy(&hd->uuid[12], &order[i], sizeof order[i]);
+		d_uuid = nn_get_duuid(hd->uuid);
+		d_object = nn_get_dobject(d_uuid, 1);
+		sum += ((nn_sensor_gyro_t *)d_object->addr)->angle;
+		nn_put_dobject(d_object);
+		nn_put_duuid(d_uuid);
+	}
+	printf("  %-16s %10.2f ns/read (sum=%llu)\n", "uuid",
+	       (double)(now_ns() - start) / reads, (unsigned long long)sum);
+
+	// inode番号(radix-tree)
+	sum = 0;
+	start = now_ns();
+	for (i = 0; i < reads; i++) {
+		d_object = nn_get_by_ino(inos[order[i]]);
+		if (!d_object) {
+			miss++;
+			continue;
+		}
+		sum += ((nn_sensor_gyro_t *)d_object->addr)->angle;
+		nn_put_dobject(d_object);
+	}
+	printf("  %-16s %10.2f ns/read (sum=%llu miss=%u)\n", "ino",
+	       (double)(now_ns() - start) / reads, (unsigned long long)sum, miss);
+	free(order);
+	free(inos);
+	return miss != 0;
+}
+
+// ---------------------------------------------------------------------------
+// record: 受信したデータグラムをseconds秒間ファイルへ記録する。
+static struct {
+	nn_context_t		ctx;
+	wq_item_t		timer;
+} __rec;
+
+static void
+bench_record_timer(wq_item_t *item, wq_arg_t arg)
+{
+	nn_capture_stop(&__rec.ctx);
+	exit(0);
+}
+
+static int
+bench_record(int argc, char **argv)
+{
+	uuid_t		uuid;
+	uint32_t	seconds;
+	int		port;
+	int		ret;
+
+	if (argc < 1) {
+		printf("record: file is required\n");
+		return 1;
+	}
+	seconds = argc > 1 ? atoi(argv[1]) : 10;
+	port = argc > 2 ? atoi(argv[2]) : 12345;
+
+	uuid_generate(uuid);
+	nn_initialize(&__rec.ctx, &uuid, port);
+	ret = nn_capture_start(&__rec.ctx, argv[0]);
+	if (ret) {
+		printf("record: nn_capture_start() error. ret=%d\n", ret);
+		return 1;
+	}
+	nn_start(&__rec.ctx);
+
+	wq_init_item_prio(&__rec.timer, 0);
+	wq_timer_sched(&__rec.timer, WQ_TIME_US(seconds * 1000000ull), bench_record_timer, NULL);
+	wq_run();
+	return 0;
+}
+
+// ---------------------------------------------------------------------------
+// replay: 記録したデータグラムを受信処理へ投入し、反映のスループットを測る。
+//         受信は開始しないので、ストアには記録の内容だけが反映される。
+static int
+bench_replay(int argc, char **argv)
+{
+	static nn_context_t	ctx;
+	nn_replay_stat_t	stat;
+	const char		*mode;
+	uuid_t			uuid;
+	int			loops;
+	int			i;
+	int			ret;
+
+	if (argc < 1) {
+		printf("replay: file is required\n");
+		return 1;
+	}
+	mode = argc > 1 ? argv[1] : "asap";
+	loops = argc > 2 ? atoi(argv[2]) : 1;
+
+	uuid_generate(uuid);
+	nn_initialize(&ctx, &uuid, 0);
+	for (i = 0; i < loops; i++) {
+		ret = nn_replay(&ctx, argv[0],
+				strcmp(mode, "realtime") == 0 ? NN_REPLAY_REALTIME : NN_REPLAY_ASAP,
+				&stat);
+		if (ret) {
+			printf("replay: nn_replay() error. ret=%d\n", ret);
+			return 1;
+		}
+		printf("replay[%d]: mode=%s datagrams=%llu objects=%llu bytes=%llu "
+		       "%.1fms %.0f dgram/s %.0f obj/s %.1f MB/s\n",
+		       i, mode,
+		       (unsigned long long)stat.datagrams,
+		       (unsigned long long)stat.objects,
+		       (unsigned long long)stat.bytes,
+		       stat.elapsed / 1e6,
+		       stat.datagrams * 1e9 / (stat.elapsed ? stat.elapsed : 1),
+		       stat.objects * 1e9 / (stat.elapsed ? stat.elapsed : 1),
+		       stat.bytes * 1e3 / (stat.elapsed ? stat.elapsed : 1));
+	}
+	return 0;
+}
+
+// ---------------------------------------------------------------------------
+// rx-apply: ループバックへ大量の更新を送り、受信から反映までの処理量を
+//           busypollとpipelineで比較する。
+#define BENCH_RXAPPLY_PORT	(12349)
+#define BENCH_RXAPPLY_OBJECTS	(4)
+#define BENCH_RXAPPLY_OBJSZ	(16)
+
+static uint64_t	__rxa_applied;
+
+static void
+bench_rx_apply_hook(nn_context_t *ctx, struct nn_object *obj, void *arg)
+{
+	__atomic_fetch_add(&__rxa_applied, 1, __ATOMIC_RELAXED);
+}
+
+static int
+bench_rx_apply(int argc, char **argv)
+{
+	static nn_context_t	ctx;
+	nn_pipeline_param_t	pparam;
+	nn_param_t		param;
+	struct sockaddr_in	addr;
+	nn_msg_upd_header_t	*hd;
+	nn_msg_updobj_header_t	*objh;
+	const char		*mode;
+	uint32_t		workers, nodes, datagrams;
+	uint64_t		start, last, applied, prev;
+	char			buf[512];
+	uuid_t			uuid;
+	uint32_t		i, j, sz;
+	int			sock;
+
+	mode = argc > 0 ? argv[0] : "pipeline";
+	workers = argc > 1 ? atoi(argv[1]) : 4;
+	nodes = argc > 2 ? atoi(argv[2]) : 10000;
+	datagrams = argc > 3 ? atoi(argv[3]) : 1000000;
+
+	uuid_generate(uuid);
+	nn_param_init(&param);
+	param.rcvbuf = 16 * 1024 * 1024;
+	nn_initialize_param(&ctx, &uuid, BENCH_RXAPPLY_PORT, &param);
+	nn_set_notify_hook(&ctx, bench_rx_apply_hook, NULL);
+	nn_start(&ctx);
+	nn_pipeline_param_init(&pparam);
+	pparam.workers = workers;
+	if (strcmp(mode, "pipeline") == 0) {
+		nn_start_pipeline(&ctx, &pparam);
+	} else {
+		nn_start_busypoll(&ctx, &pparam.io);
+	}
+
+	sock = socket(AF_INET, SOCK_DGRAM, 0);
+	memset(&addr, 0, sizeof addr);
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(BENCH_RXAPPLY_PORT);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	memset(buf, 0, sizeof buf);
+	hd = (nn_msg_upd_header_t *)buf;
+	hd->objects = BENCH_RXAPPLY_OBJECTS;
+	hd->type = NN_MSG_UPDATE;
+	hd->version = NN_WIRE_VERSION;
+	uuid_generate(hd->uuid);
+	sz = sizeof *hd;
+	for (j = 0; j < BENCH_RXAPPLY_OBJECTS; j++) {
+		objh = (nn_msg_updobj_header_t *)&buf[sz];
+		objh->idx = nn_wire16(j);
+		objh->type = nn_wire16(NN_OBJTYPE_USER + j);
+		objh->size = nn_wire16(BENCH_RXAPPLY_OBJSZ);
+		sz += sizeof *objh + BENCH_RXAPPLY_OBJSZ;
+	}
+
+	start = now_ns();
+	for (i = 0; i < datagrams; i++) {
+		// ノード番号をUUIDの末尾に入れて、nodes個のノードを巡回させる。
+		memcpy(&hd->uuid[12], &(uint32_t){ i % nodes }, sizeof(uint32_t));
+		memcpy(&buf[sizeof *hd + sizeof *objh], &i, sizeof i);
+		sendto(sock, buf, sz, 0, (struct sockaddr *)&addr, sizeof addr);
+	}
+
+	// 反映が止まるまで待つ。
+	last = now_ns();
+	prev = 0;
+	for (;;) {
+		usleep(100000);
+		applied = __atomic_load_n(&__rxa_applied, __ATOMIC_RELAXED);
+		if (applied == prev) {
+			break;
+		}
+		prev = applied;
+		last = now_ns();
+	}
+	applied /= BENCH_RXAPPLY_OBJECTS;
+	printf("rx-apply: mode=%s workers=%u nodes=%u sent=%u applied=%llu (%.1f%%) "
+	       "%.0f dgram/s\n",
+	       mode, strcmp(mode, "pipeline") == 0 ? workers : 1, nodes, datagrams,
+	       (unsigned long long)applied, applied * 100.0 / datagrams,
+	       applied * 1e9 / (last - start));
+	if (strcmp(mode, "pipeline") == 0) {
+		nn_pipeline_stat_t stat;
+		for (i = 0; nn_get_pipeline_stat(&ctx, i, &stat) == 0; i++) {
+			printf("  worker[%u] datagrams=%llu stalls=%llu\n", i,
+			       (unsigned long long)stat.datagrams,
+			       (unsigned long long)stat.stalls);
+		}
+		nn_stop_pipeline(&ctx);
+	} else {
+		nn_stop_busypoll(&ctx);
+	}
+	close(sock);
+	return 0;
+}
+
+// ---------------------------------------------------------------------------
+// ワイヤフォーマットの符号化/復号
+// 変換前と同じ生のmemcpyと、nn_wire.hを通した場合を比べる。
+
+#define BENCH_WIRE_OBJECTS	(24)
+
+static int
+bench_wire(int argc, char **argv)
+{
+	uint32_t		loops = argc > 0 ? strtoul(argv[0], NULL, 0) : 1000000;
+	static char		buf[NN_DATAGRAM_PACKETMAXSZ];
+	static nn_motor_tacho_t	src[BENCH_WIRE_OBJECTS], dst[BENCH_WIRE_OBJECTS];
+	nn_msg_updobj_header_t	*objh, oh;
+	uint64_t		start, ns[4];
+	uint32_t		i, j, off, sum = 0;
+
+	for (j = 0; j < BENCH_WIRE_OBJECTS; j++) {
+		memset(&src[j], j, sizeof src[j]);
+	}
+	// objhのoffsetを奇数にして、非整列アクセスも含める。
+	off = 1;
+
+	// 符号化(生)
+	start = now_ns();
+	for (i = 0; i < loops; i++) {
+		uint32_t sz = off;
+		for (j = 0; j < BENCH_WIRE_OBJECTS && sz + sizeof *objh + sizeof src[j] <= sizeof buf; j++) {
+			objh = (nn_msg_updobj_header_t *)&buf[sz];
+			objh->idx = j;
+			objh->type = NN_OBJTYPE_TACHO_MOTOR;
+			objh->offset = 0;
+			objh->size = sizeof src[j];
+			memcpy(objh + 1, &src[j], sizeof src[j]);
+			sz += sizeof *objh + sizeof src[j];
+		}
+		__asm__ __volatile__("" ::: "memory");
+	}
+	ns[0] = now_ns() - start;
+
+	// 符号化(nn_wire)
+	start = now_ns();
+	for (i = 0; i < loops; i++) {
+		uint32_t sz = off;
+		for (j = 0; j < BENCH_WIRE_OBJECTS && sz + sizeof *objh + sizeof src[j] <= sizeof buf; j++) {
+			objh = (nn_msg_updobj_header_t *)&buf[sz];
+			objh->idx = nn_wire16(j);
+			objh->type = nn_wire16(NN_OBJTYPE_TACHO_MOTOR);
+			objh->offset = 0;
+			objh->size = nn_wire16(sizeof src[j]);
+			nn_wire_copy_payload(objh + 1, &src[j], NN_OBJTYPE_TACHO_MOTOR, 0, sizeof src[j]);
+			sz += sizeof *objh + sizeof src[j];
+		}
+		__asm__ __volatile__("" ::: "memory");
+	}
+	ns[1] = now_ns() - start;
+
+	// 復号(生)
+	start = now_ns();
+	for (i = 0; i < loops; i++) {
+		uint32_t sz = off;
+		for (j = 0; j < BENCH_WIRE_OBJECTS; j++) {
+			objh = (nn_msg_updobj_header_t *)&buf[sz];
+			if (objh->idx >= BENCH_WIRE_OBJECTS || objh->size > sizeof dst[0]) {
+				break;
+			}
+			memcpy(&dst[objh->idx], objh + 1, objh->size);
+			sum += objh->type;
+			sz += sizeof *objh + objh->size;
+		}
+		__asm__ __volatile__("" ::: "memory");
+	}
+	ns[2] = now_ns() - start;
+
+	// 復号(nn_wire)
+	start = now_ns();
+	for (i = 0; i < loops; i++) {
+		uint32_t sz = off;
+		for (j = 0; j < BENCH_WIRE_OBJECTS; j++) {
+			nn_wire_copy_updobj_header(&oh, &buf[sz]);
+			if (oh.idx >= BENCH_WIRE_OBJECTS || oh.size > sizeof dst[0]) {
+				break;
+			}
+			nn_wire_copy_payload(&dst[oh.idx], &buf[sz + sizeof oh], oh.type, oh.offset, oh.size);
+			sum += oh.type;
+			sz += sizeof oh + oh.size;
+		}
+		__asm__ __volatile__("" ::: "memory");
+	}
+	ns[3] = now_ns() - start;
+
+	printf("wire: objects=%u objsz=%zu loops=%u bswap=%d (sum=%u)\n",
+	       BENCH_WIRE_OBJECTS, sizeof src[0], loops, NN_WIRE_BSWAP, sum);
+	printf("  %-16s %10.2f ns/obj\n", "encode(raw)", (double)ns[0] / loops / BENCH_WIRE_OBJECTS);
+	printf("  %-16s %10.2f ns/obj\n", "encode(wire)", (double)ns[1] / loops / BENCH_WIRE_OBJECTS);
+	printf("  %-16s %10.2f ns/obj\n", "decode(raw)", (double)ns[2] / loops / BENCH_WIRE_OBJECTS);
+	printf("  %-16s %10.2f ns/obj\n", "decode(wire)", (double)ns[3] / loops / BENCH_WIRE_OBJECTS);
+	return memcmp(src, dst, sizeof src) != 0;
+}
+
+// ---------------------------------------------------------------------------
+// relay: 下流の更新を中継で集約し、上流へ送るデータグラムとバイト数を比べる。
+// 送信はwqのイベントで行うので、ここでは送信キューへ積んだ量を数える。
+
+static int
+bench_relay(int argc, char **argv)
+{
+	static nn_context_t	down, up;
+	nn_msg_upd_header_t	*hd;
+	nn_sensor_gyro_t	gyro = { 90, 3 };
+	nn_relay_param_t	param;
+	nn_relay_stat_t		stat;
+	nn_relay_t		*relay;
+	uint32_t		nodes, updates;
+	uint64_t		start, ns, in_bytes = 0;
+	char			buf[512];
+	uuid_t			uuid;
+	uint32_t		i, j, sz;
+
+	nodes = argc > 0 ? atoi(argv[0]) : 10000;
+	updates = argc > 1 ? atoi(argv[1]) : 10;
+
+	uuid_generate(uuid);
+	nn_initialize(&down, &uuid, 0);
+	nn_initialize(&up, &uuid, 0);
+	nn_set_destination(&up, inet_addr("127.0.0.1"), 9);
+	nn_set_sendq_limit(&up, 0xffffffff, NN_SENDQ_DROP_OLDEST);
+	nn_relay_param_init(&param);
+	relay = nn_relay_start(&down, &up, &param);
+	if (!relay) {
+		return 1;
+	}
+
+	memset(buf, 0, sizeof buf);
+	hd = (nn_msg_upd_header_t *)buf;
+	hd->type = NN_MSG_UPDATE;
+	hd->version = NN_WIRE_VERSION;
+	hd->objects = 1;
+	uuid_generate(hd->uuid);
+
+	// 1つの窓の間に各ノードがupdates回更新される。
+	start = now_ns();
+	for (j = 0; j < updates; j++) {
+		gyro.angle = j;
+		sz = bench_add_updobj(buf, sizeof *hd, 1, NN_OBJTYPE_GYRO, &gyro, sizeof gyro);
+		for (i = 0; i < nodes; i++) {
+			memcpy(&hd->uuid[12], &i, sizeof i);
+			nn_input_datagram(&down, buf, sz);
+			in_bytes += sz;
+		}
+	}
+	ns = now_ns() - start;
+	start = now_ns();
+	nn_relay_flush(relay);
+	nn_relay_get_stat(relay, &stat);
+	printf("relay: nodes=%u updates/node=%u\n", nodes, updates);
+	printf("  %-16s datagrams=%llu bytes=%llu\n", "in",
+	       (unsigned long long)nodes * updates, (unsigned long long)in_bytes);
+	printf("  %-16s datagrams=%llu bytes=%llu (%.1f%% of bytes)\n", "out",
+	       (unsigned long long)stat.datagrams, (unsigned long long)stat.bytes,
+	       100.0 * stat.bytes / in_bytes);
+	printf("  %-16s %10.2f ns/update\n", "apply+hook", (double)ns / nodes / updates);
+	printf("  %-16s %10.2f ns/node\n", "flush", (double)(now_ns() - start) / nodes);
+	return stat.nodes != nodes || stat.objects != nodes;
+}
+
+// ---------------------------------------------------------------------------
+// publish: 毎周期オブジェクト全体を送る場合と、変わった範囲だけを送る場合を比べる。
+
+#define BENCH_PUBLISH_OBJECTS	(8)
+
+static int
+bench_publish(int argc, char **argv)
+{
+	static nn_context_t		ctx;
+	struct nn_context_object	*obj[BENCH_PUBLISH_OBJECTS];
+	nn_publish_stat_t		stat;
+	uint32_t			objsz, changed, loops;
+	uint64_t			start, ns[2], bytes[2];
+	uuid_t				uuid;
+	uint32_t			i, j, k;
+
+	objsz = argc > 0 ? atoi(argv[0]) : 4096;
+	changed = argc > 1 ? atoi(argv[1]) : 16;
+	loops = argc > 2 ? atoi(argv[2]) : 10000;
+	if (changed > objsz) {
+		changed = objsz;
+	}
+
+	uuid_generate(uuid);
+	nn_initialize(&ctx, &uuid, 0);
+	for (i = 0; i < BENCH_PUBLISH_OBJECTS; i++) {
+		obj[i] = (struct nn_context_object *)calloc(1, sizeof *obj[i] + objsz);
+		nn_context_object_init(obj[i], 0, NN_OBJTYPE_RAW, objsz);
+		nn_add_object(&ctx, obj[i]);
+	}
+
+	// 全体を送る。
+	start = now_ns();
+	for (j = 0; j < loops; j++) {
+		for (i = 0; i < BENCH_PUBLISH_OBJECTS; i++) {
+			for (k = 0; k < changed; k++) {
+				obj[i]->addr[(j * 64 + k) % objsz]++;
+			}
+			for (k = 0; k < objsz; k += ctx.datagram.pktmaxsz / 2) {
+				nn_update_object(&ctx, obj[i], k, objsz - k < ctx.datagram.pktmaxsz / 2 ?
+						 objsz - k : ctx.datagram.pktmaxsz / 2);
+			}
+		}
+	}
+	ns[0] = now_ns() - start;
+	bytes[0] = (uint64_t)objsz * BENCH_PUBLISH_OBJECTS * loops;
+
+	// 変わった範囲だけを送る。最初の全体送信は測らない。
+	nn_publish_start(&ctx, 0);
+	nn_publish_dirty(&ctx);
+	start = now_ns();
+	for (j = 0; j < loops; j++) {
+		for (i = 0; i < BENCH_PUBLISH_OBJECTS; i++) {
+			for (k = 0; k < changed; k++) {
+				obj[i]->addr[(j * 64 + k) % objsz]++;
+			}
+		}
+		nn_publish_dirty(&ctx);
+	}
+	ns[1] = now_ns() - start;
+	nn_get_publish_stat(&ctx, &stat);
+	bytes[1] = stat.changed - (uint64_t)objsz * BENCH_PUBLISH_OBJECTS;
+
+	printf("publish: objects=%u objsz=%u changed=%u loops=%u\n",
+	       BENCH_PUBLISH_OBJECTS, objsz, changed, loops);
+	printf("  %-16s %10.2f ns/tick %12llu bytes\n", "full",
+	       (double)ns[0] / loops, (unsigned long long)bytes[0]);
+	printf("  %-16s %10.2f ns/tick %12llu bytes (ranges=%llu)\n", "dirty",
+	       (double)ns[1] / loops, (unsigned long long)bytes[1],
+	       (unsigned long long)stat.ranges);
+	nn_publish_stop(&ctx);
+	return stat.errors != 0;
+}
+
+// ---------------------------------------------------------------------------
+// sched: 周期の異なるオブジェクトをタイマホイールで送り、tickあたりのコストを測る。
+
+static int
+bench_sched(int argc, char **argv)
+{
+	static const uint32_t		period_us[] = { 1000, 2000, 10000, 20000, 100000 };
+	static nn_context_t		ctx;
+	struct nn_context_object	*obj[NN_CTX_OBJECTS];
+	nn_sched_stat_t			stat;
+	uint32_t			objects, ticks, busy = 0;
+	uint64_t			start, ns;
+	uuid_t				uuid;
+	uint32_t			i;
+	int				fired;
+
+	objects = argc > 0 ? atoi(argv[0]) : NN_CTX_OBJECTS;
+	ticks = argc > 1 ? atoi(argv[1]) : 100000;
+	if (objects > NN_CTX_OBJECTS) {
+		objects = NN_CTX_OBJECTS;
+	}
+
+	uuid_generate(uuid);
+	nn_initialize(&ctx, &uuid, 0);
+	nn_sched_start(&ctx, 1000);
+	for (i = 0; i < objects; i++) {
+		obj[i] = (struct nn_context_object *)calloc(1, sizeof *obj[i] + 16);
+		nn_context_object_init(obj[i], 0, NN_OBJTYPE_RAW, 16);
+		nn_add_object(&ctx, obj[i]);
+		nn_set_publish_period(&ctx, obj[i], period_us[i % (sizeof period_us / sizeof period_us[0])]);
+	}
+
+	start = now_ns();
+	for (i = 0; i < ticks; i++) {
+		fired = nn_sched_advance(&ctx, 1);
+		if (fired > 0) {
+			busy++;
+		}
+	}
+	ns = now_ns() - start;
+	nn_get_sched_stat(&ctx, &stat);
+	printf("sched: objects=%u ticks=%u (tick=1ms)\n", objects, ticks);
+	printf("  %-16s %10.2f ns/tick %10.2f ns/object\n", "advance",
+	       (double)ns / ticks, (double)ns / (stat.fired ? stat.fired : 1));
+	printf("  fired=%llu ticks with sends=%u (%.1f objects per send tick)\n",
+	       (unsigned long long)stat.fired, busy, busy ? (double)stat.fired / busy : 0.0);
+	nn_sched_stop(&ctx);
+	return stat.errors != 0;
+}
+
+// ---------------------------------------------------------------------------
+// notify: 通知の登録がある場合とない場合で反映のコストと起床回数を比べる。
+
+static int
+bench_notify(int argc, char **argv)
+{
+	static nn_context_t	ctx;
+	nn_msg_upd_header_t	*hd;
+	nn_sensor_gyro_t	gyro = { 90, 3 };
+	nn_notifier_t		*n = NULL;
+	uint32_t		datagrams, batch;
+	uint64_t		start, ns, events = 0;
+	char			buf[512];
+	uuid_t			uuid;
+	uint32_t		i, sz;
+	int			pass;
+
+	datagrams = argc > 0 ? atoi(argv[0]) : 1000000;
+	batch = argc > 1 ? atoi(argv[1]) : 64;
+
+	uuid_generate(uuid);
+	nn_initialize(&ctx, &uuid, 0);
+	memset(buf, 0, sizeof buf);
+	hd = (nn_msg_upd_header_t *)buf;
+	hd->type = NN_MSG_UPDATE;
+	hd->version = NN_WIRE_VERSION;
+	hd->objects = 1;
+	uuid_generate(hd->uuid);
+	sz = bench_add_updobj(buf, sizeof *hd, 1, NN_OBJTYPE_GYRO, &gyro, sizeof gyro);
+
+	printf("notify: datagrams=%u consume every %u\n", datagrams, batch);
+	for (pass = 0; pass < 2; pass++) {
+		if (pass) {
+			n = nn_notifier_open(&ctx, NULL, NN_OBJTYPE_GYRO);
+		}
+		start = now_ns();
+		for (i = 0; i < datagrams; i++) {
+			hd->uuid[12] = (uint8_t)i;
+			nn_input_datagram(&ctx, buf, sz);
+			if (n && (i % batch) == batch - 1) {
+				events += nn_notifier_consume(n);
+			}
+		}
+		ns = now_ns() - start;
+		printf("  %-16s %10.2f ns/datagram\n", pass ? "notifier" : "none", (double)ns / datagrams);
+	}
+	events += nn_notifier_consume(n);
+	printf("  events=%llu wakeups=%llu\n", (unsigned long long)events,
+	       (unsigned long long)nn_notifier_wakeups(n));
+	nn_notifier_close(&ctx, n);
+	return events != datagrams;
+}
+
+// ---------------------------------------------------------------------------
+// changed: 変わったオブジェクトだけを辿る場合と、全オブジェクトを見る場合を比べる。
+
+static int
+bench_changed_cb(nn_d_object_t *obj, void *arg)
+{
+	(*(uint64_t *)arg)++;
+	return 0;
+}
+
+static int
+bench_changed(int argc, char **argv)
+{
+	static nn_context_t	ctx;
+	nn_msg_upd_header_t	*hd;
+	nn_sensor_gyro_t	gyro = { 90, 3 };
+	uint32_t		nodes, churn, rounds;
+	uint64_t		start, ns[2] = { 0, 0 }, gen, visited = 0, scanned = 0;
+	char			buf[512];
+	uuid_t			uuid;
+	uint32_t		i, r, n, sz;
+
+	nodes = argc > 0 ? atoi(argv[0]) : 100000;
+	churn = argc > 1 ? atoi(argv[1]) : 100;
+	rounds = argc > 2 ? atoi(argv[2]) : 100;
+
+	uuid_generate(uuid);
+	nn_initialize(&ctx, &uuid, 0);
+	memset(buf, 0, sizeof buf);
+	hd = (nn_msg_upd_header_t *)buf;
+	hd->type = NN_MSG_UPDATE;
+	hd->version = NN_WIRE_VERSION;
+	hd->objects = 1;
+	uuid_generate(hd->uuid);
+	sz = bench_add_updobj(buf, sizeof *hd, 1, NN_OBJTYPE_GYRO, &gyro, sizeof gyro);
+	for (i = 0; i < nodes; i++) {
+		memcpy(&hd->uuid[12], &i, sizeof i);
+		nn_input_datagram(&ctx, buf, sz);
+	}
+
+	// 毎回churn個のノードが(重複を含めて)2回ずつ更新される。
+	gen = nn_get_generation();
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < churn * 2; i++) {
+			n = (r * churn + i % churn) % nodes;
+			memcpy(&hd->uuid[12], &n, sizeof n);
+			nn_input_datagram(&ctx, buf, sz);
+		}
+		start = now_ns();
+		gen = nn_changed_since(gen, bench_changed_cb, &visited);
+		ns[0] += now_ns() - start;
+
+		start = now_ns();
+		nn_store_lock();
+		nn_for_each_objtype(NN_OBJTYPE_GYRO, bench_changed_cb, &scanned);
+		nn_store_unlock();
+		ns[1] += now_ns() - start;
+	}
+	printf("changed: nodes=%u churn=%u rounds=%u\n", nodes, churn, rounds);
+	printf("  %-16s %12.2f us/round (visited=%llu)\n", "changed_since",
+	       (double)ns[0] / rounds / 1000, (unsigned long long)visited);
+	printf("  %-16s %12.2f us/round (visited=%llu)\n", "full scan",
+	       (double)ns[1] / rounds / 1000, (unsigned long long)scanned);
+	return visited != (uint64_t)churn * rounds;
+}
+
+// ---------------------------------------------------------------------------
+// io: データグラムの送受信をepollとio_uringで比較する。
+//     送信はキューに積んだdatagrams個をシンクのソケットへ送り切るまで、
+//     受信はループバックから送ったdatagrams個を反映し終わるまでを測り、
+//     wqのスレッドが使ったCPU時間をデータグラムあたりで出す。
+#define BENCH_IO_PORT		(12350)
+#define BENCH_IO_SINK_PORT	(12351)
+#define BENCH_IO_NODES		(256)
+
+static uint64_t	__io_applied;
+
+static void
+bench_io_hook(nn_context_t *ctx, struct nn_object *obj, void *arg)
+{
+	__atomic_fetch_add(&__io_applied, 1, __ATOMIC_RELAXED);
+}
+
+static void *
+bench_io_thread(void *arg)
+{
+	wq_run();
+	return NULL;
+}
+
+static uint64_t
+bench_cpu_ns(clockid_t cid)
+{
+	struct timespec ts;
+	clock_gettime(cid, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint32_t
+bench_io_datagram(char *buf, uint32_t size)
+{
+	nn_msg_upd_header_t	*hd = (nn_msg_upd_header_t *)buf;
+	nn_msg_updobj_header_t	*objh = (nn_msg_updobj_header_t *)&buf[sizeof *hd];
+
+	memset(buf, 0, sizeof *hd + sizeof *objh + size);
+	hd->objects = 1;
+	hd->type = NN_MSG_UPDATE;
+	hd->version = NN_WIRE_VERSION;
+	uuid_generate(hd->uuid);
+	objh->idx = nn_wire16(0);
+	objh->type = nn_wire16(NN_OBJTYPE_USER);
+	objh->size = nn_wire16(size);
+	return sizeof *hd + sizeof *objh + size;
+}
+
+static int
+bench_io(int argc, char **argv)
+{
+	static nn_context_t	ctx;
+	static char		buf[NN_DATAGRAM_PACKETMAXSZ];
+	nn_param_t		param;
+	nn_uring_stat_t		ust;
+	struct sockaddr_in	addr;
+	struct timeval		tv = { 0, 500000 };
+	const char		*mode;
+	uint32_t		datagrams, size, sz, i;
+	uint64_t		start, last, cpu, applied, prev, recvd;
+	uint64_t		enters = 0;
+	int			uring = 0;
+	int			rcvbuf = 16 * 1024 * 1024;
+	int			sink, sock;
+	pthread_t		thread;
+	clockid_t		cid;
+	uuid_t			uuid;
+
+	mode = argc > 0 ? argv[0] : "epoll";
+	datagrams = argc > 1 ? atoi(argv[1]) : 200000;
+	size = argc > 2 ? atoi(argv[2]) : 64;
+	if (size > sizeof buf - sizeof(nn_msg_upd_header_t) - sizeof(nn_msg_updobj_header_t)) {
+		size = sizeof buf - sizeof(nn_msg_upd_header_t) - sizeof(nn_msg_updobj_header_t);
+	}
+
+	uuid_generate(uuid);
+	nn_param_init(&param);
+	param.rcvbuf = rcvbuf;
+	param.sndbuf = rcvbuf;
+	if (strcmp(mode, "uring") == 0) {
+		param.backend = NN_IO_URING;
+	}
+	nn_initialize_param(&ctx, &uuid, BENCH_IO_PORT, &param);
+	uring = nn_get_uring_stat(&ctx, &ust) == 0;
+	if (param.backend == NN_IO_URING && !uring) {
+		printf("io: io_uring is not available, running epoll\n");
+	}
+	nn_set_notify_hook(&ctx, bench_io_hook, NULL);
+	nn_set_sendq_limit(&ctx, 0, NN_SENDQ_DROP_OLDEST);
+
+	sink = socket(AF_INET, SOCK_DGRAM, 0);
+	memset(&addr, 0, sizeof addr);
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(BENCH_IO_SINK_PORT);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	setsockopt(sink, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof rcvbuf);
+	setsockopt(sink, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+	if (bind(sink, (struct sockaddr *)&addr, sizeof addr)) {
+		printf("io: bind() error\n");
+		return 1;
+	}
+	nn_set_destination(&ctx, htonl(INADDR_LOOPBACK), BENCH_IO_SINK_PORT);
+
+	// 送信: 先にキューへ積んでおき、wqのスレッドに送り切らせる。
+	sz = bench_io_datagram(buf, size);
+	for (i = 0; i < datagrams; i++) {
+		nn_send_datagram(&ctx, NN_PRIO_LOW, buf, sz);
+	}
+	nn_start(&ctx);
+	pthread_create(&thread, NULL, bench_io_thread, NULL);
+	pthread_getcpuclockid(thread, &cid);
+
+	start = now_ns();
+	recvd = 0;
+	last = start;
+	while (recvd < datagrams) {
+		ssize_t ret = recv(sink, buf, sizeof buf, 0);
+		if (ret < 0) {
+			break;
+		}
+		// 名前の通知などは数えない。
+		if (ret == sz) {
+			recvd++;
+			last = now_ns();
+		}
+	}
+	cpu = bench_cpu_ns(cid);
+	if (uring) {
+		nn_get_uring_stat(&ctx, &ust);
+		enters = ust.enters;
+	}
+	printf("io: backend=%s size=%u\n", uring ? "uring" : "epoll", size);
+	printf("  %-4s sent=%u recvd=%llu (%.1f%%) %.0f dgram/s %.0f ns cpu/dgram",
+	       "tx", datagrams, (unsigned long long)recvd, recvd * 100.0 / datagrams,
+	       recvd * 1e9 / (last - start + 1), (double)cpu / (recvd ? recvd : 1));
+	if (uring) {
+		printf(" %.3f enter/dgram", (double)enters / (recvd ? recvd : 1));
+	}
+	printf("\n");
+
+	// 受信: ループバックから送り、反映が止まるまで待つ。
+	sock = socket(AF_INET, SOCK_DGRAM, 0);
+	setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &rcvbuf, sizeof rcvbuf);
+	addr.sin_port = htons(BENCH_IO_PORT);
+	sz = bench_io_datagram(buf, size);
+	cpu = bench_cpu_ns(cid);
+	start = now_ns();
+	for (i = 0; i < datagrams; i++) {
+		// ノード番号をUUIDに入れて、BENCH_IO_NODES個のノードを巡回させる。
+		buf[offsetof(nn_msg_upd_header_t, uuid) + 12] = (char)(i % BENCH_IO_NODES);
+		sendto(sock, buf, sz, 0, (struct sockaddr *)&addr, sizeof addr);
+	}
+	last = now_ns();
+	prev = 0;
+	for (;;) {
+		usleep(100000);
+		applied = __atomic_load_n(&__io_applied, __ATOMIC_RELAXED);
+		if (applied == prev) {
+			break;
+		}
+		prev = applied;
+		last = now_ns();
+	}
+	cpu = bench_cpu_ns(cid) - cpu;
+	printf("  %-4s sent=%u applied=%llu (%.1f%%) %.0f dgram/s %.0f ns cpu/dgram",
+	       "rx", datagrams, (unsigned long long)applied, applied * 100.0 / datagrams,
+	       applied * 1e9 / (last - start), (double)cpu / (applied ? applied : 1));
+	if (uring) {
+		nn_get_uring_stat(&ctx, &ust);
+		printf(" %.3f enter/dgram rearms=%llu nobufs=%llu",
+		       (double)(ust.enters - enters) / (applied ? applied : 1),
+		       (unsigned long long)ust.rearms, (unsigned long long)ust.nobufs);
+	}
+	printf("\n");
+	close(sock);
+	close(sink);
+	return 0;
+}
+
+// ---------------------------------------------------------------------------
+
+static const struct {
+	const char	*name;
+	const char	*usage;
+	int		(*fn)(int argc, char **argv);
+} __benches[] = {
+	{ "column",	"[nodes] [loops]",	bench_column },
+	{ "latency",	"[event|busypoll] [samples] [period_us] [cpu]",	bench_latency },
+	{ "write-rtt",	"[samples] [period_us]",	bench_write_rtt },
+	{ "store",	"[nodes] [reads]",	bench_store },
+	{ "names",	"[nodes] [lookups]",	bench_names },
+	{ "ino",	"[nodes] [reads]",	bench_ino },
+	{ "rx-apply",	"[busypoll|pipeline] [workers] [nodes] [datagrams]",	bench_rx_apply },
+	{ "record",	"<file> [seconds] [port]",	bench_record },
+	{ "replay",	"<file> [asap|realtime] [loops]",	bench_replay },
+	{ "wire",	"[loops]",	bench_wire },
+	{ "relay",	"[nodes] [updates]",	bench_relay },
+	{ "publish",	"[objsz] [changed] [loops]",	bench_publish },
+	{ "sched",	"[objects] [ticks]",	bench_sched },
+	{ "notify",	"[datagrams] [batch]",	bench_notify },
+	{ "changed",	"[nodes] [churn] [rounds]",	bench_changed },
+	{ "io",		"[epoll|uring] [datagrams] [size]",	bench_io },
+};
+
+int
+main(int argc, char **argv)
+{
+	int i;
+
+	if (argc >= 2) {
+		for (i = 0; i < sizeof __benches / sizeof __benches[0]; i++) {
+			if (strcmp(argv[1], __benches[i].name) == 0) {
+				return __benches[i].fn(argc - 2, argv + 2);
+			}
+		}
+	}
+
+	printf("usage: %s <bench> [args...]\n", argv[0]);
+	for (i = 0; i < sizeof __benches / sizeof __benches[0]; i++) {
+		printf("  %-12s %s\n", __benches[i].name, __benches[i].usage);
+	}
+	return 1;
+}
@@ -0,0 +1,92 @@
+/* --
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2018 Abe Takafumi
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. *
+ *
+ */
+
+// nn.hppを使ったサンプル。
+// 変更したフィールドだけを送信し、受信したジャイロを型付きで読み出す。
+
+#include <stdint.h>
+#include <stdio.h>
+#include <nn.hpp>
+
+static nn_context_t			__nn_ctx;
+static nn::Object<nn_sensor_usonic_t>	__usonic;
+static nn::Object<nn_sensor_gyro_t>	__gyro;
+static nn::Object<nn_sensor_touch_t>	__touch;
+
+static wq_item_t	__timer;
+static int		__update_idx = 0;
+
+static void
+timer_sched_cb(wq_item_t *item, wq_arg_t arg)
+{
+	switch (__update_idx) {
+	case 0:
+		__usonic.set(&nn_sensor_usonic_t::value, __usonic->value + 1);
+		break;
+	case 1:
+		// angleだけが変わったのでangleだけを送る。
+		__gyro.set(&nn_sensor_gyro_t::angle, __gyro->angle + 1);
+		break;
+	case 2:
+		__gyro->angle++;
+		__gyro->rate++;
+		__gyro.publish(&nn_sensor_gyro_t::angle, &nn_sensor_gyro_t::rate);
+		break;
+	case 3:
+		__touch.set(&nn_sensor_touch_t::value, !__touch->value);
+		nn::for_each<nn_sensor_gyro_t>([](const nn_d_object_t *obj,
+						  const nn_sensor_gyro_t &gyro) {
+			printf("  gyro idx=%u angle=%d rate=%d\n", obj->idx, gyro.angle, gyro.rate);
+		});
+		break;
+	}
+	__update_idx++;
+	__update_idx &= 0x03;
+
+	wq_timer_sched(item, WQ_TIME_US(100000), timer_sched_cb, NULL);
+}
+
+int
+main(void)
+{
+	uuid_t node_uuid = {0};
+	uuid_generate(node_uuid);
+
+	nn_initialize(&__nn_ctx, &node_uuid, 12345);
+	nn_start(&__nn_ctx);
+
+	__usonic.attach(&__nn_ctx);
+	__gyro.attach(&__nn_ctx);
+	__touch.attach(&__nn_ctx);
+
+	wq_init_item_prio(&__timer, 0);
+	wq_sched(&__timer, timer_sched_cb, NULL);
+
+	// 自信をworkerスレッドとする。
+	wq_run();
+
+	return 0;
+}
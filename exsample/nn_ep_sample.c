@@ -30,6 +30,7 @@
 #include <nn.h>
 #include <nn_inode.h>
 #include <nn_sensor_data.h>
+#include <nn_timer.h>
 #include <linux/uuid.h>
 #include <radix-tree.h>
 
@@ -45,25 +46,22 @@ static int		__update_idx = 0;
 
 
 // 定期的にノードの情報を更新する。
+// 送信はオブジェクトごとの周期でスケジューラが行う。
 static void
 timer_sched_cb(wq_item_t *item, wq_arg_t arg)
 {
 	switch (__update_idx) {
 	case 0:
 		__usonic.usonic.value++;
-		nn_update_object(&__nn_ctx, (struct nn_context_object*)&__usonic, 0, sizeof __usonic.usonic);
 		break;
 	case 1:
 		__gyro.gyro.angle++;
-		nn_update_object(&__nn_ctx, (struct nn_context_object*)&__gyro, 0, sizeof __gyro.gyro);
 		break;
 	case 2:
 		__color.color.light.value++;
-		nn_update_object(&__nn_ctx, (struct nn_context_object*)&__color, 0, sizeof __color.color);
 		break;
 	case 3:
 		__touch.touch.value++;
-		nn_update_object(&__nn_ctx, (struct nn_context_object*)&__touch, 0, sizeof __touch.touch);
 //		break;
 //	case 4:
 //		break;
@@ -129,6 +127,14 @@ main(void)
 	nn_add_object(&__nn_ctx, (struct nn_context_object*)&__gyro);
 	nn_add_object(&__nn_ctx, (struct nn_context_object*)&__color);
 	nn_add_object(&__nn_ctx, (struct nn_context_object*)&__touch);
+
+	// 1ms単位のスケジューラで、オブジェクトごとの周期で送信する。
+	// 同じtickに期限を迎えたオブジェクトは1つのデータグラムで送られる。
+	nn_sched_start(&__nn_ctx, 1000);
+	nn_set_publish_period(&__nn_ctx, (struct nn_context_object*)&__gyro, 1000);
+	nn_set_publish_period(&__nn_ctx, (struct nn_context_object*)&__usonic, 20000);
+	nn_set_publish_period(&__nn_ctx, (struct nn_context_object*)&__color, 20000);
+	nn_set_publish_period(&__nn_ctx, (struct nn_context_object*)&__touch, 100000);
 //	nn_add_object(&__nn_ctx, &__tacho_motor[0], sizeof __tacho_motor[0]);
 //	nn_add_object(&__nn_ctx, &__tacho_motor[1], sizeof __tacho_motor[1]);
 //	nn_add_object(&__nn_ctx, &__tacho_motor[2], sizeof __tacho_motor[2]);
@@ -0,0 +1,210 @@
+/* --
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2018 Abe Takafumi
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. *
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <wq/wq.h>
+#include <nn.h>
+#include <nn_inode.h>
+#include <nn_latency.h>
+#include "nn_loadgen.h"
+
+// 仮想ノード群の受信側
+//
+// sample-nn-loadgenの送る更新を受信して反映し、1秒ごとに
+// 反映レート、欠損率、ノードあたりのメモリ、送信からの遅延を表示する。
+// 負荷生成側で仮想ノード数を増やしていけば、規模に対する変化が見られる。
+//
+//   sample-nn-fleet [-p port] [-b epoll|uring] [-r rcvbuf] [-d seconds]
+//
+// 遅延はCLOCK_REALTIMEの差なので、別ホストの場合は時刻同期が前提。
+
+static struct {
+	nn_context_t	ctx;
+	wq_item_t	timer;
+	uint32_t	duration;
+	// 仮想ノードごとの最後の更新番号(0は未受信)
+	uint32_t	*seq;
+	uint32_t	nseq;
+	uint32_t	nodes;		// 受信した仮想ノード数
+	uint32_t	fleet;		// 送信側の仮想ノード数(最新)
+	long		rss0;		// 開始時の常駐メモリ
+	uint64_t	start;
+	uint64_t	last_report;
+	// 表示の間隔ごとに集計する。
+	uint64_t	objects;
+	uint64_t	updates;
+	uint64_t	lost;
+	uint64_t	reordered;
+	nn_lat_hist_t	lat;
+} __fl;
+
+static long
+fleet_rss(void)
+{
+	long	size, rss = 0;
+	FILE	*fp = fopen("/proc/self/statm", "r");
+
+	if (fp) {
+		if (fscanf(fp, "%ld %ld", &size, &rss) != 2) {
+			rss = 0;
+		}
+		fclose(fp);
+	}
+	return rss * sysconf(_SC_PAGESIZE);
+}
+
+// 更新番号の飛びを欠損として数える。
+// ノードの更新はオブジェクトごとに同じ番号なので、index 0だけを見る。
+static void
+fleet_track(const nn_loadgen_payload_t *pl)
+{
+	uint32_t	*seq;
+	uint32_t	n;
+
+	if (pl->vnode >= __fl.nseq) {
+		for (n = __fl.nseq ? __fl.nseq : 1024; n <= pl->vnode; n *= 2) {
+		}
+		seq = (uint32_t *)realloc(__fl.seq, n * sizeof *seq);
+		if (!seq) {
+			return;
+		}
+		memset(&seq[__fl.nseq], 0, (n - __fl.nseq) * sizeof *seq);
+		__fl.seq = seq;
+		__fl.nseq = n;
+	}
+
+	seq = &__fl.seq[pl->vnode];
+	if (!*seq) {
+		__fl.nodes++;
+	} else if (pl->seq > *seq) {
+		__fl.lost += pl->seq - *seq - 1;
+	} else {
+		__fl.reordered++;
+		return;
+	}
+	*seq = pl->seq;
+	__fl.updates++;
+	__fl.fleet = pl->fleet;
+}
+
+static void
+fleet_hook(nn_context_t *ctx, struct nn_object *obj, void *arg)
+{
+	nn_loadgen_payload_t pl;
+
+	if (obj->objtype != NN_LOADGEN_OBJTYPE || obj->size < sizeof pl) {
+		return;
+	}
+	memcpy(&pl, obj->addr, sizeof pl);
+	nn_lat_hist_add(&__fl.lat, nn_lat_realtime() - pl.ts);
+	__fl.objects++;
+	if (obj->idx == 0) {
+		fleet_track(&pl);
+	}
+}
+
+static void
+fleet_timer_cb(wq_item_t *item, wq_arg_t arg)
+{
+	uint64_t	now = nn_lat_now();
+	double		sec = (now - __fl.last_report) / 1e9;
+	long		rss = fleet_rss() - __fl.rss0;
+
+	printf("t=%4.0fs fleet=%u nodes=%u apply=%.0f obj/s %.0f upd/s loss=%.2f%% reorder=%llu "
+	       "mem=%.0f B/node lat p50=%.0fus p99=%.0fus p99.9=%.0fus max=%.0fus\n",
+	       (now - __fl.start) / 1e9, __fl.fleet, __fl.nodes,
+	       __fl.objects / sec, __fl.updates / sec,
+	       __fl.lost * 100.0 / (__fl.lost + __fl.updates ? __fl.lost + __fl.updates : 1),
+	       (unsigned long long)__fl.reordered,
+	       __fl.nodes ? (double)rss / __fl.nodes : 0.0,
+	       nn_lat_hist_percentile(&__fl.lat, 0.50) / 1000.0,
+	       nn_lat_hist_percentile(&__fl.lat, 0.99) / 1000.0,
+	       nn_lat_hist_percentile(&__fl.lat, 0.999) / 1000.0,
+	       __fl.lat.max / 1000.0);
+	fflush(stdout);
+
+	__fl.objects = 0;
+	__fl.updates = 0;
+	__fl.lost = 0;
+	__fl.reordered = 0;
+	nn_lat_hist_clear(&__fl.lat);
+	__fl.last_report = now;
+
+	if (__fl.duration && now - __fl.start >= (uint64_t)__fl.duration * 1000000000ull) {
+		exit(0);
+	}
+	wq_timer_sched(item, WQ_TIME_US(1000000), fleet_timer_cb, NULL);
+}
+
+static void
+usage(const char *prog)
+{
+	printf("usage: %s [-p port] [-b epoll|uring] [-r rcvbuf] [-d seconds]\n", prog);
+}
+
+int
+main(int argc, char *argv[])
+{
+	nn_param_t	param;
+	uuid_t		node_uuid;
+	int		port = NN_LOADGEN_PORT;
+	int		opt;
+
+	nn_param_init(&param);
+	param.rcvbuf = 16 * 1024 * 1024;
+	while ((opt = getopt(argc, argv, "p:b:r:d:h")) != -1) {
+		switch (opt) {
+		case 'p': port = atoi(optarg); break;
+		case 'b': param.backend = strcmp(optarg, "uring") == 0 ? NN_IO_URING : NN_IO_EPOLL; break;
+		case 'r': param.rcvbuf = atoi(optarg); break;
+		case 'd': __fl.duration = strtoul(optarg, NULL, 0); break;
+		default: usage(argv[0]); return 1;
+		}
+	}
+
+	// ストアへの反映が始まる前のメモリを基準にする。
+	__fl.rss0 = fleet_rss();
+	uuid_generate(node_uuid);
+	if (nn_initialize_param(&__fl.ctx, &node_uuid, port, &param)) {
+		printf("nn_initialize_param() error.\n");
+		return 1;
+	}
+	nn_set_notify_hook(&__fl.ctx, fleet_hook, NULL);
+	nn_start(&__fl.ctx);
+
+	printf("fleet: port=%d backend=%s\n", port,
+	       __fl.ctx.datagram.uring ? "uring" : "epoll");
+	__fl.start = __fl.last_report = nn_lat_now();
+	wq_init_item_prio(&__fl.timer, 0);
+	wq_timer_sched(&__fl.timer, WQ_TIME_US(1000000), fleet_timer_cb, NULL);
+
+	wq_run();
+	return 0;
+}
@@ -0,0 +1,50 @@
+/* --
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2018 Abe Takafumi
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. *
+ *
+ */
+
+#ifndef _NN_LOADGEN_H_
+#define _NN_LOADGEN_H_
+
+#include <stdint.h>
+#include <nn.h>
+
+// 負荷生成(sample-nn-loadgen)と受信側(sample-nn-fleet)で共有する定義。
+//
+// 負荷生成は仮想ノードごとのUUIDでNN_MSG_UPDATEを組み立てて送る。
+// 各オブジェクトのデータの先頭にnn_loadgen_payload_tを置き、
+// 受信側は欠損(seqの飛び)と送信からの遅延を計算する。
+
+#define NN_LOADGEN_OBJTYPE	(NN_OBJTYPE_USER + 0x4c47)	// 'LG'
+#define NN_LOADGEN_PORT		(12360)
+
+typedef struct nn_loadgen_payload {
+	uint64_t	ts;		// 送信時刻(ns, CLOCK_REALTIME)
+	uint32_t	vnode;		// 仮想ノードの番号
+	uint32_t	seq;		// 仮想ノードごとの更新番号
+	uint32_t	fleet;		// 送信時点の仮想ノード数
+	uint32_t	rsv;
+} nn_loadgen_payload_t;
+
+#endif /* _NN_LOADGEN_H_ */
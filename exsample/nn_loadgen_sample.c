@@ -0,0 +1,305 @@
+/* --
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2018 Abe Takafumi
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. *
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <wq/wq.h>
+#include <nn.h>
+#include <nn_latency.h>
+#include <nn_wire.h>
+#include <nn_inode.h>
+#include "nn_loadgen.h"
+
+// 仮想ノード群の負荷生成
+//
+// nodes個の仮想ノードがそれぞれobjects個のオブジェクトを持ち、
+// 各ノードがrate回/秒で全オブジェクトを更新したとして送信する。
+// 送信は1つのnn_context_tの送信キューを通すので、ペーシングも使える。
+// 仮想ノード数はinitialから始めてinterval秒ごとにstepずつnodesまで増やす。
+//
+//   sample-nn-loadgen [-n nodes] [-m objects] [-r rate] [-s size|min-max]
+//                     [-i initial] [-S step] [-T interval] [-d seconds]
+//                     [-a addr] [-p port] [-P pps] [-z pktmaxsz]
+//
+// 送信先は既定のマルチキャストグループ。受信側はsample-nn-fleet。
+
+#define LOADGEN_TICK_US		(1000)
+
+static struct {
+	nn_context_t	ctx;
+	wq_item_t	timer;
+	// 設定
+	uint32_t	nodes;
+	uint32_t	objects;
+	uint32_t	rate;		// ノードあたりの更新/秒
+	uint32_t	size_min;
+	uint32_t	size_max;
+	uint32_t	initial;
+	uint32_t	step;
+	uint32_t	interval;	// 秒
+	uint32_t	duration;	// 秒(0なら止めない)
+	uint32_t	pktmaxsz;
+	// 状態
+	uuid_t		*uuid;		// 仮想ノードのUUID
+	uint32_t	*seq;
+	uint16_t	*size;		// オブジェクトごとのデータサイズ(nodes * objects)
+	uint32_t	active;		// 送信中の仮想ノード数
+	uint32_t	next;		// 次に送る仮想ノード
+	uint64_t	credit;		// 送る更新数の端数(1e9倍)
+	uint64_t	last_tick;
+	uint64_t	start;
+	uint64_t	last_report;
+	uint64_t	last_ramp;
+	uint64_t	updates;
+	uint64_t	datagrams;
+	uint64_t	bytes;
+	char		*buf;
+} __lg;
+
+// 1つの仮想ノードの更新を送る。データグラムに収まらなければ分割する。
+static void
+loadgen_send_node(uint32_t vnode)
+{
+	nn_msg_upd_header_t	*hd = (nn_msg_upd_header_t *)__lg.buf;
+	nn_msg_updobj_header_t	*objh;
+	nn_loadgen_payload_t	pl;
+	uint32_t		sz = sizeof *hd;
+	uint32_t		j, size;
+
+	memset(hd, 0, sizeof *hd);
+	memcpy(hd->uuid, __lg.uuid[vnode], sizeof hd->uuid);
+	hd->type = NN_MSG_UPDATE;
+	hd->version = NN_WIRE_VERSION;
+
+	pl.ts = nn_lat_realtime();
+	pl.vnode = vnode;
+	pl.seq = ++__lg.seq[vnode];
+	pl.fleet = __lg.active;
+	pl.rsv = 0;
+
+	for (j = 0; j < __lg.objects; j++) {
+		size = __lg.size[(size_t)vnode * __lg.objects + j];
+		if (sz + sizeof *objh + size > __lg.pktmaxsz) {
+			nn_send_datagram(&__lg.ctx, NN_PRIO_LOW, __lg.buf, sz);
+			__lg.datagrams++;
+			__lg.bytes += sz;
+			sz = sizeof *hd;
+			hd->objects = 0;
+		}
+		objh = (nn_msg_updobj_header_t *)&__lg.buf[sz];
+		objh->idx = nn_wire16(j);
+		objh->type = nn_wire16(NN_LOADGEN_OBJTYPE);
+		objh->offset = 0;
+		objh->size = nn_wire16(size);
+		sz += sizeof *objh;
+		memcpy(&__lg.buf[sz], &pl, sizeof pl);
+		memset(&__lg.buf[sz + sizeof pl], (int)pl.seq, size - sizeof pl);
+		sz += size;
+		hd->objects++;
+	}
+	nn_send_datagram(&__lg.ctx, NN_PRIO_LOW, __lg.buf, sz);
+	__lg.datagrams++;
+	__lg.bytes += sz;
+	__lg.updates++;
+}
+
+static void
+loadgen_report(uint64_t now)
+{
+	nn_sendq_stat_t	stat;
+	double		sec = (now - __lg.last_report) / 1e9;
+
+	nn_get_sendq_stat(&__lg.ctx, NN_PRIO_LOW, &stat);
+	printf("t=%4.0fs fleet=%u updates=%.0f/s datagrams=%.0f/s %.1f MB/s sendq=%u overflow=%llu\n",
+	       (now - __lg.start) / 1e9, __lg.active,
+	       __lg.updates / sec, __lg.datagrams / sec, __lg.bytes / sec / 1e6,
+	       stat.depth, (unsigned long long)stat.overflow);
+	fflush(stdout);
+	__lg.updates = 0;
+	__lg.datagrams = 0;
+	__lg.bytes = 0;
+	__lg.last_report = now;
+}
+
+// tickごとに、前回からの経過時間で期限を迎えた更新数だけ仮想ノードを順に送る。
+// タイマが遅れても平均のレートは保たれる。
+static void
+loadgen_timer_cb(wq_item_t *item, wq_arg_t arg)
+{
+	uint64_t now = nn_lat_now();
+	uint64_t n;
+
+	if (__lg.active < __lg.nodes &&
+	    now - __lg.last_ramp >= (uint64_t)__lg.interval * 1000000000ull) {
+		__lg.active += __lg.step;
+		if (__lg.active > __lg.nodes) {
+			__lg.active = __lg.nodes;
+		}
+		__lg.last_ramp = now;
+	}
+
+	__lg.credit += (uint64_t)__lg.active * __lg.rate * (now - __lg.last_tick);
+	__lg.last_tick = now;
+	for (n = __lg.credit / 1000000000ull; n; n--) {
+		if (__lg.next >= __lg.active) {
+			__lg.next = 0;
+		}
+		loadgen_send_node(__lg.next++);
+	}
+	__lg.credit %= 1000000000ull;
+
+	if (now - __lg.last_report >= 1000000000ull) {
+		loadgen_report(now);
+	}
+	if (__lg.duration && now - __lg.start >= (uint64_t)__lg.duration * 1000000000ull) {
+		exit(0);
+	}
+	wq_timer_sched(item, WQ_TIME_US(LOADGEN_TICK_US), loadgen_timer_cb, NULL);
+}
+
+static int
+loadgen_parse_size(const char *s)
+{
+	char *end;
+
+	__lg.size_min = strtoul(s, &end, 0);
+	__lg.size_max = *end == '-' ? strtoul(end + 1, NULL, 0) : __lg.size_min;
+	// 先頭にnn_loadgen_payload_tを置く。
+	if (__lg.size_min < sizeof(nn_loadgen_payload_t)) {
+		__lg.size_min = sizeof(nn_loadgen_payload_t);
+	}
+	if (__lg.size_max < __lg.size_min) {
+		__lg.size_max = __lg.size_min;
+	}
+	return 0;
+}
+
+static void
+usage(const char *prog)
+{
+	printf("usage: %s [-n nodes] [-m objects] [-r rate] [-s size|min-max]\n"
+	       "          [-i initial] [-S step] [-T interval] [-d seconds]\n"
+	       "          [-a addr] [-p port] [-P pps] [-z pktmaxsz]\n", prog);
+}
+
+int
+main(int argc, char *argv[])
+{
+	nn_param_t	param;
+	const char	*addr = NULL;
+	int		port = NN_LOADGEN_PORT;
+	uint32_t	pps = 0;
+	uint32_t	maxsz;
+	uuid_t		node_uuid;
+	size_t		i;
+	int		opt;
+
+	__lg.nodes = 1000;
+	__lg.objects = 4;
+	__lg.rate = 10;
+	__lg.initial = 0;
+	__lg.step = 0;
+	__lg.interval = 10;
+	__lg.pktmaxsz = NN_DATAGRAM_PACKETMAXSZ;
+	loadgen_parse_size("32");
+	while ((opt = getopt(argc, argv, "n:m:r:s:i:S:T:d:a:p:P:z:h")) != -1) {
+		switch (opt) {
+		case 'n': __lg.nodes = strtoul(optarg, NULL, 0); break;
+		case 'm': __lg.objects = strtoul(optarg, NULL, 0); break;
+		case 'r': __lg.rate = strtoul(optarg, NULL, 0); break;
+		case 's': loadgen_parse_size(optarg); break;
+		case 'i': __lg.initial = strtoul(optarg, NULL, 0); break;
+		case 'S': __lg.step = strtoul(optarg, NULL, 0); break;
+		case 'T': __lg.interval = strtoul(optarg, NULL, 0); break;
+		case 'd': __lg.duration = strtoul(optarg, NULL, 0); break;
+		case 'a': addr = optarg; break;
+		case 'p': port = atoi(optarg); break;
+		case 'P': pps = strtoul(optarg, NULL, 0); break;
+		case 'z': __lg.pktmaxsz = strtoul(optarg, NULL, 0); break;
+		default: usage(argv[0]); return 1;
+		}
+	}
+	// 受信側のノードが持てるオブジェクト数と、1データグラムに入る大きさに制限する。
+	maxsz = __lg.pktmaxsz - sizeof(nn_msg_upd_header_t) - sizeof(nn_msg_updobj_header_t);
+	if (!__lg.nodes || !__lg.objects || __lg.objects > NN_DUUID_OBJECTS || __lg.size_max > maxsz) {
+		printf("invalid parameter. nodes=%u objects=%u (max %u) size=%u-%u (max %u)\n",
+		       __lg.nodes, __lg.objects, NN_DUUID_OBJECTS, __lg.size_min, __lg.size_max, maxsz);
+		return 1;
+	}
+	if (!__lg.initial || __lg.initial > __lg.nodes) {
+		__lg.initial = __lg.nodes;
+	}
+	if (!__lg.step) {
+		__lg.step = __lg.initial;
+	}
+
+	__lg.uuid = (uuid_t *)malloc(__lg.nodes * sizeof(uuid_t));
+	__lg.seq = (uint32_t *)calloc(__lg.nodes, sizeof(uint32_t));
+	__lg.size = (uint16_t *)malloc((size_t)__lg.nodes * __lg.objects * sizeof(uint16_t));
+	__lg.buf = (char *)malloc(__lg.pktmaxsz);
+	if (!__lg.uuid || !__lg.seq || !__lg.size || !__lg.buf) {
+		printf("malloc() error.\n");
+		return 1;
+	}
+	// オブジェクトの大きさは作成時に決まるので、分布からの抽選は最初に1回だけ行う。
+	for (i = 0; i < __lg.nodes; i++) {
+		uuid_generate(__lg.uuid[i]);
+	}
+	for (i = 0; i < (size_t)__lg.nodes * __lg.objects; i++) {
+		__lg.size[i] = __lg.size_min + rand() % (__lg.size_max - __lg.size_min + 1);
+	}
+
+	// 自ノードは受信しないので、ポートは任意でよい。
+	uuid_generate(node_uuid);
+	nn_param_init(&param);
+	param.pktmaxsz = __lg.pktmaxsz;
+	param.sndbuf = 16 * 1024 * 1024;
+	if (nn_initialize_param(&__lg.ctx, &node_uuid, 0, &param)) {
+		printf("nn_initialize_param() error.\n");
+		return 1;
+	}
+	nn_set_destination(&__lg.ctx, addr ? inet_addr(addr) : param.group, port);
+	nn_set_sendq_limit(&__lg.ctx, 65536, NN_SENDQ_DROP_OLDEST);
+	if (pps) {
+		nn_set_pacing(&__lg.ctx, pps, 0, 64, 0);
+	}
+	nn_start(&__lg.ctx);
+
+	printf("loadgen: nodes=%u objects=%u rate=%u/s size=%u-%u initial=%u step=%u/%us\n",
+	       __lg.nodes, __lg.objects, __lg.rate, __lg.size_min, __lg.size_max,
+	       __lg.initial, __lg.step, __lg.interval);
+	__lg.active = __lg.initial;
+	__lg.start = __lg.last_report = __lg.last_ramp = __lg.last_tick = nn_lat_now();
+	wq_init_item_prio(&__lg.timer, 0);
+	wq_timer_sched(&__lg.timer, WQ_TIME_US(LOADGEN_TICK_US), loadgen_timer_cb, NULL);
+
+	wq_run();
+	return 0;
+}
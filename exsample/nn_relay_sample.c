@@ -0,0 +1,98 @@
+/* --
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2018 Abe Takafumi
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. *
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <arpa/inet.h>
+#include <wq/wq.h>
+#include <nn.h>
+#include <nn_relay.h>
+
+// 中継ノードのサンプル
+//
+// 下流のグループ(down_port)で受信した更新を窓ごとに集約し、
+// 上流の宛先(up_addr:up_port)へ束にして送る。
+//   sample-nn-relay <down_port> <up_addr> <up_port> [window_ms]
+
+static nn_context_t	__down;
+static nn_context_t	__up;
+static nn_relay_t	*__relay;
+static wq_item_t	__timer;
+
+// 1秒ごとに中継の統計を表示する。
+static void
+timer_sched_cb(wq_item_t *item, wq_arg_t arg)
+{
+	nn_relay_stat_t stat;
+
+	nn_relay_get_stat(__relay, &stat);
+	printf("updates=%llu nodes=%llu objects=%llu datagrams=%llu bytes=%llu hops_drop=%llu nomem_drop=%llu\n",
+	       (unsigned long long)stat.updates, (unsigned long long)stat.nodes,
+	       (unsigned long long)stat.objects, (unsigned long long)stat.datagrams,
+	       (unsigned long long)stat.bytes, (unsigned long long)stat.hops_drop,
+	       (unsigned long long)stat.nomem_drop);
+	wq_timer_sched(item, WQ_TIME_US(1000000), timer_sched_cb, NULL);
+}
+
+int
+main(int argc, char *argv[])
+{
+	nn_relay_param_t	param;
+	uuid_t			node_uuid = {0};
+
+	if (argc < 4) {
+		printf("usage: %s <down_port> <up_addr> <up_port> [window_ms]\n", argv[0]);
+		return 1;
+	}
+	nn_relay_param_init(&param);
+	if (argc > 4) {
+		param.window_us = atoi(argv[4]) * 1000;
+	}
+
+	// 上流と下流で同じUUIDを使い、自分の束を受信しても捨てるようにする。
+	uuid_generate(node_uuid);
+	if (nn_initialize(&__down, &node_uuid, atoi(argv[1])) ||
+	    nn_initialize(&__up, &node_uuid, 0)) {
+		printf("nn_initialize() error.\n");
+		return 1;
+	}
+	nn_set_destination(&__up, inet_addr(argv[2]), atoi(argv[3]));
+	nn_start(&__down);
+	nn_start(&__up);
+
+	__relay = nn_relay_start(&__down, &__up, &param);
+	if (!__relay) {
+		printf("nn_relay_start() error.\n");
+		return 1;
+	}
+
+	wq_init_item_prio(&__timer, 0);
+	wq_sched(&__timer, timer_sched_cb, NULL);
+
+	wq_run();
+	return 0;
+}
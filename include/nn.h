@@ -33,12 +33,23 @@
 #include <wq/wq.h>
 #include <wq/wq-event.h>
 #include <netinet/in.h>
+#include <pthread.h>
+#include <nn_latency.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 // --------------------------------
 // プロトコル
+// 数値はすべてリトルエンディアンで、構造体はパディングなしで並べる(nn_wire.h)。
 
 enum {
-	NN_MSG_UPDATE,
+	NN_MSG_UPDATE,		// オブジェクトの更新通知
+	NN_MSG_WRITE,		// 指定ノードのオブジェクトへの書き込み
+	NN_MSG_ACK,		// 書き込みの応答
+	NN_MSG_NAME,		// ノードとオブジェクトの名前(struct nn_direntryの並び)
+	NN_MSG_BUNDLE,		// 中継ノードがまとめた複数ノードの更新(nn_relay.h)
 };
 
 enum {
@@ -57,8 +68,15 @@ typedef struct nn_msg_upd_header
 {
 	uuid_t		uuid;		// 0x00: ノードのUUID
 	uint8_t		objects;	// 0x10: 登録されているオブジェクト数
-	uint8_t		rsv[15];	// 0x11: 予約
-} nn_msg_upd_header_t;
+	uint8_t		flags;		// 0x11: NN_MSG_FL_*
+	uint8_t		type;		// 0x12: メッセージタイプ(NN_MSG_*)
+	uint8_t		version;	// 0x13: ワイヤフォーマットのバージョン(NN_WIRE_VERSION)
+	uint8_t		hops;		// 0x14: 中継された回数
+	uint8_t		rsv[3];		// 0x15: 予約
+	uint64_t	tstamp;		// 0x18: 送信時刻(ns, CLOCK_REALTIME)
+} __attribute__((packed)) nn_msg_upd_header_t;
+
+#define NN_MSG_FL_TSTAMP	(0x01)	// tstampが有効
 
 typedef struct nn_msg_updobj_header
 {
@@ -66,9 +84,40 @@ typedef struct nn_msg_updobj_header
 	uint16_t	type;		// 0x02: オブジェクトタイプ
 	uint16_t	offset;		// 0x04: データオフセット
 	uint16_t	size;		// 0x06: データサイズ
-} nn_msg_updobj_header_t;
+} __attribute__((packed)) nn_msg_updobj_header_t;
+
+// NN_MSG_WRITE: nn_msg_upd_header_tに続けて配置する。
+typedef struct nn_msg_write_header
+{
+	uuid_t		target;		// 0x00: 書き込み先ノードのUUID
+	uint32_t	seq;		// 0x10: シーケンス番号
+	uint16_t	idx;		// 0x14: 書き込み先オブジェクトのindex
+	uint16_t	type;		// 0x16: オブジェクトタイプ
+	uint16_t	offset;		// 0x18: データオフセット
+	uint16_t	size;		// 0x1a: データサイズ
+	uint32_t	rsv;		// 0x1c: 予約
+} __attribute__((packed)) nn_msg_write_header_t;
+
+// NN_MSG_ACK: nn_msg_upd_header_tに続けて配置する。
+typedef struct nn_msg_ack
+{
+	uuid_t		target;		// 0x00: 書き込み元ノードのUUID
+	uint32_t	seq;		// 0x10: 書き込みのシーケンス番号
+	int32_t		status;		// 0x14: 0:成功 負値:エラー(-errno)
+} __attribute__((packed)) nn_msg_ack_t;
+
+// NN_MSG_BUNDLE: nn_msg_upd_header_tに続けて、objects個の
+// (nn_msg_bundle_entry_t, sizeバイトのNN_MSG_UPDATEメッセージ)を並べる。
+typedef struct nn_msg_bundle_entry
+{
+	uint16_t	size;		// 0x00: 続くメッセージのサイズ
+	uint16_t	rsv;		// 0x02: 予約
+} __attribute__((packed)) nn_msg_bundle_entry_t;
 
-#define NN_DATAGRAM_PACKETMAXSZ (1500)
+#define NN_DATAGRAM_PACKETMAXSZ (1500)	// 最大データグラムサイズの既定値
+#define NN_DATAGRAM_LIMITSZ	(65507)	// UDP/IPv4で送れる最大サイズ
+// MTUからIPv4/UDPヘッダを除いたデータグラムサイズ
+#define NN_DATAGRAM_MTU2SZ(mtu)	((mtu) - 20 - 8)
 
 // --------------------------------
 
@@ -76,9 +125,18 @@ struct nn_context_node {
 	uuid_t			uuid;		// ノードのUUID
 };
 
+// 送信の優先度クラス。
+// クラスごとに送信バッファと送信キューを持ち、高いクラスから送信する。
+enum {
+	NN_PRIO_HIGH,		// アクチュエータへの指令など
+	NN_PRIO_NORMAL,		// 通常のセンサ情報
+	NN_PRIO_LOW,		// バルクのテレメトリ
+	NN_PRIO_NUM,
+};
+
 typedef struct nn_context_object {
 	uint8_t			idx;		// 0x00: ノード内のindex
-	uint8_t			rsv;		// 0x01: 予約
+	uint8_t			prio;		// 0x01: 送信の優先度クラス(NN_PRIO_*)
 	uint16_t		type;		// 0x02: オブジェクトタイプ
 	uint32_t		sz;		// 0x04: サイズ
 	char			addr[0];	// 0x08: オブジェクトデータ
@@ -89,16 +147,27 @@ nn_context_object_init(nn_context_object_t *obj, uint16_t idx, uint16_t type, ui
 	obj->idx = idx;
 	obj->type = type;
 	obj->sz = sz;
+	// モータは指令の遅延が効くので既定で高優先度にする。
+	obj->prio = (type == NN_OBJTYPE_TACHO_MOTOR) ? NN_PRIO_HIGH : NN_PRIO_NORMAL;
+}
+
+static inline void
+nn_context_object_set_prio(nn_context_object_t *obj, uint8_t prio) {
+	obj->prio = prio < NN_PRIO_NUM ? prio : NN_PRIO_LOW;
 }
 
 struct nn_send_buf
 {
 	struct list_head	list;
+	uint64_t		ts;		// 送信要求時刻(遅延計測用)
+	uint64_t		objmask;	// 含まれているオブジェクトのindex
+	uint64_t		fullmask;	// オブジェクト全体を含んでいるindex
 	uint32_t		sz;
 	char			buf[0];
 };
 
 #define NN_CTX_OBJECTS	(32)
+#define NN_NAME_MAX	(63)	// 名前の最大長(終端を含まない)
 struct nn_context_objects {
 	// ノード内の登録情報。
 	// 登録順番はプログラムで固定することで、UUIDとindexで
@@ -109,11 +178,104 @@ struct nn_context_objects {
 	struct nn_context_object	*object[NN_CTX_OBJECTS];
 };
 
+// 送信キューがあふれたときの方針
+enum {
+	NN_SENDQ_DROP_OLDEST,	// 最も古いパケットを捨てる
+	NN_SENDQ_SUPERSEDE,	// 新しいパケットで全て上書きされるパケットを捨て、
+				// それでもあふれれば最も古いパケットを捨てる
+};
+
+// 送信キューの統計(優先度クラスごと)
+typedef struct nn_sendq_stat {
+	uint32_t		depth;		// 現在のキュー長
+	uint32_t		hwm;		// キュー長の最大値
+	uint64_t		enqueued;	// キューへ入れたパケット数
+	uint64_t		sent;		// 送信したパケット数
+	uint64_t		superseded;	// 上書きされて捨てたパケット数
+	uint64_t		overflow;	// あふれて捨てたパケット数
+} nn_sendq_stat_t;
+
+#define NN_SENDQ_DEFAULT_LIMIT	(256)
+#define NN_WRITE_RECENT		(16)	// 重複を検出する書き込みの履歴数
+
+// 送信バッファ。bufはコンテキストの最大データグラムサイズまで確保する。
 typedef struct nn_update_sendbuf {
 	nn_msg_upd_header_t	header;
-	char			buf[NN_DATAGRAM_PACKETMAXSZ - sizeof(nn_msg_upd_header_t)];
+	char			buf[0];
 } nn_update_sendbuf_t;
 
+// nn_initialize_param()のパラメータ。nn_param_init()で既定値にしてから変更する。
+typedef struct nn_param {
+	uint32_t		pktmaxsz;	// 最大データグラムサイズ(送受信とも)
+	int			rcvbuf;		// SO_RCVBUF (0なら変更しない)
+	int			sndbuf;		// SO_SNDBUF (0なら変更しない)
+	in_addr_t		group;		// 参加するマルチキャストグループ(送信先の既定値)
+	int			backend;	// データグラムの送受信方式(NN_IO_*)
+	uint32_t		uring_entries;	// NN_IO_URINGの投入キューと受信バッファの数
+} nn_param_t;
+
+// データグラムの送受信方式
+enum {
+	NN_IO_EPOLL,		// ソケットをwqのイベントで待ち、1つずつ送受信する(既定)
+	NN_IO_URING,		// io_uringのマルチショット受信とまとめた送信(nn_uring.h)
+};
+
+// 受信モード
+enum {
+	NN_RX_EVENT,		// wqのイベント駆動で受信する(既定)
+	NN_RX_BUSYPOLL,		// 専用スレッドでソケットをポーリングする
+	NN_RX_PIPELINE,		// 受信スレッドと反映スレッドに分ける
+};
+
+// ビジーポーリングのパラメータ。
+// 受信がなければ spin回スピン → yield回sched_yield() → sleep_usスリープ
+// の順でバックオフし、受信があれば先頭に戻る。
+typedef struct nn_busypoll_param {
+	int			cpu;		// 固定するCPU (-1なら固定しない)
+	uint32_t		busy_poll_us;	// SO_BUSY_POLLの値 (0なら設定しない)
+	uint32_t		spin;		// スピン回数
+	uint32_t		yield;		// sched_yield()回数
+	uint32_t		sleep_us;	// スリープ時間 (0ならスピンし続ける)
+} nn_busypoll_param_t;
+
+// パイプライン受信のパラメータ。
+// 受信スレッドはデータグラムを読むだけで、反映はUUIDのハッシュキーで
+// 選んだ反映スレッドが行う。同じノードは常に同じ反映スレッドが処理するので、
+// ノードごとの順序は保たれる。
+#define NN_PIPELINE_MAXWORKERS	(16)
+typedef struct nn_pipeline_param {
+	nn_busypoll_param_t	io;		// 受信スレッド(ポーリングとバックオフ)
+	uint32_t		workers;	// 反映スレッド数(2の累乗に切り下げる)
+	uint32_t		ring;		// 反映スレッドごとのバッファ数
+	int			worker_cpu;	// 反映スレッドを固定する先頭CPU。以降は連番 (-1なら固定しない)
+} nn_pipeline_param_t;
+
+typedef struct nn_pipeline_stat {
+	uint64_t		datagrams;	// 反映したデータグラム数
+	uint64_t		stalls;		// 空きバッファ待ちになった回数
+} nn_pipeline_stat_t;
+
+struct nn_context;
+struct nn_pipeline;
+struct nn_object;
+struct nn_capture;
+struct nn_publish;
+struct nn_sched;
+struct nn_notifier;
+struct nn_uring;
+struct nn_uring_stat;
+// 受信したオブジェクトを反映した後に呼び出される。
+typedef void (*nn_notify_hook_t)(struct nn_context *ctx,
+				 struct nn_object *obj, void *arg);
+// 自ノードのオブジェクトへ書き込まれた後に呼び出される。
+typedef void (*nn_write_hook_t)(struct nn_context *ctx,
+				struct nn_context_object *obj,
+				uint32_t offset, uint32_t size, void *arg);
+// 書き込みが完了(ack受信またはタイムアウト)したときに呼び出される。
+// statusは相手の応答(0または-errno)、タイムアウト時は-ETIMEDOUT。
+typedef void (*nn_write_cb_t)(struct nn_context *ctx, int status,
+			      uint64_t rtt_ns, void *arg);
+
 typedef struct nn_context {
 	struct nn_context_node		node;
 	struct nn_context_objects	objects;
@@ -122,21 +284,204 @@ typedef struct nn_context {
 		int			sock;
 		wq_ev_item_t		ev_item;
 		struct sockaddr_in	addr;
-		list_head_t		send_list;
-		uint32_t		send_cnt;
+		uint32_t		pktmaxsz;	// 最大データグラムサイズ
+		int			sndbuf;		// SO_SNDBUF (0なら変更しない)。prio_sockにも使う
+		char			*rxbuf;		// 受信バッファ(pktmaxsz)
+		list_head_t		send_list[NN_PRIO_NUM];
+		uint32_t		send_cnt;	// 全クラスの合計
+		uint32_t		sendq_limit;	// クラスごとのキュー長の上限(0なら無制限)
+		int			sendq_policy;	// NN_SENDQ_*
+		nn_sendq_stat_t		sendq_stat[NN_PRIO_NUM];
+		int			prio_sock[NN_PRIO_NUM];	// マーキング用(-1ならsockを使う)
+		struct nn_uring		*uring;		// NN_IO_URINGのとき(NULLならepoll)
 	} datagram;
 
 	struct {
 		uint32_t		usedsz;
-		nn_update_sendbuf_t	buffer;
-	} send;
+		uint64_t		open_ts;	// バッファへ最初に入れた時刻(遅延計測用)
+		uint64_t		objmask;	// バッファ内のオブジェクトのindex
+		uint64_t		fullmask;	// オブジェクト全体を入れたindex
+		nn_update_sendbuf_t	*buffer;
+	} send[NN_PRIO_NUM];
+
+	// 送信ペーシング(トークンバケット)
+	struct {
+		uint32_t		pps;		// パケット/秒 (0なら制限なし)
+		uint32_t		bps;		// バイト/秒 (0なら制限なし)
+		uint64_t		cap_pkt;	// バケット容量 (ns単位のトークン)
+		uint64_t		cap_byte;
+		uint64_t		tok_pkt;	// 残りトークン
+		uint64_t		tok_byte;
+		uint64_t		last;		// 最後にトークンを補充した時刻
+		int			blocked;	// トークン待ち
+		wq_item_t		timer;
+		uint32_t		jitter_us;	// 送信要求をずらす最大時間
+		uint32_t		seed;		// ジッタの乱数
+		uint64_t		paced;		// トークン待ちになった回数
+		uint64_t		wait_ns;	// トークン待ち時間の合計
+	} pace;
+
+	struct {
+		int			mode;		// NN_RX_*
+		nn_busypoll_param_t	param;
+		pthread_t		thread;
+		volatile int		stop;
+		struct nn_pipeline	*pipeline;	// NN_RX_PIPELINE時の状態
+	} rx;
+
+	struct {
+		pthread_rwlock_t	lock;		// cbとargの組の排他(反映側は読み込みロック)
+		nn_notify_hook_t	cb;
+		void			*arg;
+	} hook;
+
+	// リモート書き込み
+	struct {
+		pthread_mutex_t		lock;		// pendingの排他(ackは受信スレッドで処理される)
+		list_head_t		pending;	// ack待ちの書き込み
+		uint32_t		seq;
+		uint32_t		timeout_us;	// 再送までの時間
+		uint32_t		retries;	// 再送回数
+		nn_write_hook_t		hook;
+		void			*hook_arg;
+		// 受信側: 再送された書き込みを二重に反映しないための最近の履歴
+		struct {
+			uuid_t		uuid;
+			uint32_t	seq;
+			int32_t		status;
+		} recent[NN_WRITE_RECENT];
+		uint32_t		recent_pos;
+	} write;
+
+	// 遅延計測
+	struct {
+		int			enable;
+		nn_lat_hist_t		hist[NN_LAT_STAGES];
+	} lat;
+
+	// 受信フィルタ(nn_filter.h)
+	struct {
+		int			attached;
+		uint32_t		drops;		// 付けたときのソケットのdrops
+		uint64_t		delivered;	// 付けてから受信したデータグラム数
+	} filter;
+
+	// 更新の通知(nn_notify.h)
+	struct {
+		pthread_rwlock_t	lock;		// slotの排他(反映側は読み込みロック)
+		uint32_t		cnt;		// 登録数(0なら反映側は何もしない)
+		struct nn_notifier	*slot[32];	// NN_NOTIFY_MAX
+	} notify;
+
+	// 受信の記録(nn_capture.h)
+	struct {
+		pthread_mutex_t		lock;		// 記録と停止(解放)の排他
+		struct nn_capture	*cap;		// NULLなら記録しない
+	} capture;
+	struct nn_publish		*publish;	// 変更の自動検出(nn_publish.h)
+	struct nn_sched			*sched;		// オブジェクトごとの送信周期(nn_timer.h)
+
+	// 名前の通知(nn_dentry.h)
+	struct {
+		char			node[NN_NAME_MAX + 1];
+		char			object[NN_CTX_OBJECTS][NN_NAME_MAX + 1];
+		uint32_t		period_ms;	// 再通知の周期(0なら開始時だけ)
+		wq_item_t		timer;
+	} name;
 } nn_context_t;
 
-extern void nn_initialize(nn_context_t *ctx, uuid_t *uuid, int port);
+extern void nn_param_init(nn_param_t *param);
+extern int nn_initialize_param(nn_context_t *ctx, uuid_t *uuid, int port,
+			       const nn_param_t *param);
+// 既定のパラメータでnn_initialize_param()を呼ぶ。
+// ソケットの準備に失敗したら-errno、メモリがなければ-ENOMEM。
+extern int nn_initialize(nn_context_t *ctx, uuid_t *uuid, int port);
+// NN_IO_URINGで動作していれば統計を返す。epollなら-ENOENT。
+extern int nn_get_uring_stat(nn_context_t *ctx, struct nn_uring_stat *stat);
 extern void nn_start(nn_context_t *ctx);
 extern int nn_add_object(nn_context_t *ctx, struct nn_context_object *addr);
+// 組み込みタイプはoffsetとsizeが4byte境界になければ-EINVAL。
 extern int nn_update_object(nn_context_t *ctx, struct nn_context_object *obj,
 			    uint32_t offset, uint32_t size);
+// 優先度クラスの送信にDSCPとSO_PRIORITYを付ける。
+// 負値を指定した項目は設定しない。クラス専用の送信ソケットを作成する。
+extern int nn_set_prio_marking(nn_context_t *ctx, int prio, int dscp, int sk_prio);
+// 送信キューの上限と、あふれたときの方針(NN_SENDQ_*)を設定する。
+extern void nn_set_sendq_limit(nn_context_t *ctx, uint32_t limit, int policy);
+extern int nn_get_sendq_stat(nn_context_t *ctx, int prio, nn_sendq_stat_t *stat);
+// 送信ペーシング。
+// pps/bpsで平均レートを、burst_pkts/burst_bytesで瞬間的に送れる量を決める。
+// pps, bpsともに0なら無効。リモート書き込みとackは対象外。
+extern void nn_set_pacing(nn_context_t *ctx, uint32_t pps, uint32_t bps,
+			  uint32_t burst_pkts, uint32_t burst_bytes);
+// 送信要求を[0, jitter_us)のランダムな時間だけ遅らせ、
+// 多数のノードが同時に送信するのを防ぐ。平均でjitter_us/2の遅延が増える。
+extern void nn_set_flush_jitter(nn_context_t *ctx, uint32_t jitter_us);
+// 通知フックを設定する。戻った時点で、以前のフックの呼び出しは終わっている。
+// フックの中から呼び出してはならない。
+extern void nn_set_notify_hook(nn_context_t *ctx, nn_notify_hook_t cb, void *arg);
+// 現在のフックがold_cbとold_argの組であるときだけ置き換える。違えば-EBUSY。
+extern int nn_replace_notify_hook(nn_context_t *ctx,
+				  nn_notify_hook_t old_cb, void *old_arg,
+				  nn_notify_hook_t cb, void *arg);
+// 送信先を変更する(ユニキャストも可)。受信するグループは変わらない。
+extern void nn_set_destination(nn_context_t *ctx, in_addr_t addr, int port);
+// 組み立て済みのデータグラムを送信キューへ入れる。
+// 上書き(NN_SENDQ_SUPERSEDE)の対象にはならない。
+extern void nn_send_datagram(nn_context_t *ctx, int prio, const void *buf, uint32_t sz);
+
+// リモート書き込み。
+// 指定UUIDのノードのオブジェクトidxへdataを書き込む。
+// 相手はnn_add_object()で登録したオブジェクトへ書き込み、ackを返す。
+// ackがtimeout_us以内に来なければretries回まで再送する。
+// 受信側は最近NN_WRITE_RECENT件の(送信元, seq)を覚えていて、
+// 再送を二重に反映せず前回の結果でackを返す。
+// 組み込みタイプはoffsetとsizeが4byte境界になければ-EINVAL。
+extern int nn_write_object(nn_context_t *ctx, uuid_t target,
+			   uint16_t idx, uint16_t type,
+			   uint16_t offset, const void *data, uint16_t size,
+			   nn_write_cb_t cb, void *arg);
+extern void nn_set_write_param(nn_context_t *ctx, uint32_t timeout_us, uint32_t retries);
+extern void nn_set_write_hook(nn_context_t *ctx, nn_write_hook_t cb, void *arg);
+
+// 遅延計測。
+// 有効にすると送信ヘッダに送信時刻を入れ、受信ソケットでSO_TIMESTAMPNSを
+// 使ってカーネルの受信時刻を取得し、区間ごとにヒストグラムへ記録する。
+extern int nn_latency_enable(nn_context_t *ctx, int enable);
+extern const nn_lat_hist_t * nn_get_latency(nn_context_t *ctx, int stage);
+extern void nn_latency_clear(nn_context_t *ctx);
+
+// ビジーポーリング受信。
+// nn_start()の後に開始する。開始後はwqでの受信は行わず、
+// NN_IO_URINGでは使えない(-EOPNOTSUPP)。
+// 受信とストアへの反映は専用スレッドで行う。
+// そのためストアを参照するスレッドは反映と並行して動くことになる。
+extern void nn_busypoll_param_init(nn_busypoll_param_t *param);
+extern int nn_start_busypoll(nn_context_t *ctx, const nn_busypoll_param_t *param);
+extern void nn_stop_busypoll(nn_context_t *ctx);
+
+// パイプライン受信。
+// nn_start()の後に開始する。NN_IO_URINGでは使えない(-EOPNOTSUPP)。通知フックは反映スレッドから並行して
+// 呼び出される。遅延計測のヒストグラムはスレッド間で排他しないので概算となる。
+extern void nn_pipeline_param_init(nn_pipeline_param_t *param);
+extern int nn_start_pipeline(nn_context_t *ctx, const nn_pipeline_param_t *param);
+extern void nn_stop_pipeline(nn_context_t *ctx);
+extern int nn_get_pipeline_stat(nn_context_t *ctx, uint32_t worker,
+				nn_pipeline_stat_t *stat);
+
+// 名前。
+// 名前は'/'を含まないNN_NAME_MAX文字までで、空文字列で名前なしに戻す。
+// nn_start()で通知し、以降はperiod_msごとに再通知する(既定1000ms)。
+// 開始後の変更は次の再通知で反映される。
+// 受信側では"/<UUID またはノード名>/<オブジェクト名>"で引ける(nn_dentry.h)。
+extern int nn_set_node_name(nn_context_t *ctx, const char *name);
+extern int nn_set_object_name(nn_context_t *ctx, struct nn_context_object *obj,
+			      const char *name);
+extern void nn_set_name_period(nn_context_t *ctx, uint32_t period_ms);
+
+// 受信したデータグラムとして処理させる。
+// 受信スレッド以外から呼ぶ場合は受信を止めておくこと。
+extern void nn_input_datagram(nn_context_t *ctx, char *buf, uint32_t sz);
 
 
 // --------------------------------
@@ -182,5 +527,9 @@ node networkの構成例
 	※ ノードはNICのMACアドレスで判断する。
 */
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* _NN_H_ */
 
@@ -0,0 +1,254 @@
+/* --
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2018 Abe Takafumi
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. *
+ *
+ */
+
+#ifndef _NN_HPP_
+#define _NN_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+// libsharakuのヘッダ(wq, list)はCリンケージで取り込む。
+extern "C" {
+#include <nn.h>
+#include <nn_inode.h>
+#include <nn_sensor_data.h>
+#include <nn_motor_data.h>
+}
+
+// libnnのC++ラッパ(ヘッダのみ)。
+//
+//	nn::Object<nn_sensor_gyro_t> gyro;
+//	gyro.attach(&ctx);
+//	gyro.set(&nn_sensor_gyro_t::angle, 90);	// angleの4byteだけ送る
+//
+// オブジェクトタイプとサイズはnn::ObjTraits<T>で型から決まる。
+// 独自の型はObjTraitsを特殊化して使う。
+//
+//	template <> struct nn::ObjTraits<my_data_t> {
+//		static const uint16_t type = NN_OBJTYPE_USER + 1;
+//	};
+
+namespace nn {
+
+template <typename T>
+struct ObjTraits;
+
+#define NN_OBJTRAITS(T, TYPE)					\
+	template <> struct ObjTraits<T> {			\
+		static const uint16_t type = (TYPE);		\
+	}
+
+NN_OBJTRAITS(nn_sensor_touch_t,		NN_OBJTYPE_TOUCH);
+NN_OBJTRAITS(nn_sensor_gyro_t,		NN_OBJTYPE_GYRO);
+NN_OBJTRAITS(nn_sensor_color_t,		NN_OBJTYPE_COLOR);
+NN_OBJTRAITS(nn_sensor_light_t,		NN_OBJTYPE_LIGHT);
+NN_OBJTRAITS(nn_sensor_usonic_t,	NN_OBJTYPE_USONIC);
+NN_OBJTRAITS(nn_motor_tacho_t,		NN_OBJTYPE_TACHO_MOTOR);
+NN_OBJTRAITS(nn_sensor_light_color_t,	NN_OBJTYPE_COLOR_LIGHT);
+
+// テンプレート引数の推論から外す。
+template <typename T>
+struct identity {
+	typedef T type;
+};
+
+// offset_of()の基準にする実体。型ごとに1つだけ静的に置く。
+template <typename T>
+struct offset_base {
+	static const T	obj;
+};
+template <typename T>
+const T offset_base<T>::obj = T();
+
+// メンバへのポインタからオフセットを求める。
+// 静的な実体のアドレスの差なので、インライン展開で定数に畳み込まれる。
+template <typename T, typename M>
+inline uint32_t
+offset_of(M T::*member)
+{
+	const T &base = offset_base<T>::obj;
+
+	return (uint32_t)((const char *)&(base.*member) - (const char *)&base);
+}
+
+// 自ノードのオブジェクト。
+// ヘッダの直後にデータを置くnn_upd_*_tと同じ配置にする。
+template <typename T>
+class Object {
+public:
+	static const uint16_t	type = ObjTraits<T>::type;
+	static const uint32_t	size = sizeof(T);
+
+	Object() : ctx_(NULL) {
+		memset(&obj_, 0, sizeof obj_);
+		nn_context_object_init(&obj_.header, 0, type, size);
+	}
+
+	// コンテキストへ登録する。
+	int attach(nn_context_t *ctx) {
+		int ret = nn_add_object(ctx, &obj_.header);
+
+		if (ret == 0) {
+			ctx_ = ctx;
+		}
+		return ret;
+	}
+
+	T &data() { return obj_.data; }
+	const T &data() const { return obj_.data; }
+	T *operator->() { return &obj_.data; }
+	const T *operator->() const { return &obj_.data; }
+	nn_context_object_t *header() { return &obj_.header; }
+
+	void set_prio(uint8_t prio) {
+		nn_context_object_set_prio(&obj_.header, prio);
+	}
+
+	// オブジェクト全体を送信する。
+	// 送信はattach()の後で行う。登録前は-ENOENTを返す。
+	int publish() {
+		return update(0, size);
+	}
+	// 1つのフィールドだけを送信する。
+	template <typename M>
+	int publish(M T::*member) {
+		return update(offset_of(member), sizeof(M));
+	}
+	// firstからlastまでの連続したフィールドを送信する。
+	template <typename M1, typename M2>
+	int publish(M1 T::*first, M2 T::*last) {
+		uint32_t begin = offset_of(first);
+		return update(begin, offset_of(last) + sizeof(M2) - begin);
+	}
+	// 値を設定して、そのフィールドだけを送信する。
+	template <typename M>
+	int set(M T::*member, const typename identity<M>::type &value) {
+		obj_.data.*member = value;
+		return publish(member);
+	}
+
+private:
+	struct storage {
+		nn_context_object_t	header;
+		T			data;
+	};
+
+	// コンテキストにはobj_.headerのアドレスを登録するので、コピーさせない。
+	Object(const Object &);
+	Object &operator=(const Object &);
+
+	int update(uint32_t offset, uint32_t sz) {
+		if (!ctx_) {
+			return -ENOENT;
+		}
+		return nn_update_object(ctx_, &obj_.header, offset, sz);
+	}
+
+	storage		obj_;
+	nn_context_t	*ctx_;
+};
+
+// 受信したオブジェクトの読み出し。
+// タイプとサイズが一致しなければNULLを返す。
+template <typename T>
+inline const T *
+read(const nn_d_object_t *obj)
+{
+	if (!obj || obj->objtype != ObjTraits<T>::type || obj->size < sizeof(T)) {
+		return NULL;
+	}
+	return (const T *)obj->addr;
+}
+
+// 1つのフィールドを読む。受信していない範囲ならfalseを返す。
+template <typename T, typename M>
+inline bool
+read(const nn_d_object_t *obj, M T::*member, M *value)
+{
+	uint32_t off = offset_of(member);
+
+	if (!obj || obj->objtype != ObjTraits<T>::type || obj->size < off + sizeof(M)) {
+		return false;
+	}
+	memcpy(value, &obj->addr[off], sizeof(M));
+	return true;
+}
+
+// ストアのロックをスコープの間だけ獲得する。
+class StoreLock {
+public:
+	StoreLock() { nn_store_lock(); }
+	~StoreLock() { nn_store_unlock(); }
+private:
+	StoreLock(const StoreLock &);
+	StoreLock &operator=(const StoreLock &);
+};
+
+// Tの全オブジェクトに対してfn(const nn_d_object_t *, const T &)を呼び出す。
+// fnはストアのロック中に呼ばれるので、ロックを取る関数は呼べない。
+template <typename T, typename F>
+inline void
+for_each(F fn)
+{
+	struct trampoline {
+		static int call(nn_d_object_t *obj, void *arg) {
+			const T *data = read<T>(obj);
+			if (data) {
+				(*(F *)arg)((const nn_d_object_t *)obj, *data);
+			}
+			return 0;
+		}
+	};
+	StoreLock lock;
+	nn_for_each_objtype(ObjTraits<T>::type, trampoline::call, &fn);
+}
+
+// 受信したオブジェクトの参照を保持する。
+template <typename T>
+class Ref {
+public:
+	explicit Ref(nn_d_object_t *obj) : obj_(obj) {}
+	~Ref() {
+		if (obj_) {
+			nn_put_dobject(obj_);
+		}
+	}
+
+	const T *get() const { return read<T>(obj_); }
+	const T *operator->() const { return get(); }
+	const nn_d_object_t *object() const { return obj_; }
+
+private:
+	Ref(const Ref &);
+	Ref &operator=(const Ref &);
+
+	nn_d_object_t	*obj_;
+};
+
+} // namespace nn
+
+#endif /* _NN_HPP_ */
@@ -0,0 +1,106 @@
+/* --
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2018 Abe Takafumi
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. *
+ *
+ */
+
+#ifndef _NN_CAPTURE_H_
+#define _NN_CAPTURE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <nn.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 受信データグラムの記録ファイル。
+// ヘッダに続けてレコードを並べる。レコードは8byte境界に揃えてあるので、
+// ファイルをmmapしてそのまま先頭から辿れる。
+//
+// +---------------------+
+// | nn_capture_header_t |
+// +---------------------+
+// | nn_capture_rec_t    |  ts, len
+// | data (len)          |  8byte境界までパディング
+// +---------------------+
+// | ...                 |
+#define NN_CAPTURE_MAGIC	(0x50434e4e)	// "NNCP"
+#define NN_CAPTURE_VERSION	(1)
+#define NN_CAPTURE_ALIGN(x)	(((x) + 7) & ~7u)
+
+typedef struct nn_capture_header {
+	uint32_t		magic;		// 0x00: NN_CAPTURE_MAGIC
+	uint16_t		version;	// 0x04: NN_CAPTURE_VERSION
+	uint16_t		hdrsz;		// 0x06: このヘッダのサイズ
+	uint32_t		pktmaxsz;	// 0x08: 記録したコンテキストの最大データグラムサイズ
+	uint32_t		rsv;		// 0x0c: 予約
+	uint64_t		start;		// 0x10: 記録開始時刻(ns, CLOCK_REALTIME)
+	uint64_t		rsv2;		// 0x18: 予約
+} nn_capture_header_t;
+
+typedef struct nn_capture_rec {
+	uint64_t		ts;		// 0x00: 受信時刻(ns, CLOCK_REALTIME)
+	uint32_t		len;		// 0x08: データグラムのサイズ
+	uint32_t		rsv;		// 0x0c: 予約
+	char			data[0];	// 0x10: データグラム
+} nn_capture_rec_t;
+
+struct nn_capture {
+	FILE			*fp;
+	uint64_t		records;
+	uint64_t		bytes;
+	uint64_t		errors;		// 書き込めなかったレコード
+};
+
+// 再生の速さ
+enum {
+	NN_REPLAY_ASAP,		// 待たずに全て投入する
+	NN_REPLAY_REALTIME,	// 記録時の受信間隔を再現する
+};
+
+typedef struct nn_replay_stat {
+	uint64_t		datagrams;	// 投入したデータグラム数
+	uint64_t		objects;	// 投入したオブジェクト数
+	uint64_t		bytes;		// 投入したバイト数
+	uint64_t		elapsed;	// 投入にかかった時間(ns)
+} nn_replay_stat_t;
+
+// 受信したデータグラムをpathへ記録する。
+// 停止は受信スレッド以外から呼んでよく、記録中のレコードを書き終えてから閉じる。
+extern int nn_capture_start(nn_context_t *ctx, const char *path);
+extern void nn_capture_stop(nn_context_t *ctx);
+// 受信処理からctx->capture.lock中に呼び出す。
+extern void nn_capture_write(struct nn_capture *cap, const void *buf,
+			     uint32_t sz, uint64_t ts);
+
+// 記録ファイルを受信処理(nn_input_datagram())へ投入する。
+extern int nn_replay(nn_context_t *ctx, const char *path, int mode,
+		     nn_replay_stat_t *stat);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _NN_CAPTURE_H_ */
@@ -0,0 +1,99 @@
+/* --
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2018 Abe Takafumi
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. *
+ *
+ */
+
+#ifndef _NN_COLUMN_H_
+#define _NN_COLUMN_H_
+
+#include <stdint.h>
+#include <nn_inode.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 組み込みセンサタイプ(nn_sensor_*)のカラムビュー。
+// 組み込みタイプは全フィールドがint32なので、フィールドごとに
+// 連続した配列(structure of arrays)へミラーする。
+// 全ノード横断の集計はポインタを辿らずに配列を舐めるだけでよい。
+//
+// field[n][row] : n番目のint32フィールド
+// node[row]     : 行のノード
+// owner[row]    : 行のオブジェクト
+#define NN_COLUMN_MAXFIELDS	(8)
+#define NN_COLUMN_ALIGN		(64)
+
+typedef struct nn_column {
+	uint16_t		objtype;	// オブジェクトのタイプ
+	uint16_t		nfields;	// int32フィールド数
+	uint32_t		rows;		// 使用している行数
+	uint32_t		cap;		// 確保している行数
+	int32_t			*field[NN_COLUMN_MAXFIELDS];
+	struct nn_d_uuid	**node;		// ノード列
+	struct nn_object	**owner;	// オブジェクト列
+} nn_column_t;
+
+typedef struct nn_column_stat {
+	uint32_t		count;
+	int32_t			min;
+	int32_t			max;
+	int64_t			sum;
+} nn_column_stat_t;
+
+// 指定タイプのカラムビューを有効にする。
+// 既に受信済みのオブジェクトはタイプ別インデックスから取り込む。
+// 組み込みタイプ以外は -EINVAL を返す。
+extern int nn_column_enable(uint16_t objtype);
+extern void nn_column_disable(uint16_t objtype);
+// カラムを読み込みロックして返す。有効でなければロックせずにNULLを返す。
+// 反映スレッドの行追加とnn_column_disable()は配列やカラム自体を解放するので、
+// field[]などはnn_column_read_unlock()までの間だけ参照すること。
+// ロック中にnn_store_lock()を取ったり、カラムを変更する関数を呼んではならない。
+extern const nn_column_t * nn_column_read_lock(uint16_t objtype);
+extern void nn_column_read_unlock(uint16_t objtype);
+
+// 受信処理から呼び出す。オブジェクトの内容をカラムへ反映する。
+// 既に行があれば書き換えるだけで、ストアのロックは取らない。
+extern void nn_column_apply(nn_d_object_t *dent_object);
+// オブジェクト解放、タイプ変更時にnn_store_lock()を獲得して呼び出す。
+extern void nn_column_remove(nn_d_object_t *dent_object);
+
+// 集計カーネル。
+// 分岐のない単純なループにしてあるので、-O2以上で自動ベクトル化される。
+extern int32_t nn_column_min(const int32_t *col, uint32_t n);
+extern int32_t nn_column_max(const int32_t *col, uint32_t n);
+extern int64_t nn_column_sum(const int32_t *col, uint32_t n);
+extern void nn_column_minmaxsum(const int32_t *col, uint32_t n, nn_column_stat_t *stat);
+// [lo, lo + width * nbins) をnbins個に分けたヒストグラム。
+// 範囲外の値は両端のbinに入れる。
+extern void nn_column_histogram(const int32_t *col, uint32_t n,
+				int32_t lo, int32_t width,
+				uint32_t *bins, uint32_t nbins);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _NN_COLUMN_H_ */
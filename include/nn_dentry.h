@@ -0,0 +1,101 @@
+/* --
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2018 Abe Takafumi
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. *
+ *
+ */
+
+#ifndef _NN_DENTRY_H_
+#define _NN_DENTRY_H_
+
+#include <stdint.h>
+#include <list.h>
+#include <nn.h>
+#include <nn_inode.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 名前とパス検索
+//
+// ノードは自分とオブジェクトに名前を付け、NN_MSG_NAMEで通知する。
+// 更新のたびには送らず、登録時と一定周期(後から参加したノード向け)だけ送る。
+// 受信側は名前をdentryとしてハッシュに登録し、パス
+//	"/<UUID またはノード名>/<オブジェクト名>"
+// で引けるようにする。
+// 検索結果のdentryはハンドルとして保持でき、以降は名前を引き直さずに
+// nn_dentry_get_object()でオブジェクトへたどれる。
+
+#define NN_DENTRY_NODE		(0xffff)	// ノード自体の名前を表すindex
+#define NN_DENTRY_HASHSZ	(1024)
+
+typedef struct nn_dentry {
+	list_head_t		hash;		// ハッシュにつながるリスト
+	list_head_t		sibling;	// 指すノードの名前のリスト
+	struct nn_d_uuid	*dir;		// 親ノード(ノードの名前はルートなのでNULL)
+	struct nn_d_uuid	*d_uuid;	// 指すノード(追い出されるとNULL)
+	uint32_t		hashkey;
+	uint32_t		ref;		// 参照数(ハッシュに登録中は1つ持つ)
+	uint16_t		idx;		// オブジェクトのindex(NN_DENTRY_NODEはノード自体)
+	uint8_t			name_len;
+	char			name[NN_NAME_MAX + 1];
+} nn_dentry_t;
+
+// 受信した名前を登録する。同じ対象の古い名前と、同じ親で同名の
+// 別の対象は置き換える。同じ名前の再通知は検索だけで終わる。
+extern int nn_dentry_set(nn_d_uuid_t *dent_uuid, uint16_t idx, const char *name, uint32_t len);
+// ノードをストアから外すときに、ノードを指すdentryを外す。
+// ストアのロック中に呼び出す。
+extern void nn_dentry_evict(nn_d_uuid_t *dent_uuid);
+
+// パスを引いて、参照を獲得したdentryを返す。見つからなければNULL。
+extern nn_dentry_t *nn_lookup_path(const char *path);
+// ノードdent_uuidのオブジェクト名を引く。
+extern nn_dentry_t *nn_lookup_name(nn_d_uuid_t *dent_uuid, const char *name);
+extern void nn_put_dentry(nn_dentry_t *dentry);
+
+// ハンドルの指すオブジェクトの参照を獲得して返す。nn_put_dobject()で返す。
+// ノードが追い出されたか、まだオブジェクトを受信していなければNULL。
+// 追い出された後は同じ名前でも別のdentryになるので、引き直すこと。
+// ストアのロックを取るので、nn_store_lock()中には呼び出さない。
+extern nn_d_object_t *nn_dentry_get_object(const nn_dentry_t *dentry);
+
+// nn_dentry_get_object()の参照を獲得しない版。
+// 反映スレッドの追い出しと排他するため、nn_store_lock()中に呼び出し、
+// 返したオブジェクトはロックを外すまでの間だけ使うこと。
+static inline nn_d_object_t *
+nn_dentry_peek_object(const nn_dentry_t *dentry)
+{
+	nn_d_uuid_t *d_uuid = __atomic_load_n(&dentry->d_uuid, __ATOMIC_ACQUIRE);
+
+	if (!d_uuid || dentry->idx == NN_DENTRY_NODE) {
+		return NULL;
+	}
+	return nn_peek_dobject(d_uuid, dentry->idx);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _NN_DENTRY_H_ */
@@ -0,0 +1,88 @@
+/* --
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2018 Abe Takafumi
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. *
+ *
+ */
+
+#ifndef _NN_FILTER_H_
+#define _NN_FILTER_H_
+
+#include <stdint.h>
+#include <uuid/uuid.h>
+#include <linux/filter.h>
+#include <nn.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// カーネルでの受信フィルタ
+//
+// UUIDの許可リストとオブジェクトタイプの一覧をclassic BPFのプログラムに変換し、
+// SO_ATTACH_FILTERで受信ソケットへ付ける。条件に合わないデータグラムは
+// ユーザ空間へコピーされる前にカーネルで捨てられる。
+//
+// ・フィルタするのはNN_MSG_UPDATEだけ。書き込み・応答・名前・束は常に通す。
+// ・UUIDの一覧が空ならすべてのノードを通す。
+// ・タイプの一覧が空ならすべてのタイプを通す。そうでなければ、
+//   先頭NN_FILTER_OBJECTS個のオブジェクトのどれかが一覧のタイプなら通す。
+//   それより多くのオブジェクトを持つデータグラムは判定できないので通す。
+#define NN_FILTER_MAXUUIDS	(64)
+#define NN_FILTER_MAXTYPES	(16)
+#define NN_FILTER_OBJECTS	(8)
+// 生成するプログラムの最大長
+// 固定部11命令、UUIDごとに9命令、オブジェクトごとに18命令とタイプ数。
+#define NN_FILTER_MAXINSNS	(11 + NN_FILTER_MAXUUIDS * 9 + \
+				 NN_FILTER_OBJECTS * (NN_FILTER_MAXTYPES + 18))
+
+typedef struct nn_filter {
+	uint32_t		nuuids;
+	uint32_t		ntypes;
+	uuid_t			uuid[NN_FILTER_MAXUUIDS];
+	uint16_t		type[NN_FILTER_MAXTYPES];
+} nn_filter_t;
+
+typedef struct nn_filter_stat {
+	uint64_t		delivered;	// ユーザ空間で受信したデータグラム数
+	uint64_t		dropped;	// カーネルで捨てたデータグラム数
+					// (SO_MEMINFOのdrops。受信バッファのあふれを含む)
+} nn_filter_stat_t;
+
+extern void nn_filter_init(nn_filter_t *filter);
+extern int nn_filter_add_uuid(nn_filter_t *filter, const uuid_t uuid);
+extern int nn_filter_add_type(nn_filter_t *filter, uint16_t objtype);
+// BPFのプログラムを生成する。命令数か、-errnoを返す。
+// maxinsns命令に収まらなければ-ENOSPC。NN_FILTER_MAXINSNSあれば必ず収まる。
+extern int nn_filter_compile(const nn_filter_t *filter, struct sock_filter *insns,
+			     uint32_t maxinsns);
+// 受信ソケットへ付ける。付け直すと前のフィルタは外れる。
+extern int nn_filter_attach(nn_context_t *ctx, const nn_filter_t *filter);
+extern int nn_filter_detach(nn_context_t *ctx);
+// 付けてからの数を返す。
+extern int nn_filter_get_stat(nn_context_t *ctx, nn_filter_stat_t *stat);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _NN_FILTER_H_ */
@@ -34,16 +34,31 @@
 #include <errno.h>
 #include <uuid/uuid.h>
 #include <list.h>
+#include <nn_radix.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 
 // libnnのUUID, オブジェクトはinodeにて管理する。
 // inodeはradix-treeにて管理する。
-// inode番号は64bitであり、上位 xxbitがUUID, 下位xxbitがオブジェクトindexとなる。
+// inode番号は64bitであり、上位58bitがノード番号, 下位6bitがオブジェクトindexとなる。
 // inode番号からオブジェクトindexとUUIDの関連付けがわかる。
+// ノード番号は作成順に1から振り、追い出されたノードの番号は再利用しない。
+// そのため古いinode番号で引くと、別のノードではなくNULLが返る。
+#define NN_INO_SHIFT		(6)
+#define NN_INO_IDXMASK		((1 << NN_INO_SHIFT) - 1)
+#define NN_INO_NODE		(NN_INO_IDXMASK)	// ノード自体を表すindex
+#define NN_INO(node, idx)	(((uint64_t)(node) << NN_INO_SHIFT) | (idx))
+#define NN_INO_NODENO(ino)	((ino) >> NN_INO_SHIFT)
+#define NN_INO_IDX(ino)		((uint32_t)(ino) & NN_INO_IDXMASK)
 
+// NN_MSG_NAMEの1エントリ。直後にname_len byteの名前(終端なし)が続く。
+// 数値はリトルエンディアン(nn_wire.h)。
 enum {
-	NN_DIRENTRY_TYPE_STRING,
-	NN_DIRENTRY_TYPE_UUID,
+	NN_DIRENTRY_TYPE_STRING,	// オブジェクトの名前。inoはオブジェクトのindex
+	NN_DIRENTRY_TYPE_UUID,		// ノード自体の名前。inoは未使用
 };
 struct nn_direntry {
 	uint8_t		name_len;
@@ -56,39 +71,224 @@ struct nn_object;
 struct nn_d_uuid;
 struct nn_d_uuidctx;
 
+#define NN_DUUID_OBJECTS	(32)	// ノード内のオブジェクト数
+
+// オブジェクトはサイズクラスごとのslabから確保する。
+// クラスは 64 << n byte (ヘッダ込み)で、作成時のサイズで決まり以降は変わらない。
+#define NN_DOBJECT_MINSZ	(64)
+#define NN_DOBJECT_CLASSES	(7)	// 64 ～ 4096
+#define NN_DOBJECT_CLASSSZ(c)	(NN_DOBJECT_MINSZ << (c))
+// オブジェクトに格納できる最大のデータサイズ
+#define NN_DOBJECT_DATASZ	(NN_DOBJECT_CLASSSZ(NN_DOBJECT_CLASSES - 1) - sizeof(nn_d_object_t))
+
+// 小さなオブジェクトはノードのエントリ内に直接置く(インライン)。
+// 読み出しはノードのエントリだけで完結する。
+#define NN_DUUID_INLINE		(4)	// インラインに置けるオブジェクト数
+#define NN_DINLINE_SZ		(72)	// インラインの1オブジェクトのサイズ(ヘッダ込み)
+#define NN_DINLINE_DATASZ	(NN_DINLINE_SZ - sizeof(nn_d_object_t))
+
+#define NN_DOBJ_FL_INLINE	(0x01)	// ノードのエントリ内にある
+
 // ファイル名がUUID Onlyの場合の構造体。
 typedef struct nn_object {
-	uint64_t		ino;		// inode番号 (下位6bitは データ管理用)
+	uint64_t		ino;		// inode番号 (下位6bitはオブジェクトindex)
 	uint16_t		objtype;	// オブジェクトのタイプ
 	uint16_t		idx;
 	uint32_t		size;		// inodeで管理しているオブジェクトのサイズ
 	struct nn_d_uuid	*d_uuid;
+	list_head_t		type_list;	// タイプ別インデックスにつながるリスト
+	uint32_t		col_row;	// カラムビューの行番号+1 (0は未登録)
+	uint16_t		capa;		// addrに格納できるサイズ
+	uint8_t			flags;		// NN_DOBJ_FL_*
+	uint8_t			sclass;		// サイズクラス(インラインは未使用)
+	uint64_t		gen;		// 最後に反映したときの世代
 	char			addr[0];	// 実データ。
 } nn_d_object_t;
 
+// map[]の値
+#define NN_DMAP_NONE		(0x00)	// オブジェクトなし
+					// 1～NN_DUUID_INLINE: inl[値-1]
+#define NN_DMAP_EXT		(0x80)	// ext[値 & NN_DMAP_SLOT]
+#define NN_DMAP_SLOT		(0x7f)
+
 typedef struct nn_d_uuid {
 	list_head_t		list;		// ハッシュにつながるリスト
 	list_head_t		list_entries;	// 全ノードのつながるリスト
-	uint64_t		ino;		// inode番号
+	list_head_t		lru;		// LRUリスト(更新順)
+	list_head_t		dentries;	// このノードを指す名前(nn_dentry.h)
+	uint64_t		ino;		// inode番号(下位6bitはNN_INO_NODE)
+	uint64_t		atime;		// 最後に更新を反映した時刻(ns)
+	uint64_t		gen;		// 最後に反映したときの世代
 	uuid_t			uuid;		// UUID
-	struct nn_object	*objects[32];	// オブジェクトリスト
+	uint8_t			map[NN_DUUID_OBJECTS];	// indexごとの格納場所(NN_DMAP_*)
+	uint8_t			extcnt;		// extの要素数
+	uint8_t			lrupart;	// LRUリストの番号
+	uint8_t			hops;		// 最後の更新が中継された回数
+	uint8_t			inlretired;	// 移動済みで再利用しないインラインの領域(bit)
+	uint32_t		memsz;		// このノードが使っているメモリ(外部オブジェクト込み)
+	struct nn_object	**ext;		// インラインに置けないオブジェクト(必要な分だけ確保)
+	// インラインのオブジェクト
+	char			inl[NN_DUUID_INLINE][NN_DINLINE_SZ] __attribute__((aligned(8)));
 } nn_d_uuid_t;
 
+// オブジェクトタイプ(NN_OBJTYPE_*)ごとのインデックス。
+// 同一タイプのオブジェクトを全ノード横断でリストにつなぐ。
+// タイプは疎な値なので、ハッシュで管理する。
+#define NN_TYPEIDX_HASHSZ	(64)
+#define NN_UUID_HASHSZ		(256)
+typedef struct nn_d_typeidx {
+	list_head_t		list;		// ハッシュにつながるリスト
+	list_head_t		objects;	// このタイプのオブジェクトのリスト
+	uint16_t		objtype;	// オブジェクトのタイプ
+	uint32_t		count;		// 登録されているオブジェクト数
+} nn_d_typeidx_t;
+
+// LRUはUUIDハッシュのキーで分割する。パイプライン受信の反映スレッドは
+// 同じ分割を使うので、各リストを更新するスレッドは1つに決まる。
+#define NN_STORE_LRUS		(16)
+
 typedef struct nn_d_uuidctx {
-	uint64_t		ino;		// inode番号
+	uint64_t		ino;		// 最後に振ったノード番号
+	nn_radix_t		ino_tree;	// ノード番号→ノード
 	list_head_t		list_entries;	// 全ノードのつながるリスト
-	list_head_t		uuid_hash[256];	// UUIDハッシュ
+	list_head_t		uuid_hash[NN_UUID_HASHSZ];	// UUIDハッシュ
+	list_head_t		type_hash[NN_TYPEIDX_HASHSZ];	// タイプ別インデックス
+	list_head_t		lru[NN_STORE_LRUS];	// 更新の古い順
+	uint32_t		owners;		// LRUを更新するスレッド数
+	uint64_t		budget;		// メモリ予算(0なら無制限)
+	uint64_t		memsz;		// 使用中のメモリ
+	uint64_t		nodes;
+	uint64_t		evictions;	// 追い出したノード数
+	uint64_t		evicted_bytes;	// 追い出したノードの使用メモリの合計
+	uint64_t		rejects;	// 予算内に収まらず作成しなかった回数
+	uint64_t		gen;		// 最後に振った世代
 } nn_d_uuidctx_t;
 
+// 変更の記録
+// 反映するたびにストア全体で1つずつ増える世代を振り、オブジェクトとノードに
+// 記録する。世代ごとに(世代, オブジェクトのinode番号)をリングへ書くので、
+// ある世代より後に変わったオブジェクトを変更数に比例するコストで辿れる。
+// リングからあふれた古い世代を指定された場合は、全ノードを走査する。
+#define NN_JOURNAL_SZ		(1 << 16)	// リングの要素数(2の累乗)
+
+typedef struct nn_journal_ent {
+	uint64_t		gen;		// 書き込み中は0
+	uint64_t		ino;
+} nn_journal_ent_t;
+
+typedef struct nn_store_stat {
+	uint64_t		budget;
+	uint64_t		memsz;
+	uint64_t		nodes;
+	uint64_t		evictions;
+	uint64_t		evicted_bytes;
+	uint64_t		rejects;
+} nn_store_stat_t;
+
 extern void nn_init(void);
+// ストアの構造変更(ノード/オブジェクトの追加、タイプ別インデックス、
+// カラムビュー)の排他。既存ノードの検索と反映はロックしない。
+// 同じハッシュキーのノードを複数スレッドで更新しないこと。
+extern void nn_store_lock(void);
+extern void nn_store_unlock(void);
+// UUIDハッシュのキー(0～NN_UUID_HASHSZ-1)を取得する。
+extern uint32_t nn_uuid_hashkey(uuid_t uuid);
+// 存在しなければ作成する。メモリ予算を超える場合は更新の古いノードを
+// 追い出し、それでも収まらなければNULLを返す。
 extern nn_d_uuid_t* nn_get_duuid(uuid_t uuid);
 extern void nn_put_duuid(nn_d_uuid_t *dent_uuid);
 extern nn_d_object_t* nn_get_dobject(nn_d_uuid_t *dent_uuid, uint32_t idx);
+// 存在しなければ、size(組み込みタイプはそのサイズ以上)を格納できる
+// オブジェクトを作成する。容量は作成時に決まる。
+extern nn_d_object_t* nn_alloc_dobject(nn_d_uuid_t *dent_uuid, uint32_t idx,
+				       uint16_t objtype, uint32_t size);
+// 容量がsizeに足りなければ、大きなサイズクラスへ内容ごと移す。
+// 渡した参照は消費し、移した先の参照を返す(失敗ならNULL)。inode番号は変わらない。
+// 古いオブジェクトの参照を持っている読み手は、古い内容を見続ける。
+// インラインだった領域は参照がノードの参照なので、ノードの解放まで再利用しない。
+extern nn_d_object_t* nn_grow_dobject(nn_d_object_t *dent_object, uint32_t size);
 extern void nn_put_dobject(nn_d_object_t *dent_object);
+// 検索で見つけたオブジェクトの参照を獲得する。追い出しと排他するため、
+// 見つけてから獲得するまでnn_store_lock()を獲得しておくこと。
+extern void nn_get_dobject_ref(nn_d_object_t *dent_object);
+// 作成せずに検索する。参照は獲得しない。
+extern nn_d_uuid_t* nn_lookup_duuid(uuid_t uuid);
+// inode番号で取得する。UUIDの検索を通らない。存在しなければNULL。
+// 参照を獲得するので、nn_put_duuid(), nn_put_dobject()で返す。
+// ストアのロックを取るので、nn_store_lock()中には呼び出さない。
+extern nn_d_uuid_t* nn_get_duuid_by_ino(uint64_t ino);
+extern nn_d_object_t* nn_get_by_ino(uint64_t ino);
+static inline nn_d_object_t *
+nn_peek_dobject(nn_d_uuid_t *dent_uuid, uint32_t idx)
+{
+	uint8_t map;
+
+	if (idx >= NN_DUUID_OBJECTS) {
+		return NULL;
+	}
+	map = dent_uuid->map[idx];
+	if (map == NN_DMAP_NONE) {
+		return NULL;
+	}
+	if (map & NN_DMAP_EXT) {
+		return dent_uuid->ext[map & NN_DMAP_SLOT];
+	}
+	return (nn_d_object_t *)dent_uuid->inl[map - 1];
+}
 
 // uuidリストを取得する。
 extern int nn_read_uuids(uuid_t uuid);
 extern nn_d_object_t * nn_read_objects(uuid_t uuid, nn_d_object_t *object);
 
+// ストアのメモリ予算(byte)。0なら無制限。
+extern void nn_set_store_budget(uint64_t budget);
+extern void nn_get_store_stat(nn_store_stat_t *stat);
+// ノード以外(名前など)のメモリをストアの使用量に加える(deltaは負値も可)。
+// dent_uuidがNULLならストア全体だけを増減する。
+extern void nn_store_account(nn_d_uuid_t *dent_uuid, int32_t delta);
+// 受信処理から呼び出す。オブジェクトへ反映した後に新しい世代を振る。
+extern uint64_t nn_dobject_changed(nn_d_object_t *dent_object);
+// 現在の世代。nn_changed_since()の最初の引数に使う。
+extern uint64_t nn_get_generation(void);
+// genより後に反映されたオブジェクトに対してcbを呼び出し、次に渡す世代を返す。
+// 同じオブジェクトが何度反映されていても呼び出しは1回。
+// 反映中の世代があればその手前で止めるので、次の呼び出しで同じオブジェクトを
+// もう一度呼び出すことがある。cbが0以外を返した場合はそこで中断する。
+// リングから外れた世代を指定した場合は、ストアのロックを取って全ノードを走査する。
+// cbはストアのロックを外してから呼び出すので、cbからストアの関数を呼んでよい。
+extern uint64_t nn_changed_since(uint64_t gen, int (*cb)(nn_d_object_t *, void *),
+				 void *arg);
+// 受信処理から呼び出す。ノードをLRUの末尾へ移す。
+extern void nn_touch_duuid(nn_d_uuid_t *dent_uuid);
+// LRUを更新するスレッド数(パイプライン受信の反映スレッド数)。
+// 追い出しは、作成するスレッドが担当するLRUからだけ行う。
+extern void nn_store_set_owners(uint32_t owners);
+// オブジェクトが使っているメモリ。インラインはノードに含まれるので0。
+static inline uint32_t
+nn_dobject_memsz(const nn_d_object_t *dent_object)
+{
+	return (dent_object->flags & NN_DOBJ_FL_INLINE) ?
+		0 : NN_DOBJECT_CLASSSZ(dent_object->sclass);
+}
+
+// オブジェクトタイプを設定し、タイプ別インデックスを更新する。
+extern void nn_set_dobject_type(nn_d_object_t *dent_object, uint16_t objtype);
+// 指定タイプのオブジェクトを順に取得する。
+// objectにNULLを指定すると先頭、それ以外は次のオブジェクトを返す。
+// 反映スレッドがタイプ変更や追い出しでリストを変えるので、
+// 先頭から最後まで辿る間nn_store_lock()を獲得しておくこと。
+extern nn_d_object_t * nn_read_objtype(uint16_t objtype, nn_d_object_t *object);
+// 指定タイプのオブジェクト数を取得する。ストアのロックを取る。
+extern uint32_t nn_count_objtype(uint16_t objtype);
+// 指定タイプの全オブジェクトに対してcbを呼び出す。
+// cbが0以外を返した場合はそこで中断し、その値を返す。
+// nn_store_lock()を獲得して呼び出すこと。cbからロックを取る関数は呼べない。
+extern int nn_for_each_objtype(uint16_t objtype,
+			       int (*cb)(nn_d_object_t *, void *), void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* _NN_INODE_H_ */
 
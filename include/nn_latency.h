@@ -0,0 +1,109 @@
+/* --
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2018 Abe Takafumi
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. *
+ *
+ */
+
+#ifndef _NN_LATENCY_H_
+#define _NN_LATENCY_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 遅延計測の区間
+enum {
+	NN_LAT_ENQ_FLUSH,	// nn_update_object()でバッファへ入れてから送信要求まで
+	NN_LAT_FLUSH_SEND,	// 送信要求からsendto()完了まで
+	NN_LAT_RX_APPLY,	// カーネルの受信時刻からストアへの反映完了まで
+	NN_LAT_APPLY_DELIVER,	// ストアへ書き込んでから、カラム・変更ジャーナル・
+				// フック・通知の待ち手へ渡し終えるまで
+				// (メッセージ内で最初に書き込んだオブジェクトから)
+	NN_LAT_E2E,		// 送信側の送信時刻から反映完了まで(時刻同期が前提)
+	NN_LAT_STAGES,
+};
+
+// 対数ヒストグラム。
+// 2のべき乗ごとの区間をさらに4分割する(誤差は最大25%)。
+// 加算は数命令なので常時有効にしておける。
+#define NN_LAT_SUBBITS		(2)
+#define NN_LAT_BUCKETS		(256)
+
+typedef struct nn_lat_hist {
+	uint64_t		count;
+	uint64_t		sum;		// ns
+	uint64_t		max;		// ns
+	uint64_t		bucket[NN_LAT_BUCKETS];
+} nn_lat_hist_t;
+
+static inline uint32_t
+nn_lat_bucket(uint64_t ns)
+{
+	uint32_t msb;
+
+	if (ns < (1 << NN_LAT_SUBBITS)) {
+		return (uint32_t)ns;
+	}
+	msb = 63 - __builtin_clzll(ns);
+	return ((msb - NN_LAT_SUBBITS + 1) << NN_LAT_SUBBITS) |
+	       ((ns >> (msb - NN_LAT_SUBBITS)) & ((1 << NN_LAT_SUBBITS) - 1));
+}
+
+static inline void
+nn_lat_hist_add(nn_lat_hist_t *hist, uint64_t ns)
+{
+	hist->count++;
+	hist->sum += ns;
+	if (ns > hist->max) {
+		hist->max = ns;
+	}
+	hist->bucket[nn_lat_bucket(ns)]++;
+}
+
+static inline uint64_t
+nn_lat_clock(clockid_t clk)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// 送受信をまたぐ区間はカーネルのタイムスタンプに合わせてCLOCK_REALTIME、
+// プロセス内の区間はCLOCK_MONOTONICを使う。
+#define nn_lat_now()		nn_lat_clock(CLOCK_MONOTONIC)
+#define nn_lat_realtime()	nn_lat_clock(CLOCK_REALTIME)
+
+extern void nn_lat_hist_clear(nn_lat_hist_t *hist);
+// p (0.0～1.0) のパーセンタイル値(ns)を返す。値はbinの上限値。
+extern uint64_t nn_lat_hist_percentile(const nn_lat_hist_t *hist, double p);
+extern const char * nn_lat_stage_name(int stage);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _NN_LATENCY_H_ */
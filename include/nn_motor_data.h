@@ -23,3 +23,101 @@
  * SOFTWARE. *
  *
  */
+
+#ifndef _NN_MOTOR_DATA_H_
+#define _NN_MOTOR_DATA_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <nn.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// タコモータへの指令
+enum nn_motor_command {
+	NN_MOTOR_CMD_NONE = 0,		// 指令なし
+	NN_MOTOR_CMD_RUN_FOREVER,	// speed_spで回し続ける
+	NN_MOTOR_CMD_RUN_TO_ABS_POS,	// position_spの絶対位置まで回す
+	NN_MOTOR_CMD_RUN_TO_REL_POS,	// 現在位置からposition_spだけ回す
+	NN_MOTOR_CMD_RUN_TIMED,		// time_sp[ms]だけ回す
+	NN_MOTOR_CMD_RUN_DIRECT,	// duty_cycle_spで直接駆動する
+	NN_MOTOR_CMD_STOP,		// stop_actionで停止する
+	NN_MOTOR_CMD_RESET,		// 状態を初期化する
+};
+
+// 停止方法
+enum nn_motor_stop_action {
+	NN_MOTOR_STOP_COAST = 0,	// 惰性で止める
+	NN_MOTOR_STOP_BRAKE,		// ブレーキをかける
+	NN_MOTOR_STOP_HOLD,		// 位置を保持する
+};
+
+// モータの状態(ビット)
+enum nn_motor_state {
+	NN_MOTOR_STATE_RUNNING	= 0x01,
+	NN_MOTOR_STATE_RAMPING	= 0x02,
+	NN_MOTOR_STATE_HOLDING	= 0x04,
+	NN_MOTOR_STATE_OVERLOAD	= 0x08,
+	NN_MOTOR_STATE_STALLED	= 0x10,
+};
+
+// 指令。コントローラがnn_write_object()で書き込む。
+typedef struct nn_motor_tacho_cmd {
+	int32_t		seq;		// 指令番号(同じ番号の再送は同じ指令)
+	int32_t		command;	// enum nn_motor_command
+	int32_t		stop_action;	// enum nn_motor_stop_action
+	int32_t		duty_cycle_sp;	// デューティ比[%]
+	int32_t		speed_sp;	// 速度[count/s]
+	int32_t		position_sp;	// 位置[count]
+	int32_t		time_sp;	// 時間[ms]
+} nn_motor_tacho_cmd_t;
+
+// 状態。ロボットがnn_update_object()で公開する。
+typedef struct nn_motor_tacho_state {
+	int32_t		cmd_seq;	// 最後に実行した指令番号
+	int32_t		position;	// 位置[count]
+	int32_t		speed;		// 速度[count/s]
+	int32_t		duty_cycle;	// デューティ比[%]
+	int32_t		state;		// enum nn_motor_stateの組み合わせ
+} nn_motor_tacho_state_t;
+
+typedef struct nn_motor_tacho {
+	nn_motor_tacho_cmd_t	cmd;	// 指令
+	nn_motor_tacho_state_t	state;	// 状態
+} nn_motor_tacho_t;
+
+// ---------------------------------------------
+
+typedef struct nn_upd_motor_tacho {
+	nn_context_object_t	header;	// ヘッダ
+	nn_motor_tacho_t	motor;
+} nn_upd_motor_tacho_t;
+static inline void
+nn_updmotor_tacho_init(nn_upd_motor_tacho_t *obj) {
+	memset(obj, 0, sizeof *obj);
+	nn_context_object_init(&obj->header, 0, NN_OBJTYPE_TACHO_MOTOR, sizeof(nn_motor_tacho_t));
+}
+
+// 指令部分だけを書き込む。
+static inline int
+nn_motor_tacho_command(nn_context_t *ctx, uuid_t target, uint16_t idx,
+		       const nn_motor_tacho_cmd_t *cmd,
+		       nn_write_cb_t cb, void *arg) {
+	return nn_write_object(ctx, target, idx, NN_OBJTYPE_TACHO_MOTOR,
+			       0, cmd, sizeof *cmd, cb, arg);
+}
+
+// 状態部分だけを公開する。
+static inline int
+nn_motor_tacho_publish_state(nn_context_t *ctx, nn_upd_motor_tacho_t *obj) {
+	return nn_update_object(ctx, &obj->header,
+				sizeof(nn_motor_tacho_cmd_t), sizeof(nn_motor_tacho_state_t));
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _NN_MOTOR_DATA_H_ */
@@ -0,0 +1,83 @@
+/* --
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2018 Abe Takafumi
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. *
+ *
+ */
+
+#ifndef _NN_NOTIFY_H_
+#define _NN_NOTIFY_H_
+
+#include <stdint.h>
+#include <uuid/uuid.h>
+#include <nn.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// eventfdによる更新の通知
+//
+// wqの外のスレッドが、ストアへの反映をepoll/pollで待てるようにする。
+// 通知はノード(UUID)とオブジェクトタイプで絞り込める。
+//
+// 何回反映されても、利用者がnn_notifier_consume()するまでeventfdへの
+// 書き込みは1回だけ行う。反映側の追加コストは、条件に合ったときの
+// アトミック操作だけになる。
+//
+//	fd = nn_notifier_fd(n);
+//	for (;;) {
+//		poll(fd) / epoll_wait()
+//		if (nn_notifier_consume(n)) {
+//			ストアを読む
+//		}
+//	}
+#define NN_NOTIFY_MAX		(32)	// コンテキストごとの登録数
+#define NN_NOTIFY_ANY_TYPE	(-1)	// すべてのオブジェクトタイプ
+
+typedef struct nn_notifier nn_notifier_t;
+
+// uuidがNULLならすべてのノード、objtypeがNN_NOTIFY_ANY_TYPEならすべてのタイプ。
+extern nn_notifier_t *nn_notifier_open(nn_context_t *ctx, const uuid_t uuid, int objtype);
+extern void nn_notifier_close(nn_context_t *ctx, nn_notifier_t *n);
+// poll/epollに登録するfd。読み出しはnn_notifier_consume()で行う。
+extern int nn_notifier_fd(const nn_notifier_t *n);
+// 前回から反映されたオブジェクト数を返し、次の通知を受けられるようにする。
+extern uint64_t nn_notifier_consume(nn_notifier_t *n);
+// 通知をtimeout_ms待ってconsumeする(-1なら無期限)。
+extern uint64_t nn_notifier_wait(nn_notifier_t *n, int timeout_ms);
+// eventfdへ書き込んだ回数
+extern uint64_t nn_notifier_wakeups(const nn_notifier_t *n);
+
+// 反映側から呼び出す。nn_notify_begin()が0以外を返したときだけ、
+// nn_notify_object()とnn_notify_end()を呼び出す。
+// ロックはnn_notify_object()とnn_notify_end()の中でだけ取るので、
+// 間に呼び出す通知フックからnn_notifier_open()/close()を呼んでよい。
+extern int nn_notify_begin(nn_context_t *ctx);
+extern uint32_t nn_notify_object(nn_context_t *ctx, const uuid_t uuid, uint16_t objtype);
+extern void nn_notify_end(nn_context_t *ctx, uint32_t mask);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _NN_NOTIFY_H_ */
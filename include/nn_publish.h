@@ -0,0 +1,71 @@
+/* --
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2018 Abe Takafumi
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. *
+ *
+ */
+
+#ifndef _NN_PUBLISH_H_
+#define _NN_PUBLISH_H_
+
+#include <stdint.h>
+#include <nn.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 変更の自動検出による送信
+//
+// 登録したオブジェクトごとに前回送信した内容(シャドウ)を持ち、
+// 周期ごとに実データと比べて変わったバイト範囲だけをnn_update_object()で送る。
+// 比較はワード単位で行い、変化のない32byteのブロックは1回の判定で飛ばす。
+// 送信とシャドウの更新は変化したバイト数にだけ比例する。
+//
+// ・範囲は4byte境界に揃える(ワイヤ形式の変換がワード単位のため)。
+// ・NN_PUBLISH_GAP byte未満の隙間で分かれた範囲は1つにまとめる。
+//   範囲ごとのヘッダ(8byte)より隙間を送る方が安い。
+// ・シャドウを持たないオブジェクト(開始後に登録したものを含む)は最初に全体を送る。
+#define NN_PUBLISH_GAP		(16)
+
+typedef struct nn_publish_stat {
+	uint64_t		ticks;		// 比較した回数
+	uint64_t		compared;	// 比較したバイト数
+	uint64_t		changed;	// 送信したバイト数
+	uint64_t		ranges;		// 送信した範囲の数
+	uint64_t		errors;		// nn_update_object()が失敗した回数
+} nn_publish_stat_t;
+
+// 変更の検出を開始する。tick_usごとにnn_publish_dirty()を呼び出す。
+// tick_usが0ならタイマは使わず、アプリケーションが呼び出す。
+extern int nn_publish_start(nn_context_t *ctx, uint32_t tick_us);
+// 検出を止める。タイマを使っていれば解放は次の周期で行う。
+extern void nn_publish_stop(nn_context_t *ctx);
+// 変わった範囲を送る。送った範囲の数か、-errnoを返す。
+extern int nn_publish_dirty(nn_context_t *ctx);
+extern int nn_get_publish_stat(nn_context_t *ctx, nn_publish_stat_t *stat);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _NN_PUBLISH_H_ */
@@ -0,0 +1,93 @@
+/* --
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2018 Abe Takafumi
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. *
+ *
+ */
+
+#ifndef _NN_RADIX_H_
+#define _NN_RADIX_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 64bitキーのradix-tree。
+// 1段でキーを6bitずつ使い、高さはキーの最大値に合わせて根の上へ伸ばす。
+// キーが連番に近いほど葉が埋まり、段数も少なくなる。
+// 更新は呼び出し元で排他する。検索はロックせずに行える。
+// ただし削除で空になったノードはすぐに解放するので、検索と並行して
+// 同じ範囲のキーを削除しないこと。
+#define NN_RADIX_BITS		(6)
+#define NN_RADIX_SLOTS		(1 << NN_RADIX_BITS)
+#define NN_RADIX_MASK		(NN_RADIX_SLOTS - 1)
+#define NN_RADIX_MAXDEPTH	((64 + NN_RADIX_BITS - 1) / NN_RADIX_BITS)
+
+typedef struct nn_radix_node {
+	uint32_t		shift;		// このノードが使うキーのbit位置(葉は0)
+	uint32_t		count;		// 使用中のslot数
+	void			*slot[NN_RADIX_SLOTS];
+} nn_radix_node_t;
+
+typedef struct nn_radix {
+	nn_radix_node_t		*root;
+	uint64_t		nodes;		// 確保しているノード数
+} nn_radix_t;
+
+// 根のノードで表せる範囲を超えているか。
+static inline int
+__nn_radix_over(const nn_radix_node_t *node, uint64_t key)
+{
+	return node->shift + NN_RADIX_BITS < 64 && (key >> (node->shift + NN_RADIX_BITS));
+}
+
+static inline void *
+nn_radix_lookup(const nn_radix_t *tree, uint64_t key)
+{
+	const nn_radix_node_t	*node = __atomic_load_n(&tree->root, __ATOMIC_ACQUIRE);
+	void			*p;
+
+	if (!node || __nn_radix_over(node, key)) {
+		return NULL;
+	}
+	for (;;) {
+		p = __atomic_load_n(&node->slot[(key >> node->shift) & NN_RADIX_MASK], __ATOMIC_ACQUIRE);
+		if (!node->shift || !p) {
+			return p;
+		}
+		node = (const nn_radix_node_t *)p;
+	}
+}
+
+// 登録済みのキーなら-EEXIST, メモリが足りなければ-ENOMEMを返す。
+extern int nn_radix_insert(nn_radix_t *tree, uint64_t key, void *item);
+// 削除した要素を返す。なければNULL。
+extern void *nn_radix_delete(nn_radix_t *tree, uint64_t key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _NN_RADIX_H_ */
@@ -0,0 +1,85 @@
+/* --
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2018 Abe Takafumi
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. *
+ *
+ */
+
+#ifndef _NN_RELAY_H_
+#define _NN_RELAY_H_
+
+#include <stdint.h>
+#include <nn.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 中継ノード
+//
+// 下流のコンテキストで受信・反映した更新をノードごとに窓の間だけ集約し、
+// 窓の終わりに各ノードの最新の状態をNN_MSG_BUNDLEへ詰めて上流へ送る。
+// 同じノードが窓の中で何度更新しても送るのは1回になる。
+//
+// ループ防止
+// ・束のUUIDが受信したコンテキストと同じなら捨てる(upとdownに同じUUIDを使う)。
+// ・中継するたびにhopsを1つ増やし、maxhops以上になった更新は転送しない。
+// ・中継ノード自身のUUIDのノードは転送しない。
+
+typedef struct nn_relay_param {
+	uint32_t		window_us;	// 集約する時間
+	uint8_t			maxhops;	// この回数以上中継された更新は転送しない
+	int			prio;		// 上流への送信クラス(NN_PRIO_*)
+} nn_relay_param_t;
+
+typedef struct nn_relay_stat {
+	uint64_t		updates;	// 下流で反映した更新(オブジェクト単位)
+	uint64_t		nodes;		// 上流へ送ったノード(窓ごとに数える)
+	uint64_t		objects;	// 上流へ送ったオブジェクト
+	uint64_t		datagrams;	// 上流へ送ったデータグラム
+	uint64_t		bytes;		// 上流へ送ったバイト数
+	uint64_t		hops_drop;	// 中継回数の上限で転送しなかった更新
+	uint64_t		nomem_drop;	// 集合を広げられずに転送しなかった更新
+} nn_relay_stat_t;
+
+typedef struct nn_relay nn_relay_t;
+
+extern void nn_relay_param_init(nn_relay_param_t *param);
+// downの通知フックで更新を集め、upの送信キューから送る。
+// 既に設定されていたフックは中継から続けて呼び出す。
+// upはnn_set_destination()で上流のグループまたはユニキャストの宛先にし、
+// nn_start()しておくこと。
+extern nn_relay_t *nn_relay_start(nn_context_t *down, nn_context_t *up,
+				  const nn_relay_param_t *param);
+// フックを元に戻す。解放は次の窓のタイマで行う。
+// 開始後に別のフックが設定されていれば、それを消さずに-EBUSYを返す(中継は続く)。
+// 通知フックの中から呼び出してはならない。
+extern int nn_relay_stop(nn_relay_t *relay);
+// 集約中の更新を今すぐ送る。通常は窓ごとにタイマから呼び出される。
+extern void nn_relay_flush(nn_relay_t *relay);
+extern void nn_relay_get_stat(nn_relay_t *relay, nn_relay_stat_t *stat);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _NN_RELAY_H_ */
@@ -0,0 +1,122 @@
+/* --
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2018 Abe Takafumi
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. *
+ *
+ */
+
+#ifndef _NN_RING_H_
+#define _NN_RING_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 単一生産者・単一消費者のロックフリーリング。
+// headは生産者だけが、tailは消費者だけが書き込む。
+// 相手側の位置はキャッシュしておき、満杯/空に見えたときだけ読み直す。
+#define NN_RING_CACHELINE	(64)
+
+typedef struct nn_ring {
+	// 共有(初期化後は読むだけ)
+	void			**slot;
+	uint32_t		mask;
+	// 生産者
+	uint32_t		head __attribute__((aligned(NN_RING_CACHELINE)));
+	uint32_t		tail_cache;
+	// 消費者
+	uint32_t		tail __attribute__((aligned(NN_RING_CACHELINE)));
+	uint32_t		head_cache;
+} __attribute__((aligned(NN_RING_CACHELINE))) nn_ring_t;
+
+// sizeは2の累乗に切り上げる。
+static inline int
+nn_ring_init(nn_ring_t *ring, uint32_t size)
+{
+	uint32_t n = 2;
+
+	while (n < size) {
+		n <<= 1;
+	}
+	ring->slot = (void **)calloc(n, sizeof(void *));
+	if (!ring->slot) {
+		return -ENOMEM;
+	}
+	ring->mask = n - 1;
+	ring->head = 0;
+	ring->tail_cache = 0;
+	ring->tail = 0;
+	ring->head_cache = 0;
+	return 0;
+}
+
+static inline void
+nn_ring_free(nn_ring_t *ring)
+{
+	free(ring->slot);
+	ring->slot = NULL;
+}
+
+// 生産者から呼び出す。満杯なら-EAGAIN。
+static inline int
+nn_ring_push(nn_ring_t *ring, void *p)
+{
+	uint32_t head = ring->head;
+
+	if (head - ring->tail_cache > ring->mask) {
+		ring->tail_cache = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+		if (head - ring->tail_cache > ring->mask) {
+			return -EAGAIN;
+		}
+	}
+	ring->slot[head & ring->mask] = p;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+// 消費者から呼び出す。空ならNULL。
+static inline void *
+nn_ring_pop(nn_ring_t *ring)
+{
+	uint32_t tail = ring->tail;
+	void *p;
+
+	if (tail == ring->head_cache) {
+		ring->head_cache = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		if (tail == ring->head_cache) {
+			return NULL;
+		}
+	}
+	p = ring->slot[tail & ring->mask];
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+	return p;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _NN_RING_H_ */
@@ -28,8 +28,13 @@
 #define _NN_SENSOR_DATA_H_
 
 #include <stdint.h>
+#include <string.h>
 #include <nn.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef struct nn_sensor_gyro {
 	int32_t		angle;		// 角度
 	int32_t		rate;		// 加速度
@@ -136,4 +141,8 @@ nn_upd_sensor_touch_init(nn_upd_sensor_touch_t *obj) {
 
 
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* _NN_SENSOR_DATA_H_ */
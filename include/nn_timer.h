@@ -0,0 +1,109 @@
+/* --
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2018 Abe Takafumi
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. *
+ *
+ */
+
+#ifndef _NN_TIMER_H_
+#define _NN_TIMER_H_
+
+#include <stdint.h>
+#include <list.h>
+#include <nn.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 階層タイマホイール
+//
+// 時刻はtick単位の通し番号。レベルlのスロットは64^l tickずつを受け持ち、
+// 期限がレベル0の範囲(64tick以内)に入ると下のレベルへ移す(カスケード)。
+// 登録・削除はO(1)で、1tick進めるコストは期限を迎えたタイマの数にだけ比例する。
+#define NN_TWHEEL_BITS		(6)
+#define NN_TWHEEL_SLOTS		(1 << NN_TWHEEL_BITS)
+#define NN_TWHEEL_MASK		(NN_TWHEEL_SLOTS - 1)
+#define NN_TWHEEL_LEVELS	(4)	// 64^4 tickまで
+
+typedef struct nn_timer {
+	list_head_t		list;		// スロットのリスト
+	uint64_t		expires;	// 期限(tick)
+} nn_timer_t;
+
+typedef struct nn_twheel {
+	uint64_t		now;		// 現在のtick
+	list_head_t		slot[NN_TWHEEL_LEVELS][NN_TWHEEL_SLOTS];
+} nn_twheel_t;
+
+extern void nn_twheel_init(nn_twheel_t *wheel, uint64_t now);
+// expiresが現在以前なら次のtickで期限を迎える。
+extern void nn_twheel_add(nn_twheel_t *wheel, nn_timer_t *timer, uint64_t expires);
+extern void nn_twheel_del(nn_timer_t *timer);
+// 1tick進め、期限を迎えたタイマをexpiredへ移す。
+extern void nn_twheel_advance(nn_twheel_t *wheel, list_head_t *expired);
+
+static inline void
+nn_timer_init(nn_timer_t *timer)
+{
+	init_list_head(&timer->list);
+	timer->expires = 0;
+}
+
+static inline int
+nn_timer_pending(const nn_timer_t *timer)
+{
+	return !list_empty(&timer->list);
+}
+
+// オブジェクトごとの送信周期
+//
+// nn_set_publish_period()で周期を設定したオブジェクトは、スケジューラが
+// 周期ごとにオブジェクト全体をnn_update_object()で送る。
+// 同じtickに期限を迎えたオブジェクトは続けて送信バッファへ入るので、
+// 1つのデータグラムにまとまる。周期はtickの倍数に切り上げる。
+typedef struct nn_sched_stat {
+	uint64_t		ticks;		// 進めたtick数
+	uint64_t		fired;		// 送信したオブジェクト数
+	uint64_t		late;		// タイマの遅れで追いついたtick数
+	uint64_t		skipped;	// 遅れの間に過ぎて送らなかった周期の数
+	uint64_t		errors;		// nn_update_object()が失敗した回数
+} nn_sched_stat_t;
+
+extern int nn_sched_start(nn_context_t *ctx, uint32_t tick_us);
+// スケジューラを止める。解放は次のtickで行う。
+extern void nn_sched_stop(nn_context_t *ctx);
+// period_usごとにobjを送る。0なら周期送信をやめる。
+extern int nn_set_publish_period(nn_context_t *ctx, struct nn_context_object *obj,
+				 uint32_t period_us);
+// ticks分進めて期限を迎えたオブジェクトを送る。送ったオブジェクト数を返す。
+// 進める間に同じオブジェクトが複数回期限を迎えても送るのは1回で、
+// 次の期限は進めた後のtickより後になる。
+// 通常は内部のタイマから呼び出される。
+extern int nn_sched_advance(nn_context_t *ctx, uint32_t ticks);
+extern int nn_get_sched_stat(nn_context_t *ctx, nn_sched_stat_t *stat);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _NN_TIMER_H_ */
@@ -0,0 +1,83 @@
+/* --
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2018 Abe Takafumi
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. *
+ *
+ */
+
+#ifndef _NN_URING_H_
+#define _NN_URING_H_
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// io_uringによるデータグラムの送受信(NN_IO_URING)
+//
+// 受信: 受信バッファのリング(provided buffer ring)を登録し、
+//       マルチショットのrecvmsgを1つ投入しておく。データグラムごとに完了が
+//       積まれるだけなので、定常状態では受信のシステムコールは発生しない。
+// 送信: 送信キューの内容をまとめてsendmsgとして投入し、1回のio_uring_enterで送る。
+//
+// 完了キューが空でなくなるとリングのfdが読み込み可能になるので、
+// wqのイベントはソケットの代わりにこのfdで待つ。
+// liburingには依存せず、システムコールとmmapで直接扱う。
+// 受信バッファのリングはLinux 5.19以降が必要。使えなければ初期化に失敗する。
+
+typedef struct nn_uring_stat {
+	uint64_t		enters;		// io_uring_enter()の呼び出し数
+	uint64_t		sends;		// 投入したsendmsg
+	uint64_t		send_errors;	// 失敗したsendmsg
+	uint64_t		recvs;		// 受信したデータグラム
+	uint64_t		truncated;	// 切り詰められて捨てたデータグラム
+	uint64_t		rearms;		// マルチショット受信を投入し直した回数
+	uint64_t		nobufs;		// 受信バッファが尽きた回数
+} nn_uring_stat_t;
+
+struct nn_uring;
+
+// 受信したデータグラムごとに呼び出される。rx_tsはSO_TIMESTAMPNSの時刻(なければ0)。
+typedef void (*nn_uring_recv_t)(void *arg, char *buf, uint32_t sz, uint64_t rx_ts);
+
+// entriesは投入キューの大きさと受信バッファ数(2の累乗に切り上げる)。
+extern int nn_uring_init(struct nn_uring **ring, int sock, uint32_t entries, uint32_t pktmaxsz);
+extern void nn_uring_free(struct nn_uring *ring);
+extern int nn_uring_fd(const struct nn_uring *ring);
+// sendmsgを投入キューへ入れる。bufは送信完了後にfree()する。
+// 空きがなければ-EBUSY。nn_uring_submit()まではカーネルへ渡らない。
+extern int nn_uring_sendmsg(struct nn_uring *ring, int sock, void *buf,
+			    void *data, uint32_t sz, const struct sockaddr_in *addr);
+extern int nn_uring_submit(struct nn_uring *ring);
+// 続けてnn_uring_sendmsg()できる数。
+extern uint32_t nn_uring_send_space(const struct nn_uring *ring);
+// 完了を処理する。処理した完了の数を返す。
+extern int nn_uring_reap(struct nn_uring *ring, nn_uring_recv_t recv, void *arg);
+extern void nn_uring_get_stat(const struct nn_uring *ring, nn_uring_stat_t *stat);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _NN_URING_H_ */
@@ -0,0 +1,175 @@
+/* --
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2018 Abe Takafumi
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. *
+ *
+ */
+
+#ifndef _NN_WIRE_H_
+#define _NN_WIRE_H_
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <nn.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ワイヤフォーマットのバージョン(nn_msg_upd_header_t::version)
+// 0はバージョンを持たない旧形式で、リトルエンディアンとして扱う。
+#define NN_WIRE_VERSION		(1)
+
+// ワイヤ上の数値はすべてリトルエンディアン。
+// リトルエンディアンのホストでは変換は消え、memcpyだけが残る。
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define NN_WIRE_BSWAP		(1)
+#define nn_wire16(x)		__builtin_bswap16((uint16_t)(x))
+#define nn_wire32(x)		__builtin_bswap32((uint32_t)(x))
+#define nn_wire64(x)		__builtin_bswap64((uint64_t)(x))
+#else
+#define NN_WIRE_BSWAP		(0)
+#define nn_wire16(x)		((uint16_t)(x))
+#define nn_wire32(x)		((uint32_t)(x))
+#define nn_wire64(x)		((uint64_t)(x))
+#endif
+
+// 変換は対称なので、符号化(ホスト→ワイヤ)と復号(ワイヤ→ホスト)は同じ操作。
+// 構造体のフィールドをその場で変換する。
+#define NN_WIRE_FIELD(p, f)						\
+	do {								\
+		switch (sizeof((p)->f)) {				\
+		case 2: (p)->f = nn_wire16((p)->f); break;		\
+		case 4: (p)->f = nn_wire32((p)->f); break;		\
+		case 8: (p)->f = nn_wire64((p)->f); break;		\
+		default: break;						\
+		}							\
+	} while (0)
+
+// 組み込みタイプのペイロードはint32_tの並びなので、ワード単位で変換する。
+// NN_OBJTYPE_RAWとNN_OBJTYPE_USER以降は中身を知らないのでそのまま運ぶ。
+static inline int
+nn_wire_objtype_words32(uint16_t type)
+{
+	return (type >= NN_OBJTYPE_TOUCH && type <= NN_OBJTYPE_USONIC) ||
+	       type == NN_OBJTYPE_TACHO_MOTOR ||
+	       type == NN_OBJTYPE_COLOR_LIGHT;
+}
+
+// ワード単位で変換するタイプは、範囲が4byte境界に揃っていなければ
+// -EINVALを返す。ワードの途中で切れた範囲は相手側で正しく戻せない。
+// エンディアンに関わらず同じ範囲を拒否するよう、常に検査する。
+static inline int
+nn_wire_check_payload(uint16_t type, uint32_t offset, uint32_t size)
+{
+	if (nn_wire_objtype_words32(type) && ((offset | size) & 3)) {
+		return -EINVAL;
+	}
+	return 0;
+}
+
+// ペイロード中の[offset, offset+size)を変換する。
+// offsetは構造体の先頭からの位置。
+static inline int
+nn_wire_swap_payload(void *data, uint16_t type, uint32_t offset, uint32_t size)
+{
+	int ret = nn_wire_check_payload(type, offset, size);
+
+	if (ret) {
+		return ret;
+	}
+#if NN_WIRE_BSWAP
+	if (nn_wire_objtype_words32(type)) {
+		uint8_t *p = (uint8_t *)data;
+		uint32_t w;
+
+		for (; size >= 4; p += 4, size -= 4) {
+			memcpy(&w, p, 4);
+			w = __builtin_bswap32(w);
+			memcpy(p, &w, 4);
+		}
+	}
+#else
+	(void)data;
+#endif
+	return 0;
+}
+
+// オブジェクトデータをワイヤ形式で(またはワイヤ形式から)コピーする。
+// 範囲が揃っていなければ何もコピーせずに-EINVALを返す。
+static inline int
+nn_wire_copy_payload(void *dst, const void *src, uint16_t type, uint32_t offset, uint32_t size)
+{
+	int ret = nn_wire_check_payload(type, offset, size);
+
+	if (ret) {
+		return ret;
+	}
+	memcpy(dst, src, size);
+	return nn_wire_swap_payload(dst, type, offset, size);
+}
+
+// ヘッダをワイヤ形式とホスト形式の間でコピーする。
+// 受信側はフィールドを読む前にホスト形式の作業領域へ取り出し、受信バッファは書き換えない。
+// リトルエンディアンのホストではmemcpyだけになる。
+static inline void
+nn_wire_copy_updobj_header(nn_msg_updobj_header_t *dst, const void *src)
+{
+	memcpy(dst, src, sizeof *dst);
+#if NN_WIRE_BSWAP
+	NN_WIRE_FIELD(dst, idx);
+	NN_WIRE_FIELD(dst, type);
+	NN_WIRE_FIELD(dst, offset);
+	NN_WIRE_FIELD(dst, size);
+#endif
+}
+
+static inline void
+nn_wire_copy_write_header(nn_msg_write_header_t *dst, const void *src)
+{
+	memcpy(dst, src, sizeof *dst);
+#if NN_WIRE_BSWAP
+	NN_WIRE_FIELD(dst, seq);
+	NN_WIRE_FIELD(dst, idx);
+	NN_WIRE_FIELD(dst, type);
+	NN_WIRE_FIELD(dst, offset);
+	NN_WIRE_FIELD(dst, size);
+	NN_WIRE_FIELD(dst, rsv);
+#endif
+}
+
+static inline void
+nn_wire_copy_ack(nn_msg_ack_t *dst, const void *src)
+{
+	memcpy(dst, src, sizeof *dst);
+#if NN_WIRE_BSWAP
+	NN_WIRE_FIELD(dst, seq);
+	NN_WIRE_FIELD(dst, status);
+#endif
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _NN_WIRE_H_ */
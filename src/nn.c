@@ -26,55 +26,116 @@
 
 // uuid-dev
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
 #include <unistd.h>
-#include <sys/eventfd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
 #include <nn.h>
 #include <wq/wq.h>
 #include <wq/wq-event.h>
 #include <log/log.h>
 #include <bitops.h>
 #include <nn_inode.h>
+#include <nn_column.h>
+#include <nn_capture.h>
+#include <nn_ring.h>
+#include <nn_wire.h>
+#include <nn_dentry.h>
+#include <nn_notify.h>
+#include <nn_uring.h>
 #include <slab.h>
+#include <stddef.h>
 
+// ワイヤフォーマットの配置はコンパイラやABIに依存させない。
+_Static_assert(sizeof(nn_msg_upd_header_t) == 0x20, "nn_msg_upd_header_t");
+_Static_assert(offsetof(nn_msg_upd_header_t, version) == 0x13, "version");
+_Static_assert(offsetof(nn_msg_upd_header_t, hops) == 0x14, "hops");
+_Static_assert(offsetof(nn_msg_upd_header_t, tstamp) == 0x18, "tstamp");
+_Static_assert(sizeof(nn_msg_updobj_header_t) == 0x08, "nn_msg_updobj_header_t");
+_Static_assert(sizeof(nn_msg_write_header_t) == 0x20, "nn_msg_write_header_t");
+_Static_assert(offsetof(nn_msg_write_header_t, seq) == 0x10, "seq");
+_Static_assert(sizeof(nn_msg_ack_t) == 0x18, "nn_msg_ack_t");
+_Static_assert(sizeof(struct nn_direntry) == 0x10, "nn_direntry");
+_Static_assert(sizeof(nn_msg_bundle_entry_t) == 0x04, "nn_msg_bundle_entry_t");
 
-static void __nn_notify_update(struct nn_context *ctx, char *buf, uint32_t sz);
-static void __nn_init_buffer(nn_context_t *ctx);
+static void __nn_recv_datagram(struct nn_context *ctx, char *buf, uint32_t sz, uint64_t rx_ts);
+static void __nn_notify_update(struct nn_context *ctx, char *buf, uint32_t sz, uint64_t rx_ts);
+static void __nn_notify_write(struct nn_context *ctx, char *buf, uint32_t sz);
+static void __nn_notify_ack(struct nn_context *ctx, char *buf, uint32_t sz);
+static void __nn_notify_name(struct nn_context *ctx, char *buf, uint32_t sz);
+static void __nn_notify_bundle(struct nn_context *ctx, char *buf, uint32_t sz, uint64_t rx_ts);
+static void __nn_send_names(struct nn_context *ctx);
+static void __nn_init_buffer(nn_context_t *ctx, int prio);
 static void nn_datagram_event(wq_item_t *item, wq_arg_t arg);
 
-static void
-nn_datagram_initialize(struct nn_context *ctx, int port)
+// wqで待つ受信側のイベント。
+// ビジーポーリング、パイプライン受信中は受信を専用スレッドが行うので待たない。
+static inline uint32_t
+__nn_rx_events(struct nn_context *ctx)
+{
+	return ctx->rx.mode == NN_RX_EVENT ? WQ_EVFL_FDIN : 0;
+}
+
+// 失敗したらソケットを閉じて-errnoを返す。
+static int
+nn_datagram_initialize(struct nn_context *ctx, int port, const nn_param_t *param)
 {
 	struct sockaddr_in udp_addr;
 	struct ip_mreq mreq;
 	int rc;
 
 	ctx->datagram.sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (ctx->datagram.sock < 0) {
+		rc = -errno;
+		wq_infolog64("socket() error. errno=%d", errno);
+		return rc;
+	}
 	udp_addr.sin_family = AF_INET;
 	udp_addr.sin_port = htons(port);
 	udp_addr.sin_addr.s_addr = INADDR_ANY;
 	rc = bind(ctx->datagram.sock, (struct sockaddr *)&udp_addr, sizeof(udp_addr));
 	if (rc) {
-		wq_infolog64("bind() error. rc=%d errno=%d", rc, errno);
-		return;
+		rc = -errno;
+		wq_infolog64("bind() error. errno=%d", -rc);
+		goto err;
+	}
+
+	// データグラムを大きくした場合はソケットバッファも合わせて広げる。
+	if (param->rcvbuf) {
+		rc = setsockopt(ctx->datagram.sock, SOL_SOCKET, SO_RCVBUF,
+				&param->rcvbuf, sizeof(param->rcvbuf));
+		if (rc) {
+			wq_infolog64("setsockopt(SO_RCVBUF) error. rc=%d errno=%d", rc, errno);
+		}
+	}
+	if (param->sndbuf) {
+		rc = setsockopt(ctx->datagram.sock, SOL_SOCKET, SO_SNDBUF,
+				&param->sndbuf, sizeof(param->sndbuf));
+		if (rc) {
+			wq_infolog64("setsockopt(SO_SNDBUF) error. rc=%d errno=%d", rc, errno);
+		}
 	}
 
 	/* setsockoptは、bind以降で行う必要あり */
 	memset(&mreq, 0, sizeof(mreq));
 	mreq.imr_interface.s_addr = INADDR_ANY;
-	mreq.imr_multiaddr.s_addr = inet_addr("239.192.1.2");
+	mreq.imr_multiaddr.s_addr = param->group;
 	rc = setsockopt(ctx->datagram.sock,
 			IPPROTO_IP,
 			IP_ADD_MEMBERSHIP,
 			(char *)&mreq, sizeof(mreq));
 	if (rc) {
-		wq_infolog64("setsockopt() error. rc=%d errno=%d", rc, errno);
-		return;
+		rc = -errno;
+		wq_infolog64("setsockopt() error. errno=%d", -rc);
+		goto err;
 	}
 
 	in_addr_t ipaddr = INADDR_ANY;
@@ -83,67 +144,415 @@ nn_datagram_initialize(struct nn_context *ctx, int port)
 			IP_MULTICAST_IF,
 			(char *)&ipaddr, sizeof(ipaddr));
 	if (rc) {
-		wq_infolog64("setsockopt() error. rc=%d errno=%d", rc, errno);
-		return;
+		rc = -errno;
+		wq_infolog64("setsockopt() error. errno=%d", -rc);
+		goto err;
 	}
 
 	ctx->datagram.addr.sin_family = AF_INET;
 	ctx->datagram.addr.sin_port = htons(port);
-	ctx->datagram.addr.sin_addr.s_addr = inet_addr("239.192.1.2");
+	ctx->datagram.addr.sin_addr.s_addr = param->group;
 
-	return;
+	return 0;
+
+err:
+	close(ctx->datagram.sock);
+	ctx->datagram.sock = -1;
+	return rc;
 }
+// 送信キューから捨てる。
 static void
-nn_datagram_send(struct nn_context *ctx, void *b, int sz)
+__nn_sendq_drop(struct nn_context *ctx, int prio, struct nn_send_buf *buf)
+{
+	list_del_init(&buf->list);
+	free(buf);
+	ctx->datagram.sendq_stat[prio].depth--;
+	ctx->datagram.send_cnt--;
+}
+
+// --------------------------------
+// 送信ペーシング
+// トークンは「ns × レート」の単位で持ち、1パケット(1バイト)で1e9消費する。
+#define NN_PACE_UNIT	(1000000000ull)
+
+static void
+__nn_pace_timer(wq_item_t *item, wq_arg_t arg)
+{
+	nn_context_t *ctx = (nn_context_t *)arg;
+
+	ctx->pace.blocked = 0;
+	wq_ev_sched(&ctx->datagram.ev_item, __nn_rx_events(ctx)|WQ_EVFL_FDOUT, nn_datagram_event);
+}
+
+// szバイトのパケットを送ってよければトークンを消費して1を返す。
+// 足りなければ補充されるまでのタイマを仕掛けて0を返す。
+static int
+__nn_pace_take(struct nn_context *ctx, uint32_t sz)
 {
-	struct nn_send_buf *buf = malloc(512);
-	memset(buf, 0, 512);
+	uint64_t now;
+	uint64_t elapsed;
+	uint64_t cost = (uint64_t)sz * NN_PACE_UNIT;
+	uint64_t wait = 0;
+	uint64_t w;
+
+	if (!ctx->pace.pps && !ctx->pace.bps) {
+		return 1;
+	}
+
+	now = nn_lat_now();
+	elapsed = now - ctx->pace.last;
+	if (elapsed > NN_PACE_UNIT) {
+		// 1秒以上空いたらバケットは満杯になっている。
+		elapsed = NN_PACE_UNIT;
+	}
+	ctx->pace.last = now;
+
+	if (ctx->pace.pps) {
+		ctx->pace.tok_pkt += elapsed * ctx->pace.pps;
+		if (ctx->pace.tok_pkt > ctx->pace.cap_pkt) {
+			ctx->pace.tok_pkt = ctx->pace.cap_pkt;
+		}
+		if (ctx->pace.tok_pkt < NN_PACE_UNIT) {
+			wait = (NN_PACE_UNIT - ctx->pace.tok_pkt + ctx->pace.pps - 1) / ctx->pace.pps;
+		}
+	}
+	if (ctx->pace.bps) {
+		ctx->pace.tok_byte += elapsed * ctx->pace.bps;
+		if (ctx->pace.tok_byte > ctx->pace.cap_byte) {
+			ctx->pace.tok_byte = ctx->pace.cap_byte;
+		}
+		if (ctx->pace.tok_byte < cost) {
+			w = (cost - ctx->pace.tok_byte + ctx->pace.bps - 1) / ctx->pace.bps;
+			wait = w > wait ? w : wait;
+		}
+	}
+
+	if (wait) {
+		if (!ctx->pace.blocked) {
+			ctx->pace.blocked = 1;
+			ctx->pace.paced++;
+			ctx->pace.wait_ns += wait;
+			wq_timer_sched(&ctx->pace.timer, WQ_TIME_US((wait + 999) / 1000),
+				       __nn_pace_timer, ctx);
+		}
+		return 0;
+	}
+
+	if (ctx->pace.pps) {
+		ctx->pace.tok_pkt -= NN_PACE_UNIT;
+	}
+	if (ctx->pace.bps) {
+		ctx->pace.tok_byte -= cost;
+	}
+	return 1;
+}
+
+void
+nn_set_pacing(nn_context_t *ctx, uint32_t pps, uint32_t bps,
+	      uint32_t burst_pkts, uint32_t burst_bytes)
+{
+	ctx->pace.pps = pps;
+	ctx->pace.bps = bps;
+	// バケットは最低でも1パケット(最大サイズ)は入るようにする。
+	ctx->pace.cap_pkt = (uint64_t)(burst_pkts ? burst_pkts : 1) * NN_PACE_UNIT;
+	if (burst_bytes < ctx->datagram.pktmaxsz) {
+		burst_bytes = ctx->datagram.pktmaxsz;
+	}
+	ctx->pace.cap_byte = (uint64_t)burst_bytes * NN_PACE_UNIT;
+	ctx->pace.tok_pkt = ctx->pace.cap_pkt;
+	ctx->pace.tok_byte = ctx->pace.cap_byte;
+	ctx->pace.last = nn_lat_now();
+}
+
+void
+nn_set_flush_jitter(nn_context_t *ctx, uint32_t jitter_us)
+{
+	ctx->pace.jitter_us = jitter_us;
+}
+
+static uint32_t
+__nn_pace_jitter(struct nn_context *ctx)
+{
+	// xorshift32。ノードごとに種が違えばよい。
+	uint32_t x = ctx->pace.seed;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	ctx->pace.seed = x;
+	return x % ctx->pace.jitter_us;
+}
+
+// 新しいパケットを入れる前にキューの上限を守る。
+static void
+__nn_sendq_reserve(struct nn_context *ctx, int prio, uint64_t fullmask)
+{
+	nn_sendq_stat_t		*stat = &ctx->datagram.sendq_stat[prio];
+	list_head_t		*head = &ctx->datagram.send_list[prio];
+	list_head_t		*pos = NULL;
+	list_head_t		*n = NULL;
+	struct nn_send_buf	*buf;
+
+	if (ctx->datagram.sendq_policy == NN_SENDQ_SUPERSEDE && fullmask) {
+		// 新しいパケットに全て含まれている古いパケットは送る意味がない。
+		list_for_each_safe(pos, n, head) {
+			buf = list_entry(pos, struct nn_send_buf, list);
+			if (buf->objmask && !(buf->objmask & ~fullmask)) {
+				__nn_sendq_drop(ctx, prio, buf);
+				stat->superseded++;
+			}
+		}
+	}
+
+	while (ctx->datagram.sendq_limit && stat->depth >= ctx->datagram.sendq_limit) {
+		// 最新の値を優先するので、古いものから捨てる。
+		buf = list_first_entry(head, struct nn_send_buf, list);
+		__nn_sendq_drop(ctx, prio, buf);
+		stat->overflow++;
+	}
+}
+
+static void
+nn_datagram_send(struct nn_context *ctx, int prio, const void *b, int sz,
+		 uint64_t objmask, uint64_t fullmask)
+{
+	nn_sendq_stat_t *stat = &ctx->datagram.sendq_stat[prio];
+	struct nn_send_buf *buf;
+
+	__nn_sendq_reserve(ctx, prio, fullmask);
+
+	buf = malloc(sizeof(*buf) + sz);
+	if (!buf) {
+		wq_infolog64("malloc() error. sz=%d", sz);
+		stat->overflow++;
+		return;
+	}
 	init_list_head(&buf->list);
 	memcpy(buf->buf, b, sz);
 	buf->sz = sz;
+	buf->objmask = objmask;
+	buf->fullmask = fullmask;
+	buf->ts = ctx->lat.enable ? nn_lat_now() : 0;
 
-	list_add_tail(&buf->list, &ctx->datagram.send_list);
-	if (!ctx->datagram.send_cnt) {
-		wq_ev_sched(&ctx->datagram.ev_item, WQ_EVFL_FDIN|WQ_EVFL_FDOUT, nn_datagram_event);
+	list_add_tail(&buf->list, &ctx->datagram.send_list[prio]);
+	stat->enqueued++;
+	if (++stat->depth > stat->hwm) {
+		stat->hwm = stat->depth;
+	}
+	if (!ctx->datagram.send_cnt && !ctx->pace.blocked) {
+		wq_ev_sched(&ctx->datagram.ev_item, __nn_rx_events(ctx)|WQ_EVFL_FDOUT, nn_datagram_event);
 	}
 	ctx->datagram.send_cnt++;
 }
+static int
+__nn_sendto(struct nn_context *ctx, int prio, const void *buf, uint32_t sz)
+{
+	int sock = ctx->datagram.prio_sock[prio] >= 0 ?
+		ctx->datagram.prio_sock[prio] : ctx->datagram.sock;
+	int rc;
+
+	rc = sendto(sock, buf, sz,
+		    0, (struct sockaddr *)&ctx->datagram.addr,
+		    sizeof(ctx->datagram.addr));
+	if (rc < 0) {
+		wq_infolog64("sendto() error. rc=%d errno=%d", rc, errno);
+	}
+	return rc;
+}
+static void __nn_uring_recv(void *arg, char *buf, uint32_t sz, uint64_t rx_ts);
+
+// io_uringでは送れるだけ投入キューへ入れ、まとめて1回で投入する。
+// 送信バッファは完了時にnn_uring_reap()で解放される。
+static uint32_t
+__nn_do_send_uring(struct nn_context *ctx)
+{
+	struct nn_uring		*ring = ctx->datagram.uring;
+	struct nn_send_buf	*buf;
+	uint32_t		space;
+	int prio;
+	int sock;
+
+	// 先に完了を回収して送信スロットを空ける。
+	nn_uring_reap(ring, __nn_uring_recv, ctx);
+	space = nn_uring_send_space(ring);
+
+	for (prio = 0; prio < NN_PRIO_NUM && space; prio++) {
+		sock = ctx->datagram.prio_sock[prio] >= 0 ?
+			ctx->datagram.prio_sock[prio] : ctx->datagram.sock;
+		while (space && !list_empty(&ctx->datagram.send_list[prio])) {
+			buf = (struct nn_send_buf*)list_first_entry(&ctx->datagram.send_list[prio],
+								    struct nn_send_buf, list);
+			if (!__nn_pace_take(ctx, buf->sz)) {
+				// トークンが補充されるまで待つ。
+				goto submit;
+			}
+			list_del_init(&buf->list);
+			if (ctx->lat.enable && buf->ts) {
+				nn_lat_hist_add(&ctx->lat.hist[NN_LAT_FLUSH_SEND], nn_lat_now() - buf->ts);
+			}
+			nn_uring_sendmsg(ring, sock, buf, buf->buf, buf->sz, &ctx->datagram.addr);
+			space--;
+
+			ctx->datagram.sendq_stat[prio].depth--;
+			ctx->datagram.sendq_stat[prio].sent++;
+			ctx->datagram.send_cnt--;
+		}
+	}
+submit:
+	nn_uring_submit(ring);
+	return ctx->datagram.send_cnt;
+}
+
 static uint32_t
 nn_do_send(struct nn_context *ctx)
 {
 	struct nn_send_buf	*buf;
+	int prio;
 	int rc;
 
-	if (list_empty(&ctx->datagram.send_list)) {
+	if (ctx->datagram.uring) {
+		return __nn_do_send_uring(ctx);
+	}
+
+	// 高い優先度クラスの送信リストから順に見る。
+	for (prio = 0; prio < NN_PRIO_NUM; prio++) {
+		if (!list_empty(&ctx->datagram.send_list[prio])) {
+			break;
+		}
+	}
+	if (prio == NN_PRIO_NUM) {
 		return 0;
 	}
 
 	// 送信リストの先頭を抜いて送信する。
-	buf = (struct nn_send_buf*)list_first_entry(&ctx->datagram.send_list,
+	buf = (struct nn_send_buf*)list_first_entry(&ctx->datagram.send_list[prio],
 						    struct nn_send_buf, list);
+	if (!__nn_pace_take(ctx, buf->sz)) {
+		// トークンが補充されるまで待つ。
+		return ctx->datagram.send_cnt;
+	}
 	list_del_init(&buf->list);
-	rc = sendto(ctx->datagram.sock, buf->buf, buf->sz,
-		    0, (struct sockaddr *)&ctx->datagram.addr,
-		    sizeof(ctx->datagram.addr));
-	if (rc < 0) {
-		wq_infolog64("sendto() error. rc=%d errno=%d", rc, errno);
+	rc = __nn_sendto(ctx, prio, buf->buf, buf->sz);
+	if (rc >= 0 && ctx->lat.enable && buf->ts) {
+		nn_lat_hist_add(&ctx->lat.hist[NN_LAT_FLUSH_SEND], nn_lat_now() - buf->ts);
 	}
+	free(buf);
 
+	ctx->datagram.sendq_stat[prio].depth--;
+	ctx->datagram.sendq_stat[prio].sent++;
 	ctx->datagram.send_cnt--;
 	return ctx->datagram.send_cnt;
 }
+// 1つ受信する。
+// 遅延計測が有効ならカーネルの受信時刻(CLOCK_REALTIME)を*rx_tsへ返す。
+static ssize_t
+__nn_recv_sock(struct nn_context *ctx, char *buf, size_t sz, int flags, uint64_t *rx_ts)
+{
+	char		cbuf[CMSG_SPACE(sizeof(struct timespec))];
+	struct iovec	iov;
+	struct msghdr	msg;
+	struct cmsghdr	*cmsg;
+	ssize_t		ret;
+
+	*rx_ts = 0;
+	if (!ctx->lat.enable) {
+		// MSG_TRUNCで実際の長さを受け取り、切り詰められたものは捨てる。
+		ret = recv(ctx->datagram.sock, buf, sz, flags | MSG_TRUNC);
+		if (ret > (ssize_t)sz) {
+			errno = EMSGSIZE;
+			return -1;
+		}
+		return ret;
+	}
+
+	iov.iov_base = buf;
+	iov.iov_len = sz;
+	memset(&msg, 0, sizeof msg);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof cbuf;
+	ret = recvmsg(ctx->datagram.sock, &msg, flags);
+	if (ret <= 0) {
+		return ret;
+	}
+	if (msg.msg_flags & MSG_TRUNC) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+			struct timespec ts;
+			memcpy(&ts, CMSG_DATA(cmsg), sizeof ts);
+			*rx_ts = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+		}
+	}
+	return ret;
+}
+
+// 受信したデータグラムの計数とキャプチャ。
+static inline void
+__nn_recv_account(struct nn_context *ctx, const char *buf, size_t sz, uint64_t rx_ts)
+{
+	struct nn_capture *cap;
+
+	ctx->filter.delivered++;
+	if (!__atomic_load_n(&ctx->capture.cap, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+	// 停止は別スレッドから呼ばれるので、ロック中に読み直してから書く。
+	pthread_mutex_lock(&ctx->capture.lock);
+	cap = ctx->capture.cap;
+	if (cap) {
+		nn_capture_write(cap, buf, sz, rx_ts ? rx_ts : nn_lat_realtime());
+	}
+	pthread_mutex_unlock(&ctx->capture.lock);
+}
+
+static ssize_t
+__nn_recv(struct nn_context *ctx, char *buf, size_t sz, int flags, uint64_t *rx_ts)
+{
+	ssize_t ret = __nn_recv_sock(ctx, buf, sz, flags, rx_ts);
+
+	if (ret > 0) {
+		__nn_recv_account(ctx, buf, ret, *rx_ts);
+	}
+	return ret;
+}
+
+// nn_uring_reap()から受信したデータグラムごとに呼び出される。
+// bufは受信バッファのリングの中にあり、戻るとカーネルへ返される。
+static void
+__nn_uring_recv(void *arg, char *buf, uint32_t sz, uint64_t rx_ts)
+{
+	struct nn_context *ctx = (struct nn_context *)arg;
+
+	if (!sz) {
+		return;
+	}
+	__nn_recv_account(ctx, buf, sz, rx_ts);
+	__nn_recv_datagram(ctx, buf, sz, rx_ts);
+}
+
 static void
 nn_do_recv(struct nn_context *ctx)
 {
-	// 1pageのバッファを用意する。
-	char buf[4096] = {0};
+	// バッファは最大データグラムサイズで確保してある。
+	char *buf = ctx->datagram.rxbuf;
+	uint64_t rx_ts;
 	ssize_t ret;
-	ret = recv(ctx->datagram.sock, buf, sizeof(buf), 0);
+
+	if (ctx->datagram.uring) {
+		// 完了キューにたまった分をまとめて反映する。
+		nn_uring_reap(ctx->datagram.uring, __nn_uring_recv, ctx);
+		return;
+	}
+	ret = __nn_recv(ctx, buf, ctx->datagram.pktmaxsz, 0, &rx_ts);
 	if (ret < 0) {
 		wq_infolog64("recv() error. ret=%d errno=%d", ret, errno);
 	} else if (ret == 0) {
 	} else {
-		__nn_notify_update(ctx, buf, ret);
+		__nn_recv_datagram(ctx, buf, ret, rx_ts);
 	}
 
 }
@@ -152,109 +561,949 @@ nn_datagram_event(wq_item_t *item, wq_arg_t arg)
 {
 	wq_ev_item_t	*item_ev = (wq_ev_item_t*)arg;
 	nn_context_t	*ctx = (nn_context_t*)list_entry(arg, nn_context_t, datagram.ev_item);
-	uint32_t	events = WQ_EVFL_FDIN;
+	uint32_t	events = __nn_rx_events(ctx);
 
 	if (item_ev->events & WQ_EVFL_FDOUT) {
 		nn_do_send(ctx);
 	}
-	if (item_ev->events & WQ_EVFL_FDIN) {
+	if ((item_ev->events & WQ_EVFL_FDIN) && ctx->rx.mode == NN_RX_EVENT) {
 		nn_do_recv(ctx);
 	}
 
-	if(ctx->datagram.send_cnt) {
-		events |= WQ_EVFL_FDOUT;
+	if(ctx->datagram.send_cnt && !ctx->pace.blocked) {
+		events |= WQ_EVFL_FDOUT;
+	}
+	if (events) {
+		// ビジーポーリング中で送信もなければ再登録しない。
+		// 次の送信時にnn_datagram_send()で登録される。
+		wq_ev_sched(&ctx->datagram.ev_item, events, nn_datagram_event);
+	}
+}
+
+static inline void
+__nn_cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+static void
+__nn_busypoll_backoff(const nn_busypoll_param_t *param, uint32_t idle)
+{
+	struct timespec ts;
+
+	if (idle < param->spin) {
+		__nn_cpu_relax();
+	} else if (idle < param->spin + param->yield || !param->sleep_us) {
+		sched_yield();
+	} else {
+		ts.tv_sec = param->sleep_us / 1000000;
+		ts.tv_nsec = (param->sleep_us % 1000000) * 1000;
+		nanosleep(&ts, NULL);
+	}
+}
+
+static void *
+__nn_busypoll_thread(void *arg)
+{
+	nn_context_t	*ctx = (nn_context_t *)arg;
+	char		*buf;
+	uint32_t	idle = 0;
+	uint64_t	rx_ts;
+	ssize_t		ret;
+
+	// wq側の受信バッファとは別に確保する。
+	buf = (char *)malloc(ctx->datagram.pktmaxsz);
+	if (!buf) {
+		wq_infolog64("malloc() error. sz=%u", ctx->datagram.pktmaxsz);
+		return NULL;
+	}
+
+	wq_infolog64("busypoll thread start. cpu=%d", ctx->rx.param.cpu);
+	while (!ctx->rx.stop) {
+		ret = __nn_recv(ctx, buf, ctx->datagram.pktmaxsz, MSG_DONTWAIT, &rx_ts);
+		if (ret > 0) {
+			__nn_recv_datagram(ctx, buf, ret, rx_ts);
+			idle = 0;
+			continue;
+		}
+		if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+			wq_infolog64("recv() error. ret=%d errno=%d", ret, errno);
+		}
+		if (idle < UINT32_MAX) {
+			idle++;
+		}
+		__nn_busypoll_backoff(&ctx->rx.param, idle);
+	}
+	wq_infolog64("busypoll thread stop.");
+	free(buf);
+	return NULL;
+}
+
+void
+nn_busypoll_param_init(nn_busypoll_param_t *param)
+{
+	param->cpu		= -1;
+	param->busy_poll_us	= 50;
+	param->spin		= 1000;
+	param->yield		= 100;
+	param->sleep_us		= 0;
+}
+
+static void
+__nn_set_busy_poll(nn_context_t *ctx, uint32_t busy_poll_us)
+{
+#ifdef SO_BUSY_POLL
+	int us = busy_poll_us;
+	int rc;
+
+	if (!us) {
+		return;
+	}
+	// 権限が足りなければ失敗するが、ポーリング自体は行える。
+	rc = setsockopt(ctx->datagram.sock, SOL_SOCKET, SO_BUSY_POLL,
+			&us, sizeof(us));
+	if (rc) {
+		wq_infolog64("setsockopt(SO_BUSY_POLL) error. rc=%d errno=%d", rc, errno);
+	}
+#endif
+}
+
+static void
+__nn_set_affinity(pthread_t thread, int cpu)
+{
+	cpu_set_t	cpus;
+	int		rc;
+
+	if (cpu < 0) {
+		return;
+	}
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu, &cpus);
+	rc = pthread_setaffinity_np(thread, sizeof(cpus), &cpus);
+	if (rc) {
+		wq_infolog64("pthread_setaffinity_np() error. rc=%d cpu=%d", rc, cpu);
+	}
+}
+
+int
+nn_start_busypoll(nn_context_t *ctx, const nn_busypoll_param_t *param)
+{
+	int		rc;
+
+	if (ctx->rx.mode != NN_RX_EVENT) {
+		return -EBUSY;
+	}
+	if (ctx->datagram.uring) {
+		// ソケットはio_uringのマルチショット受信が読んでいる。
+		return -EOPNOTSUPP;
+	}
+	ctx->rx.param = *param;
+	ctx->rx.stop = 0;
+
+	__nn_set_busy_poll(ctx, param->busy_poll_us);
+
+	// 以降wqでは受信しない。
+	ctx->rx.mode = NN_RX_BUSYPOLL;
+	rc = pthread_create(&ctx->rx.thread, NULL, __nn_busypoll_thread, ctx);
+	if (rc) {
+		wq_infolog64("pthread_create() error. rc=%d", rc);
+		ctx->rx.mode = NN_RX_EVENT;
+		wq_ev_sched(&ctx->datagram.ev_item, WQ_EVFL_FDIN|WQ_EVFL_FDOUT, nn_datagram_event);
+		return -rc;
+	}
+
+	__nn_set_affinity(ctx->rx.thread, param->cpu);
+	return 0;
+}
+
+void
+nn_stop_busypoll(nn_context_t *ctx)
+{
+	if (ctx->rx.mode != NN_RX_BUSYPOLL) {
+		return;
+	}
+	ctx->rx.stop = 1;
+	pthread_join(ctx->rx.thread, NULL);
+
+	// wqでの受信に戻す。
+	ctx->rx.mode = NN_RX_EVENT;
+	wq_ev_sched(&ctx->datagram.ev_item, WQ_EVFL_FDIN|WQ_EVFL_FDOUT, nn_datagram_event);
+}
+
+// ---------------------------------------------------------------------------
+// パイプライン受信
+//
+// 受信スレッド --(rx)--> 反映スレッド[n]
+//             <-(ret)--
+//
+// バッファは反映スレッドごとにring個ずつ持たせ、retリングへ入れておく。
+// 受信スレッドは受信したバッファを渡すときに、同じ反映スレッドのretリングから
+// 空きバッファを1つ受け取る。反映スレッドの持つバッファ数は変わらないので、
+// rxリングが溢れることはない。
+// 反映スレッドはUUIDハッシュのキーで選ぶ。ハッシュのリストごとに
+// 更新するスレッドが1つに決まるので、既存ノードの検索はロックしない。
+
+struct nn_pipeline_buf {
+	uint32_t		sz;
+	uint32_t		rsv;
+	uint64_t		rx_ts;
+	char			data[0];
+};
+
+struct nn_pipeline_worker {
+	nn_ring_t		rx;		// 受信スレッド→反映スレッド
+	nn_ring_t		ret;		// 反映スレッド→受信スレッド(空きバッファ)
+	nn_context_t		*ctx;
+	struct nn_pipeline	*pl;
+	pthread_t		thread;
+	int			started;
+	nn_pipeline_stat_t	stat;
+} __attribute__((aligned(NN_RING_CACHELINE)));
+
+struct nn_pipeline {
+	nn_pipeline_param_t	param;
+	uint32_t		nworkers;
+	volatile int		stop;		// 反映スレッドの停止
+	char			*pool;
+	struct nn_pipeline_buf	*cur;		// 受信スレッドが使うバッファ
+	struct nn_pipeline_worker	*worker;
+};
+
+// 反映スレッドwから空きバッファを1つ受け取る。停止したらNULLを返す。
+static struct nn_pipeline_buf *
+__nn_pipeline_take(nn_context_t *ctx, struct nn_pipeline *pl, struct nn_pipeline_worker *w)
+{
+	struct nn_pipeline_buf	*next;
+	uint32_t		wait;
+
+	for (wait = 0; !(next = (struct nn_pipeline_buf *)nn_ring_pop(&w->ret)); wait++) {
+		// 反映が追いついていない。ソケットのバッファで待たせる。
+		if (!wait) {
+			w->stat.stalls++;
+		}
+		if (ctx->rx.stop) {
+			return NULL;
+		}
+		__nn_busypoll_backoff(&pl->param.io, wait);
+	}
+	return next;
+}
+
+// 中継ノードの束はノードごとに分け、コピーしてそれぞれの反映スレッドへ渡す。
+static int
+__nn_pipeline_split(nn_context_t *ctx, struct nn_pipeline *pl, char *buf, uint32_t sz,
+		    uint64_t rx_ts)
+{
+	nn_msg_upd_header_t		*hd = (nn_msg_upd_header_t *)buf;
+	nn_msg_upd_header_t		*inner;
+	nn_msg_bundle_entry_t		ent;
+	struct nn_pipeline_worker	*w;
+	struct nn_pipeline_buf		*b;
+	uint32_t			cnt;
+	uint32_t			offset;
+	uint32_t			size = 0;
+
+	if (uuid_compare(hd->uuid, ctx->node.uuid) == 0) {
+		return 0;
+	}
+	for (cnt = 0, offset = sizeof *hd; cnt < hd->objects; cnt++, offset += sizeof ent + size) {
+		if (offset + sizeof ent > sz) {
+			break;
+		}
+		memcpy(&ent, &buf[offset], sizeof ent);
+		size = nn_wire16(ent.size);
+		if (size < sizeof *inner || offset + sizeof ent + size > sz) {
+			break;
+		}
+		inner = (nn_msg_upd_header_t *)&buf[offset + sizeof ent];
+		if (inner->type != NN_MSG_UPDATE) {
+			continue;
+		}
+		w = &pl->worker[nn_uuid_hashkey(inner->uuid) & (pl->nworkers - 1)];
+		b = __nn_pipeline_take(ctx, pl, w);
+		if (!b) {
+			return -1;
+		}
+		memcpy(b->data, inner, size);
+		b->sz = size;
+		b->rx_ts = rx_ts;
+		nn_ring_push(&w->rx, b);
+	}
+	return 0;
+}
+
+static void *
+__nn_pipeline_io_thread(void *arg)
+{
+	nn_context_t			*ctx = (nn_context_t *)arg;
+	struct nn_pipeline		*pl = ctx->rx.pipeline;
+	struct nn_pipeline_worker	*w;
+	struct nn_pipeline_buf		*next;
+	nn_msg_upd_header_t		*hd;
+	uint32_t			idle = 0;
+	uint64_t			rx_ts;
+	ssize_t				ret;
+
+	wq_infolog64("pipeline io thread start. workers=%u", pl->nworkers);
+	while (!ctx->rx.stop) {
+		ret = __nn_recv(ctx, pl->cur->data, ctx->datagram.pktmaxsz, MSG_DONTWAIT, &rx_ts);
+		if (ret <= 0) {
+			if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				wq_infolog64("recv() error. ret=%d errno=%d", ret, errno);
+			}
+			if (idle < UINT32_MAX) {
+				idle++;
+			}
+			__nn_busypoll_backoff(&pl->param.io, idle);
+			continue;
+		}
+		idle = 0;
+
+		hd = (nn_msg_upd_header_t *)pl->cur->data;
+		if (ret >= sizeof(*hd) && hd->version <= NN_WIRE_VERSION &&
+		    hd->type == NN_MSG_BUNDLE) {
+			if (__nn_pipeline_split(ctx, pl, pl->cur->data, ret, rx_ts)) {
+				goto out;
+			}
+			continue;
+		}
+		if (ret < sizeof(*hd) || hd->version > NN_WIRE_VERSION ||
+		    (hd->type != NN_MSG_UPDATE && hd->type != NN_MSG_NAME)) {
+			// 書き込みとackはストアを使わないので、ここで処理する。
+			__nn_recv_datagram(ctx, pl->cur->data, ret, rx_ts);
+			continue;
+		}
+
+		w = &pl->worker[nn_uuid_hashkey(hd->uuid) & (pl->nworkers - 1)];
+		next = __nn_pipeline_take(ctx, pl, w);
+		if (!next) {
+			goto out;
+		}
+		pl->cur->sz = ret;
+		pl->cur->rx_ts = rx_ts;
+		nn_ring_push(&w->rx, pl->cur);
+		pl->cur = next;
+	}
+out:
+	wq_infolog64("pipeline io thread stop.");
+	return NULL;
+}
+
+static void *
+__nn_pipeline_worker_thread(void *arg)
+{
+	struct nn_pipeline_worker	*w = (struct nn_pipeline_worker *)arg;
+	struct nn_pipeline_buf		*b;
+	uint32_t			idle = 0;
+
+	for (;;) {
+		b = (struct nn_pipeline_buf *)nn_ring_pop(&w->rx);
+		if (!b) {
+			// 停止時は受け取った分を反映し終えてから抜ける。
+			if (w->pl->stop) {
+				break;
+			}
+			if (idle < UINT32_MAX) {
+				idle++;
+			}
+			__nn_busypoll_backoff(&w->pl->param.io, idle);
+			continue;
+		}
+		idle = 0;
+		__nn_recv_datagram(w->ctx, b->data, b->sz, b->rx_ts);
+		w->stat.datagrams++;
+		nn_ring_push(&w->ret, b);
+	}
+	return NULL;
+}
+
+static void
+__nn_pipeline_free(struct nn_pipeline *pl)
+{
+	uint32_t i;
+
+	pl->stop = 1;
+	for (i = 0; i < pl->nworkers; i++) {
+		if (pl->worker[i].started) {
+			pthread_join(pl->worker[i].thread, NULL);
+		}
+		nn_ring_free(&pl->worker[i].rx);
+		nn_ring_free(&pl->worker[i].ret);
+	}
+	free(pl->worker);
+	free(pl->pool);
+	free(pl);
+}
+
+void
+nn_pipeline_param_init(nn_pipeline_param_t *param)
+{
+	nn_busypoll_param_init(&param->io);
+	param->workers		= 2;
+	param->ring		= 256;
+	param->worker_cpu	= -1;
+}
+
+int
+nn_start_pipeline(nn_context_t *ctx, const nn_pipeline_param_t *param)
+{
+	struct nn_pipeline		*pl;
+	struct nn_pipeline_worker	*w;
+	uint32_t			bufsz;
+	uint32_t			nbuf;
+	uint32_t			i, j;
+	int				rc;
+
+	if (ctx->rx.mode != NN_RX_EVENT) {
+		return -EBUSY;
+	}
+	if (ctx->datagram.uring) {
+		return -EOPNOTSUPP;
+	}
+
+	pl = (struct nn_pipeline *)calloc(1, sizeof *pl);
+	if (!pl) {
+		return -ENOMEM;
+	}
+	pl->param = *param;
+	// ハッシュキーの下位bitで振り分けるので2の累乗にする。
+	for (pl->nworkers = 1;
+	     pl->nworkers * 2 <= param->workers && pl->nworkers * 2 <= NN_PIPELINE_MAXWORKERS;
+	     pl->nworkers *= 2) {
+	}
+	pl->worker = (struct nn_pipeline_worker *)aligned_alloc(NN_RING_CACHELINE,
+				pl->nworkers * sizeof(struct nn_pipeline_worker));
+	if (!pl->worker) {
+		free(pl);
+		return -ENOMEM;
+	}
+	memset(pl->worker, 0, pl->nworkers * sizeof(struct nn_pipeline_worker));
+
+	for (i = 0; i < pl->nworkers; i++) {
+		w = &pl->worker[i];
+		w->ctx = ctx;
+		w->pl = pl;
+		if (nn_ring_init(&w->rx, param->ring) || nn_ring_init(&w->ret, param->ring)) {
+			pl->nworkers = i + 1;
+			__nn_pipeline_free(pl);
+			return -ENOMEM;
+		}
+	}
+
+	// 反映スレッドごとにリング長分、受信スレッドに1つ。
+	bufsz = (sizeof(struct nn_pipeline_buf) + ctx->datagram.pktmaxsz
+		 + NN_RING_CACHELINE - 1) & ~(NN_RING_CACHELINE - 1);
+	nbuf = pl->worker[0].rx.mask + 1;
+	pl->pool = (char *)aligned_alloc(NN_RING_CACHELINE,
+					 (size_t)bufsz * (pl->nworkers * nbuf + 1));
+	if (!pl->pool) {
+		__nn_pipeline_free(pl);
+		return -ENOMEM;
+	}
+	for (i = 0; i < pl->nworkers; i++) {
+		for (j = 0; j < nbuf; j++) {
+			nn_ring_push(&pl->worker[i].ret,
+				     &pl->pool[(size_t)bufsz * (i * nbuf + j)]);
+		}
+	}
+	pl->cur = (struct nn_pipeline_buf *)&pl->pool[(size_t)bufsz * pl->nworkers * nbuf];
+
+	for (i = 0; i < pl->nworkers; i++) {
+		w = &pl->worker[i];
+		rc = pthread_create(&w->thread, NULL, __nn_pipeline_worker_thread, w);
+		if (rc) {
+			wq_infolog64("pthread_create() error. rc=%d", rc);
+			__nn_pipeline_free(pl);
+			return -rc;
+		}
+		w->started = 1;
+		if (param->worker_cpu >= 0) {
+			__nn_set_affinity(w->thread, param->worker_cpu + i);
+		}
+	}
+
+	__nn_set_busy_poll(ctx, param->io.busy_poll_us);
+	// LRUは反映スレッドごとに分けて追い出す。
+	nn_store_set_owners(pl->nworkers);
+
+	// 以降wqでは受信しない。
+	ctx->rx.param = param->io;
+	ctx->rx.stop = 0;
+	ctx->rx.pipeline = pl;
+	ctx->rx.mode = NN_RX_PIPELINE;
+	rc = pthread_create(&ctx->rx.thread, NULL, __nn_pipeline_io_thread, ctx);
+	if (rc) {
+		wq_infolog64("pthread_create() error. rc=%d", rc);
+		ctx->rx.mode = NN_RX_EVENT;
+		ctx->rx.pipeline = NULL;
+		__nn_pipeline_free(pl);
+		nn_store_set_owners(1);
+		wq_ev_sched(&ctx->datagram.ev_item, WQ_EVFL_FDIN|WQ_EVFL_FDOUT, nn_datagram_event);
+		return -rc;
+	}
+	__nn_set_affinity(ctx->rx.thread, param->io.cpu);
+	return 0;
+}
+
+void
+nn_stop_pipeline(nn_context_t *ctx)
+{
+	if (ctx->rx.mode != NN_RX_PIPELINE) {
+		return;
+	}
+	// 受信を止めてから、反映スレッドに残りを反映させる。
+	ctx->rx.stop = 1;
+	pthread_join(ctx->rx.thread, NULL);
+	__nn_pipeline_free(ctx->rx.pipeline);
+	ctx->rx.pipeline = NULL;
+	nn_store_set_owners(1);
+
+	// wqでの受信に戻す。
+	ctx->rx.mode = NN_RX_EVENT;
+	wq_ev_sched(&ctx->datagram.ev_item, WQ_EVFL_FDIN|WQ_EVFL_FDOUT, nn_datagram_event);
+}
+
+int
+nn_get_pipeline_stat(nn_context_t *ctx, uint32_t worker, nn_pipeline_stat_t *stat)
+{
+	struct nn_pipeline *pl = ctx->rx.pipeline;
+
+	if (!pl) {
+		return -ENOENT;
+	}
+	if (worker >= pl->nworkers) {
+		return -EINVAL;
+	}
+	*stat = pl->worker[worker].stat;
+	return 0;
+}
+
+#include <timeofday.h>
+
+void
+nn_param_init(nn_param_t *param)
+{
+	param->pktmaxsz	= NN_DATAGRAM_PACKETMAXSZ;
+	param->rcvbuf	= 0;
+	param->sndbuf	= 0;
+	param->group	= inet_addr("239.192.1.2");
+	param->backend	= NN_IO_EPOLL;
+	param->uring_entries = 256;
+}
+
+int
+nn_initialize_param(nn_context_t *ctx, uuid_t *uuid, int port, const nn_param_t *param)
+{
+	pthread_rwlockattr_t rwattr;
+	int i;
+	int rc;
+
+	wq_infolog64("nn init. port=%d pktmaxsz=%u", port, param->pktmaxsz);
+
+	if (param->pktmaxsz < sizeof(nn_msg_upd_header_t) + sizeof(nn_msg_write_header_t) ||
+	    param->pktmaxsz > NN_DATAGRAM_LIMITSZ) {
+		wq_infolog64("invalid pktmaxsz. pktmaxsz=%u", param->pktmaxsz);
+		return -EINVAL;
+	}
+
+	nn_init();
+
+	ctx->datagram.pktmaxsz = param->pktmaxsz;
+	ctx->datagram.sndbuf = param->sndbuf;
+	ctx->datagram.rxbuf = (char *)malloc(param->pktmaxsz);
+	for (i = 0; i < NN_PRIO_NUM; i++) {
+		ctx->send[i].buffer = (nn_update_sendbuf_t *)malloc(param->pktmaxsz);
+	}
+	if (!ctx->datagram.rxbuf) {
+		goto nomem;
+	}
+	for (i = 0; i < NN_PRIO_NUM; i++) {
+		if (!ctx->send[i].buffer) {
+			goto nomem;
+		}
+	}
+
+	for (i = 0; i < NN_PRIO_NUM; i++) {
+		init_list_head(&ctx->datagram.send_list[i]);
+		ctx->datagram.prio_sock[i] = -1;
+	}
+	ctx->datagram.send_cnt = 0;
+	ctx->datagram.sendq_limit = NN_SENDQ_DEFAULT_LIMIT;
+	ctx->datagram.sendq_policy = NN_SENDQ_SUPERSEDE;
+	memset(ctx->datagram.sendq_stat, 0, sizeof ctx->datagram.sendq_stat);
+	memset(&ctx->pace, 0, sizeof ctx->pace);
+	wq_init_item(&ctx->pace.timer);
+	ctx->datagram.sock = -1;
+	ctx->datagram.uring = NULL;
+	ctx->rx.mode = NN_RX_EVENT;
+	ctx->rx.stop = 0;
+	ctx->rx.pipeline = NULL;
+	// 反映が続いてもフックの変更が待たされ続けないように、書き込みを優先する。
+	pthread_rwlockattr_init(&rwattr);
+	pthread_rwlockattr_setkind_np(&rwattr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+	pthread_rwlock_init(&ctx->hook.lock, &rwattr);
+	pthread_rwlockattr_destroy(&rwattr);
+	ctx->hook.cb = NULL;
+	ctx->hook.arg = NULL;
+	pthread_mutex_init(&ctx->write.lock, NULL);
+	init_list_head(&ctx->write.pending);
+	ctx->write.seq = 0;
+	ctx->write.timeout_us = 2000;
+	ctx->write.retries = 3;
+	ctx->write.hook = NULL;
+	ctx->write.hook_arg = NULL;
+	// seqは1から始まるので、空の履歴は一致しない。
+	memset(ctx->write.recent, 0, sizeof ctx->write.recent);
+	ctx->write.recent_pos = 0;
+	memset(&ctx->lat, 0, sizeof ctx->lat);
+	pthread_mutex_init(&ctx->capture.lock, NULL);
+	ctx->capture.cap = NULL;
+	ctx->publish = NULL;
+	ctx->sched = NULL;
+	memset(&ctx->filter, 0, sizeof ctx->filter);
+	pthread_rwlock_init(&ctx->notify.lock, NULL);
+	ctx->notify.cnt = 0;
+	memset(ctx->notify.slot, 0, sizeof ctx->notify.slot);
+	memset(&ctx->name, 0, sizeof ctx->name);
+	ctx->name.period_ms = 1000;
+	wq_init_item(&ctx->name.timer);
+	memcpy(ctx->node.uuid, uuid, sizeof ctx->node.uuid);
+	memcpy(&ctx->pace.seed, &ctx->node.uuid[12], sizeof ctx->pace.seed);
+	ctx->pace.seed |= 1;
+	rc = nn_datagram_initialize(ctx, port, param);
+	if (rc) {
+		goto sockerr;
+	}
+	if (param->backend == NN_IO_URING && ctx->datagram.sock >= 0) {
+		rc = nn_uring_init(&ctx->datagram.uring, ctx->datagram.sock,
+				   param->uring_entries, param->pktmaxsz);
+		if (rc) {
+			// 古いカーネルなど。epollで動作を続ける。
+			wq_infolog64("io_uring unavailable, fall back to epoll. rc=%d", rc);
+			ctx->datagram.uring = NULL;
+		}
+	}
+	// io_uringでは完了があるとリングのfdが読み込み可能になる。
+	wq_ev_init(&ctx->datagram.ev_item, ctx->datagram.uring ?
+		   nn_uring_fd(ctx->datagram.uring) : ctx->datagram.sock);
+
+	wq_init_item(&ctx->objects.async_send);
+	ctx->objects.async_item = &ctx->objects.async_send;
+	ctx->objects.used_bmp = 0;
+	memset(ctx->objects.object, 0, sizeof ctx->objects.object);
+	for (i = 0; i < NN_PRIO_NUM; i++) {
+		__nn_init_buffer(ctx, i);
+	}
+	return 0;
+
+sockerr:
+	pthread_rwlock_destroy(&ctx->notify.lock);
+	pthread_mutex_destroy(&ctx->capture.lock);
+	pthread_mutex_destroy(&ctx->write.lock);
+	pthread_rwlock_destroy(&ctx->hook.lock);
+	goto out;
+
+nomem:
+	wq_infolog64("malloc() error. pktmaxsz=%u", param->pktmaxsz);
+	rc = -ENOMEM;
+out:
+	for (i = 0; i < NN_PRIO_NUM; i++) {
+		free(ctx->send[i].buffer);
+		ctx->send[i].buffer = NULL;
+	}
+	free(ctx->datagram.rxbuf);
+	ctx->datagram.rxbuf = NULL;
+	return rc;
+}
+
+int
+nn_initialize(nn_context_t *ctx, uuid_t *uuid, int port)
+{
+	nn_param_t param;
+
+	nn_param_init(&param);
+	return nn_initialize_param(ctx, uuid, port, &param);
+}
+
+int
+nn_get_uring_stat(nn_context_t *ctx, struct nn_uring_stat *stat)
+{
+	if (!ctx->datagram.uring) {
+		return -ENOENT;
+	}
+	nn_uring_get_stat(ctx->datagram.uring, stat);
+	return 0;
+}
+
+void
+nn_start(nn_context_t *ctx)
+{
+	wq_infolog64("nn start.");
+	wq_ev_sched(&ctx->datagram.ev_item, WQ_EVFL_FDIN|WQ_EVFL_FDOUT, nn_datagram_event);
+	__nn_send_names(ctx);
+}
+
+void
+nn_stop(nn_context_t *ctx)
+{
+	wq_infolog64("nn stop.");
+}
+
+int
+nn_add_object(nn_context_t *ctx, struct nn_context_object *addr)
+{
+	int bit;
+	for_each_clear_bit64(bit, &ctx->objects.used_bmp) {
+		if (bit >= NN_CTX_OBJECTS) {
+			break;
+		}
+		ctx->objects.object[bit] = addr;
+		addr->idx = bit;
+		ctx->objects.used_bmp |= (1ull << bit);
+		return 0;
+	}
+	return -1;
+}
+
+// 反映側はcbとargを読み込みロック中に読んで呼び出すので、書き込みロックを
+// 取れた時点で古い組による呼び出しは残っていない。
+void
+nn_set_notify_hook(nn_context_t *ctx, nn_notify_hook_t cb, void *arg)
+{
+	pthread_rwlock_wrlock(&ctx->hook.lock);
+	ctx->hook.arg = arg;
+	__atomic_store_n(&ctx->hook.cb, cb, __ATOMIC_RELEASE);
+	pthread_rwlock_unlock(&ctx->hook.lock);
+}
+
+int
+nn_replace_notify_hook(nn_context_t *ctx, nn_notify_hook_t old_cb, void *old_arg,
+		       nn_notify_hook_t cb, void *arg)
+{
+	int ret = 0;
+
+	pthread_rwlock_wrlock(&ctx->hook.lock);
+	if (ctx->hook.cb != old_cb || ctx->hook.arg != old_arg) {
+		ret = -EBUSY;
+	} else {
+		ctx->hook.arg = arg;
+		__atomic_store_n(&ctx->hook.cb, cb, __ATOMIC_RELEASE);
+	}
+	pthread_rwlock_unlock(&ctx->hook.lock);
+	return ret;
+}
+
+static void
+__nn_call_hook(nn_context_t *ctx, nn_d_object_t *d_object)
+{
+	nn_notify_hook_t cb;
+
+	pthread_rwlock_rdlock(&ctx->hook.lock);
+	cb = ctx->hook.cb;
+	if (cb) {
+		cb(ctx, d_object, ctx->hook.arg);
+	}
+	pthread_rwlock_unlock(&ctx->hook.lock);
+}
+
+void
+nn_set_destination(nn_context_t *ctx, in_addr_t addr, int port)
+{
+	ctx->datagram.addr.sin_family = AF_INET;
+	ctx->datagram.addr.sin_port = htons(port);
+	ctx->datagram.addr.sin_addr.s_addr = addr;
+}
+
+void
+nn_send_datagram(nn_context_t *ctx, int prio, const void *buf, uint32_t sz)
+{
+	if (prio < 0 || prio >= NN_PRIO_NUM) {
+		prio = NN_PRIO_LOW;
+	}
+	nn_datagram_send(ctx, prio, buf, sz, 0, 0);
+}
+
+int
+nn_latency_enable(nn_context_t *ctx, int enable)
+{
+	int on = enable ? 1 : 0;
+	int rc;
+
+	rc = setsockopt(ctx->datagram.sock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+	if (rc) {
+		wq_infolog64("setsockopt(SO_TIMESTAMPNS) error. rc=%d errno=%d", rc, errno);
+		return -errno;
 	}
-	wq_ev_sched(&ctx->datagram.ev_item, events, nn_datagram_event);
+	ctx->lat.enable = on;
+	return 0;
 }
 
-#include <timeofday.h>
+const nn_lat_hist_t *
+nn_get_latency(nn_context_t *ctx, int stage)
+{
+	if (stage < 0 || stage >= NN_LAT_STAGES) {
+		return NULL;
+	}
+	return &ctx->lat.hist[stage];
+}
 
 void
-nn_initialize(nn_context_t *ctx, uuid_t *uuid, int port)
+nn_latency_clear(nn_context_t *ctx)
 {
-	wq_infolog64("nn init. port=%d", port);
-
-	nn_init();
-
-	init_list_head(&ctx->datagram.send_list);
-	ctx->datagram.send_cnt = 0;
-	ctx->datagram.sock = -1;
-	memcpy(ctx->node.uuid, uuid, sizeof ctx->node.uuid);
-	nn_datagram_initialize(ctx, port);
-	wq_ev_init(&ctx->datagram.ev_item, ctx->datagram.sock);
+	int stage;
 
-	wq_init_item(&ctx->objects.async_send);
-	ctx->objects.async_item = &ctx->objects.async_send;
-	ctx->objects.used_bmp = 0;
-	memset(ctx->objects.object, 0, sizeof ctx->objects.object);
-	__nn_init_buffer(ctx);
+	for (stage = 0; stage < NN_LAT_STAGES; stage++) {
+		nn_lat_hist_clear(&ctx->lat.hist[stage]);
+	}
 }
 
-void
-nn_start(nn_context_t *ctx)
+int
+nn_set_prio_marking(nn_context_t *ctx, int prio, int dscp, int sk_prio)
 {
-	wq_infolog64("nn start.");
-	wq_ev_sched(&ctx->datagram.ev_item, WQ_EVFL_FDIN|WQ_EVFL_FDOUT, nn_datagram_event);
+	in_addr_t ipaddr = INADDR_ANY;
+	int sock;
+	int rc;
+
+	if (prio < 0 || prio >= NN_PRIO_NUM) {
+		return -EINVAL;
+	}
+
+	// 1つのソケットでパケットごとにマーキングを変えることはできないので、
+	// クラス専用の送信ソケットを用意する。
+	sock = ctx->datagram.prio_sock[prio];
+	if (sock < 0) {
+		sock = socket(AF_INET, SOCK_DGRAM, 0);
+		if (sock < 0) {
+			wq_infolog64("socket() error. errno=%d", errno);
+			return -errno;
+		}
+		rc = setsockopt(sock, IPPROTO_IP, IP_MULTICAST_IF,
+				(char *)&ipaddr, sizeof(ipaddr));
+		if (rc) {
+			wq_infolog64("setsockopt() error. rc=%d errno=%d", rc, errno);
+		}
+		// 大きなデータグラムが送れるよう、メインのソケットと同じだけ広げる。
+		if (ctx->datagram.sndbuf) {
+			rc = setsockopt(sock, SOL_SOCKET, SO_SNDBUF,
+					&ctx->datagram.sndbuf, sizeof(ctx->datagram.sndbuf));
+			if (rc) {
+				wq_infolog64("setsockopt(SO_SNDBUF) error. rc=%d errno=%d", rc, errno);
+			}
+		}
+		ctx->datagram.prio_sock[prio] = sock;
+	}
+
+	if (dscp >= 0) {
+		int tos = (dscp & 0x3f) << 2;
+		rc = setsockopt(sock, IPPROTO_IP, IP_TOS, &tos, sizeof(tos));
+		if (rc) {
+			wq_infolog64("setsockopt(IP_TOS) error. rc=%d errno=%d", rc, errno);
+			return -errno;
+		}
+	}
+	if (sk_prio >= 0) {
+		rc = setsockopt(sock, SOL_SOCKET, SO_PRIORITY, &sk_prio, sizeof(sk_prio));
+		if (rc) {
+			wq_infolog64("setsockopt(SO_PRIORITY) error. rc=%d errno=%d", rc, errno);
+			return -errno;
+		}
+	}
+	return 0;
 }
 
 void
-nn_stop(nn_context_t *ctx)
+nn_set_sendq_limit(nn_context_t *ctx, uint32_t limit, int policy)
 {
-	wq_infolog64("nn stop.");
+	ctx->datagram.sendq_limit = limit;
+	ctx->datagram.sendq_policy = policy;
 }
 
 int
-nn_add_object(nn_context_t *ctx, struct nn_context_object *addr)
+nn_get_sendq_stat(nn_context_t *ctx, int prio, nn_sendq_stat_t *stat)
 {
-	int bit;
-	for_each_clear_bit64(bit, &ctx->objects.used_bmp) {
-		ctx->objects.object[bit] = addr;
-		addr->idx = bit;
-		ctx->objects.used_bmp |= (1 << bit);
-		return 0;
+	if (prio < 0 || prio >= NN_PRIO_NUM) {
+		return -EINVAL;
 	}
-	return -1;
+	*stat = ctx->datagram.sendq_stat[prio];
+	return 0;
 }
 
 static void
-__nn_init_buffer(nn_context_t *ctx)
+__nn_init_buffer(nn_context_t *ctx, int prio)
 {
-	memset(&ctx->send, 0, sizeof(nn_update_sendbuf_t));
+	ctx->send[prio].usedsz = 0;
+	ctx->send[prio].objmask = 0;
+	ctx->send[prio].fullmask = 0;
+	memset(&ctx->send[prio].buffer->header, 0, sizeof(nn_msg_upd_header_t));
+	ctx->send[prio].buffer->header.version = NN_WIRE_VERSION;
 
 	// ヘッダは初期で消費している。
-	memcpy(ctx->send.buffer.header.uuid,
+	memcpy(ctx->send[prio].buffer->header.uuid,
 	       ctx->node.uuid, sizeof ctx->node.uuid);
 }
 
+// 送信バッファの内容を送信キューへ入れ、バッファを空にする。
+static void
+__nn_flush_buffer(nn_context_t *ctx, int prio)
+{
+	nn_update_sendbuf_t *buffer = ctx->send[prio].buffer;
+
+	if (ctx->lat.enable) {
+		buffer->header.flags |= NN_MSG_FL_TSTAMP;
+		buffer->header.tstamp = nn_wire64(nn_lat_realtime());
+		nn_lat_hist_add(&ctx->lat.hist[NN_LAT_ENQ_FLUSH], nn_lat_now() - ctx->send[prio].open_ts);
+	}
+	nn_datagram_send(ctx, prio, buffer, ctx->send[prio].usedsz + sizeof(nn_msg_upd_header_t),
+			 ctx->send[prio].objmask, ctx->send[prio].fullmask);
+	__nn_init_buffer(ctx, prio);
+}
+
 static void
 __nn_update_send(wq_item_t *item, wq_arg_t arg)
 {
 	// updateプロトコル構築
 	nn_context_t *ctx = (nn_context_t *)arg;
+	int prio;
 
-	nn_datagram_send(ctx, &ctx->send.buffer, ctx->send.usedsz + sizeof(nn_msg_upd_header_t));
-	__nn_init_buffer(ctx);
+	// 送信キューには高い優先度から入れる。
+	for (prio = 0; prio < NN_PRIO_NUM; prio++) {
+		if (ctx->send[prio].buffer->header.objects) {
+			__nn_flush_buffer(ctx, prio);
+		}
+	}
 	ctx->objects.async_item = item;
 }
 
 static int
-__nn_add_buffer(nn_context_t *ctx, struct nn_context_object *obj, uint32_t offset, uint32_t size)
+__nn_add_buffer(nn_context_t *ctx, int prio, struct nn_context_object *obj, uint32_t offset, uint32_t size)
 {
-	nn_msg_updobj_header_t *objh = (nn_msg_updobj_header_t *)&(ctx->send.buffer.buf[ctx->send.usedsz]);
-	char *addr = &(ctx->send.buffer.buf[offset + sizeof(nn_msg_updobj_header_t)]);
+	uint32_t usedsz = ctx->send[prio].usedsz;
+	uint32_t bufsz = ctx->datagram.pktmaxsz - sizeof(nn_msg_upd_header_t);
+	nn_update_sendbuf_t *buffer = ctx->send[prio].buffer;
+	nn_msg_updobj_header_t *objh = (nn_msg_updobj_header_t *)&(buffer->buf[usedsz]);
+	char *addr = &(buffer->buf[usedsz + sizeof(nn_msg_updobj_header_t)]);
 
-	if ((NN_DATAGRAM_PACKETMAXSZ - ctx->send.usedsz) < (sizeof(nn_msg_updobj_header_t) + size)) {
+	if ((bufsz - usedsz) < (sizeof(nn_msg_updobj_header_t) + size)) {
 		// 入らなければエラーする
 		return -1;
 	}
+	if (ctx->lat.enable && !usedsz) {
+		ctx->send[prio].open_ts = nn_lat_now();
+	}
 
-	objh->idx	= obj->idx;
-	objh->type	= obj->type;
-	objh->offset	= offset;
-	objh->size	= size;
-	memcpy(addr, obj->addr + offset, size);
-	ctx->send.usedsz += sizeof(nn_msg_updobj_header_t) + size;
-	ctx->send.buffer.header.objects++;
+	objh->idx	= nn_wire16(obj->idx);
+	objh->type	= nn_wire16(obj->type);
+	objh->offset	= nn_wire16(offset);
+	objh->size	= nn_wire16(size);
+	nn_wire_copy_payload(addr, obj->addr + offset, obj->type, offset, size);
+	ctx->send[prio].usedsz += sizeof(nn_msg_updobj_header_t) + size;
+	ctx->send[prio].objmask |= 1ull << obj->idx;
+	if (offset == 0 && size >= obj->sz) {
+		ctx->send[prio].fullmask |= 1ull << obj->idx;
+	}
+	buffer->header.objects++;
 	return 0;
 }
 
@@ -262,19 +1511,24 @@ int
 nn_update_object(nn_context_t *ctx, struct nn_context_object *obj,
 		 uint32_t offset, uint32_t size)
 {
+	int prio = obj->prio < NN_PRIO_NUM ? obj->prio : NN_PRIO_LOW;
 	int ret;
 
+	// ワード単位のタイプは4byte境界で切った範囲しか送れない。
+	ret = nn_wire_check_payload(obj->type, offset, size);
+	if (ret) {
+		return ret;
+	}
 	// バッファへ追加する。
-	ret = __nn_add_buffer(ctx, obj, offset, size);
+	ret = __nn_add_buffer(ctx, prio, obj, offset, size);
 	if (ret != 0) {
 		wq_infolog64("buffer full. ret=%d", ret);
 		// もし、バッファがいっぱいであれば先に送信する。
 		// 送信は、バッファ内容がコピーされるのでクリアしてから
 		// 再利用する。
 //		wq_cancel(ctx->objects.async_item);
-		nn_datagram_send(ctx, &ctx->send.buffer, ctx->send.usedsz + sizeof(nn_msg_upd_header_t));
-		__nn_init_buffer(ctx);
-		ret = __nn_add_buffer(ctx, obj, offset, size);
+		__nn_flush_buffer(ctx, prio);
+		ret = __nn_add_buffer(ctx, prio, obj, offset, size);
 		if (ret != 0) {
 			return -1;
 		}
@@ -287,13 +1541,518 @@ nn_update_object(nn_context_t *ctx, struct nn_context_object *obj,
 		wq_item_t *item = ctx->objects.async_item;
 
 		ctx->objects.async_item = NULL;
-		wq_sched(item, __nn_update_send, (void*)ctx);
+		if (ctx->pace.jitter_us) {
+			wq_timer_sched(item, WQ_TIME_US(__nn_pace_jitter(ctx)),
+				       __nn_update_send, (void*)ctx);
+		} else {
+			wq_sched(item, __nn_update_send, (void*)ctx);
+		}
+	}
+	return 0;
+}
+
+// --------------------------------
+// リモート書き込み
+
+// ack待ちの書き込み
+struct nn_write_req {
+	list_head_t		list;
+	wq_item_t		timer;
+	nn_context_t		*ctx;
+	uint32_t		seq;
+	uint32_t		retry;
+	uint64_t		start;
+	int			done;
+	nn_write_cb_t		cb;
+	void			*arg;
+	uint32_t		sz;
+	char			pkt[0];
+};
+
+void
+nn_set_write_param(nn_context_t *ctx, uint32_t timeout_us, uint32_t retries)
+{
+	ctx->write.timeout_us = timeout_us;
+	ctx->write.retries = retries;
+}
+
+void
+nn_set_write_hook(nn_context_t *ctx, nn_write_hook_t cb, void *arg)
+{
+	ctx->write.hook_arg = arg;
+	ctx->write.hook = cb;
+}
+
+static void
+__nn_write_timeout(wq_item_t *item, wq_arg_t arg)
+{
+	struct nn_write_req	*req = (struct nn_write_req *)arg;
+	nn_context_t		*ctx = req->ctx;
+
+	pthread_mutex_lock(&ctx->write.lock);
+	if (req->done) {
+		// ackで完了済み。タイマの後始末だけ行う。
+		pthread_mutex_unlock(&ctx->write.lock);
+		free(req);
+		return;
+	}
+	if (req->retry >= ctx->write.retries) {
+		list_del_init(&req->list);
+		pthread_mutex_unlock(&ctx->write.lock);
+		wq_infolog64("write timeout. seq=%u", req->seq);
+		if (req->cb) {
+			req->cb(ctx, -ETIMEDOUT, nn_lat_now() - req->start, req->arg);
+		}
+		free(req);
+		return;
+	}
+	req->retry++;
+	pthread_mutex_unlock(&ctx->write.lock);
+
+	wq_infolog64("write retransmit. seq=%u retry=%u", req->seq, req->retry);
+	__nn_sendto(ctx, NN_PRIO_HIGH, req->pkt, req->sz);
+	wq_timer_sched(&req->timer, WQ_TIME_US(ctx->write.timeout_us), __nn_write_timeout, req);
+}
+
+int
+nn_write_object(nn_context_t *ctx, uuid_t target,
+		uint16_t idx, uint16_t type,
+		uint16_t offset, const void *data, uint16_t size,
+		nn_write_cb_t cb, void *arg)
+{
+	struct nn_write_req	*req;
+	nn_msg_upd_header_t	*hd;
+	nn_msg_write_header_t	*wh;
+	uint32_t		sz = sizeof(*hd) + sizeof(*wh) + size;
+
+	if (sz > ctx->datagram.pktmaxsz) {
+		return -EMSGSIZE;
+	}
+	if (nn_wire_check_payload(type, offset, size)) {
+		return -EINVAL;
+	}
+	req = (struct nn_write_req *)malloc(sizeof(*req) + sz);
+	if (!req) {
+		return -ENOMEM;
+	}
+	memset(req, 0, sizeof(*req) + sizeof(*hd) + sizeof(*wh));
+	init_list_head(&req->list);
+	wq_init_item(&req->timer);
+	req->ctx = ctx;
+	req->cb = cb;
+	req->arg = arg;
+	req->sz = sz;
+
+	hd = (nn_msg_upd_header_t *)req->pkt;
+	wh = (nn_msg_write_header_t *)(hd + 1);
+	memcpy(hd->uuid, ctx->node.uuid, sizeof hd->uuid);
+	hd->type = NN_MSG_WRITE;
+	hd->version = NN_WIRE_VERSION;
+	hd->objects = 1;
+	memcpy(wh->target, target, sizeof wh->target);
+	wh->idx = nn_wire16(idx);
+	wh->type = nn_wire16(type);
+	wh->offset = nn_wire16(offset);
+	wh->size = nn_wire16(size);
+	nn_wire_copy_payload(wh + 1, data, type, offset, size);
+
+	// ackは登録した直後から届きうるので、startは登録前に決める。
+	req->start = nn_lat_now();
+	pthread_mutex_lock(&ctx->write.lock);
+	req->seq = ++ctx->write.seq;
+	wh->seq = nn_wire32(req->seq);
+	list_add_tail(&req->list, &ctx->write.pending);
+	pthread_mutex_unlock(&ctx->write.lock);
+
+	// 指令は送信キューを経由せずに直接送信し、待ち時間を作らない。
+	__nn_sendto(ctx, NN_PRIO_HIGH, req->pkt, req->sz);
+	wq_timer_sched(&req->timer, WQ_TIME_US(ctx->write.timeout_us), __nn_write_timeout, req);
+	return 0;
+}
+
+static void
+__nn_send_ack(struct nn_context *ctx, uuid_t target, uint32_t seq, int32_t status)
+{
+	struct {
+		nn_msg_upd_header_t	hd;
+		nn_msg_ack_t		ack;
+	} pkt;
+
+	memset(&pkt, 0, sizeof pkt);
+	memcpy(pkt.hd.uuid, ctx->node.uuid, sizeof pkt.hd.uuid);
+	pkt.hd.type = NN_MSG_ACK;
+	pkt.hd.version = NN_WIRE_VERSION;
+	memcpy(pkt.ack.target, target, sizeof pkt.ack.target);
+	pkt.ack.seq = nn_wire32(seq);
+	pkt.ack.status = (int32_t)nn_wire32(status);
+	__nn_sendto(ctx, NN_PRIO_HIGH, &pkt, sizeof pkt);
+}
+
+static int
+__nn_write_seen(struct nn_context *ctx, uuid_t uuid, uint32_t seq, int32_t *status)
+{
+	int i, found = 0;
+
+	pthread_mutex_lock(&ctx->write.lock);
+	for (i = 0; i < NN_WRITE_RECENT; i++) {
+		if (ctx->write.recent[i].seq == seq &&
+		    uuid_compare(ctx->write.recent[i].uuid, uuid) == 0) {
+			*status = ctx->write.recent[i].status;
+			found = 1;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&ctx->write.lock);
+	return found;
+}
+
+static void
+__nn_write_record(struct nn_context *ctx, uuid_t uuid, uint32_t seq, int32_t status)
+{
+	uint32_t pos;
+
+	pthread_mutex_lock(&ctx->write.lock);
+	pos = ctx->write.recent_pos++ % NN_WRITE_RECENT;
+	memcpy(ctx->write.recent[pos].uuid, uuid, sizeof(uuid_t));
+	ctx->write.recent[pos].seq = seq;
+	ctx->write.recent[pos].status = status;
+	pthread_mutex_unlock(&ctx->write.lock);
+}
+
+static void
+__nn_notify_write(struct nn_context *ctx, char *buf, uint32_t sz)
+{
+	nn_msg_upd_header_t	*hd = (nn_msg_upd_header_t *)buf;
+	nn_msg_write_header_t	w, *wh = &w;
+	char			*data = buf + sizeof(*hd) + sizeof(*wh);
+	struct nn_context_object *obj;
+	int32_t			status = 0;
+
+	if (sz < sizeof(*hd) + sizeof(*wh)) {
+		wq_infolog64("short write message. sz=%u", sz);
+		return;
+	}
+	nn_wire_copy_write_header(wh, hd + 1);
+	if (sz < sizeof(*hd) + sizeof(*wh) + wh->size) {
+		wq_infolog64("short write message. sz=%u", sz);
+		return;
+	}
+	if (uuid_compare(wh->target, ctx->node.uuid) != 0) {
+		// 他ノード宛て
+		return;
+	}
+
+	// 再送された書き込みは反映し直さず、前回の結果でackだけ返す。
+	// 同じ送信元は同じ反映スレッドが処理するので、検索と記録の間に
+	// 同じ書き込みが割り込むことはない。
+	if (__nn_write_seen(ctx, hd->uuid, wh->seq, &status)) {
+		wq_infolog64("duplicate write. idx=%u seq=%u", wh->idx, wh->seq);
+		__nn_send_ack(ctx, hd->uuid, wh->seq, status);
+		return;
+	}
+
+	if (wh->idx >= NN_CTX_OBJECTS || !(ctx->objects.used_bmp & (1ull << wh->idx))) {
+		status = -ENOENT;
+	} else {
+		obj = ctx->objects.object[wh->idx];
+		if (obj->type != wh->type ||
+		    (uint32_t)wh->offset + wh->size > obj->sz ||
+		    nn_wire_check_payload(wh->type, wh->offset, wh->size)) {
+			status = -EINVAL;
+		} else {
+			nn_wire_copy_payload(obj->addr + wh->offset, data, wh->type, wh->offset, wh->size);
+			if (ctx->write.hook) {
+				ctx->write.hook(ctx, obj, wh->offset, wh->size, ctx->write.hook_arg);
+			}
+		}
+	}
+	__nn_write_record(ctx, hd->uuid, wh->seq, status);
+	wq_infolog64("write. idx=%u seq=%u status=%d", wh->idx, wh->seq, status);
+	__nn_send_ack(ctx, hd->uuid, wh->seq, status);
+}
+
+static void
+__nn_notify_ack(struct nn_context *ctx, char *buf, uint32_t sz)
+{
+	nn_msg_upd_header_t	*hd = (nn_msg_upd_header_t *)buf;
+	nn_msg_ack_t		a, *ack = &a;
+	struct nn_write_req	*req = NULL;
+	list_head_t		*pos = NULL;
+	nn_write_cb_t		cb;
+	void			*arg;
+	uint64_t		start;
+
+	if (sz < sizeof(*hd) + sizeof(*ack)) {
+		return;
+	}
+	nn_wire_copy_ack(ack, hd + 1);
+	if (uuid_compare(ack->target, ctx->node.uuid) != 0) {
+		return;
+	}
+
+	// ack待ちは少数なので線形に探す。
+	pthread_mutex_lock(&ctx->write.lock);
+	list_for_each(pos, &ctx->write.pending) {
+		struct nn_write_req *r = list_entry(pos, struct nn_write_req, list);
+		if (r->seq == ack->seq) {
+			req = r;
+			break;
+		}
+	}
+	if (!req) {
+		// 再送に対する重複したack
+		pthread_mutex_unlock(&ctx->write.lock);
+		return;
+	}
+	list_del_init(&req->list);
+	// doneを立てた後はタイマがいつreqを解放してもよいので、
+	// 必要な値はロック中に取り出しておく。
+	cb = req->cb;
+	arg = req->arg;
+	start = req->start;
+	req->done = 1;
+	pthread_mutex_unlock(&ctx->write.lock);
+
+	if (cb) {
+		cb(ctx, ack->status, nn_lat_now() - start, arg);
+	}
+}
+
+// ---------------------------------------------------------------------------
+// 名前の通知
+//
+// 名前は更新のたびには送らず、開始時と周期的な再通知でだけ送る。
+// 受信側は同じ名前の再通知をハッシュの検索だけで捨てる。
+
+static int
+__nn_check_name(const char *name)
+{
+	size_t len = strlen(name);
+
+	if (len > NN_NAME_MAX || strchr(name, '/')) {
+		return -EINVAL;
+	}
+	return 0;
+}
+
+int
+nn_set_node_name(nn_context_t *ctx, const char *name)
+{
+	if (__nn_check_name(name)) {
+		return -EINVAL;
+	}
+	strcpy(ctx->name.node, name);
+	return 0;
+}
+
+int
+nn_set_object_name(nn_context_t *ctx, struct nn_context_object *obj, const char *name)
+{
+	if (__nn_check_name(name)) {
+		return -EINVAL;
+	}
+	if (obj->idx >= NN_CTX_OBJECTS || ctx->objects.object[obj->idx] != obj) {
+		// nn_add_object()で登録していない。
+		return -ENOENT;
 	}
+	strcpy(ctx->name.object[obj->idx], name);
 	return 0;
 }
 
+void
+nn_set_name_period(nn_context_t *ctx, uint32_t period_ms)
+{
+	ctx->name.period_ms = period_ms;
+}
+
+static void
+__nn_name_timer(wq_item_t *item, wq_arg_t arg)
+{
+	__nn_send_names((nn_context_t *)arg);
+}
+
+// エントリを1つ追加する。入らなければ先に送信する。
+static uint32_t
+__nn_add_name(struct nn_context *ctx, char *buf, uint32_t bufsz, uint32_t sz,
+	      uint8_t type, uint64_t ino, const char *name)
+{
+	nn_msg_upd_header_t	*hd = (nn_msg_upd_header_t *)buf;
+	struct nn_direntry	de;
+	uint32_t		len = strlen(name);
+
+	if (sz + sizeof de + len > bufsz || hd->objects == UINT8_MAX) {
+		if (hd->objects) {
+			__nn_sendto(ctx, NN_PRIO_LOW, buf, sz);
+		}
+		hd->objects = 0;
+		sz = sizeof *hd;
+		if (sz + sizeof de + len > bufsz) {
+			// 最大データグラムサイズが小さすぎる。
+			return sz;
+		}
+	}
+	memset(&de, 0, sizeof de);
+	de.name_len = len;
+	de.type = type;
+	de.ino = nn_wire64(ino);
+	memcpy(&buf[sz], &de, sizeof de);
+	memcpy(&buf[sz + sizeof de], name, len);
+	hd->objects++;
+	return sz + sizeof de + len;
+}
+
+static void
+__nn_send_names(struct nn_context *ctx)
+{
+	char			buf[NN_DATAGRAM_PACKETMAXSZ];
+	nn_msg_upd_header_t	*hd = (nn_msg_upd_header_t *)buf;
+	uint32_t		bufsz = ctx->datagram.pktmaxsz < sizeof buf ?
+					ctx->datagram.pktmaxsz : sizeof buf;
+	uint32_t		sz = sizeof *hd;
+	uint32_t		idx;
+
+	memset(hd, 0, sizeof *hd);
+	memcpy(hd->uuid, ctx->node.uuid, sizeof hd->uuid);
+	hd->type = NN_MSG_NAME;
+	hd->version = NN_WIRE_VERSION;
+	if (ctx->name.node[0]) {
+		sz = __nn_add_name(ctx, buf, bufsz, sz, NN_DIRENTRY_TYPE_UUID, 0, ctx->name.node);
+	}
+	for (idx = 0; idx < NN_CTX_OBJECTS; idx++) {
+		if ((ctx->objects.used_bmp & (1ull << idx)) && ctx->name.object[idx][0]) {
+			sz = __nn_add_name(ctx, buf, bufsz, sz, NN_DIRENTRY_TYPE_STRING, idx,
+					   ctx->name.object[idx]);
+		}
+	}
+	if (hd->objects) {
+		__nn_sendto(ctx, NN_PRIO_LOW, buf, sz);
+	}
+
+	if (ctx->name.period_ms) {
+		wq_timer_sched(&ctx->name.timer, WQ_TIME_US(ctx->name.period_ms * 1000ull),
+			       __nn_name_timer, ctx);
+	}
+}
+
+static void
+__nn_notify_name(struct nn_context *ctx, char *buf, uint32_t sz)
+{
+	nn_msg_upd_header_t	*hd = (nn_msg_upd_header_t *)buf;
+	struct nn_direntry	de;
+	nn_d_uuid_t		*d_uuid;
+	uint64_t		ino;
+	uint32_t		cnt;
+	uint32_t		offset;
+
+	// 名前だけが先に届いた場合もノードを作成しておく。
+	d_uuid = nn_get_duuid(hd->uuid);
+	if (!d_uuid) {
+		return;
+	}
+	for (cnt = 0, offset = sizeof *hd; cnt < hd->objects;
+	     cnt++, offset += sizeof de + de.name_len) {
+		if (offset + sizeof de > sz) {
+			break;
+		}
+		memcpy(&de, &buf[offset], sizeof de);
+		if (offset + sizeof de + de.name_len > sz) {
+			wq_infolog64("truncated name. cnt=%u offset=%u sz=%u", cnt, offset, sz);
+			break;
+		}
+		ino = nn_wire64(de.ino);
+		switch (de.type) {
+		case NN_DIRENTRY_TYPE_UUID:
+			nn_dentry_set(d_uuid, NN_DENTRY_NODE, &buf[offset + sizeof de], de.name_len);
+			break;
+		case NN_DIRENTRY_TYPE_STRING:
+			if (ino < NN_DUUID_OBJECTS) {
+				nn_dentry_set(d_uuid, ino, &buf[offset + sizeof de], de.name_len);
+			}
+			break;
+		default:
+			break;
+		}
+	}
+	nn_put_duuid(d_uuid);
+}
+
+// 中継ノードがまとめた更新を、ノードごとのNN_MSG_UPDATEとして反映する。
+static void
+__nn_notify_bundle(struct nn_context *ctx, char *buf, uint32_t sz, uint64_t rx_ts)
+{
+	nn_msg_upd_header_t	*hd = (nn_msg_upd_header_t *)buf;
+	nn_msg_upd_header_t	*inner;
+	nn_msg_bundle_entry_t	ent;
+	uint32_t		cnt;
+	uint32_t		offset;
+	uint32_t		size = 0;
+
+	if (uuid_compare(hd->uuid, ctx->node.uuid) == 0) {
+		// 自分が送った束が戻ってきた。
+		return;
+	}
+	for (cnt = 0, offset = sizeof *hd; cnt < hd->objects; cnt++, offset += sizeof ent + size) {
+		if (offset + sizeof ent > sz) {
+			break;
+		}
+		memcpy(&ent, &buf[offset], sizeof ent);
+		size = nn_wire16(ent.size);
+		if (size < sizeof *inner || offset + sizeof ent + size > sz) {
+			wq_infolog64("truncated bundle. cnt=%u offset=%u sz=%u", cnt, offset, sz);
+			break;
+		}
+		inner = (nn_msg_upd_header_t *)&buf[offset + sizeof ent];
+		if (inner->type == NN_MSG_UPDATE) {
+			__nn_notify_update(ctx, (char *)inner, size, rx_ts);
+		}
+	}
+}
+
+// 受信したデータグラムを外部から投入する(記録の再生など)。
+void
+nn_input_datagram(nn_context_t *ctx, char *buf, uint32_t sz)
+{
+	__nn_recv_datagram(ctx, buf, sz, 0);
+}
+
+static void
+__nn_recv_datagram(struct nn_context *ctx, char *buf, uint32_t sz, uint64_t rx_ts)
+{
+	nn_msg_upd_header_t *hd = (nn_msg_upd_header_t *)buf;
+
+	if (sz < sizeof(*hd)) {
+		wq_infolog64("short datagram. sz=%u", sz);
+		return;
+	}
+	if (hd->version > NN_WIRE_VERSION) {
+		// 知らない形式は解釈できない。
+		wq_infolog64("unknown wire version. version=%u", hd->version);
+		return;
+	}
+	switch (hd->type) {
+	case NN_MSG_UPDATE:
+		__nn_notify_update(ctx, buf, sz, rx_ts);
+		break;
+	case NN_MSG_WRITE:
+		__nn_notify_write(ctx, buf, sz);
+		break;
+	case NN_MSG_ACK:
+		__nn_notify_ack(ctx, buf, sz);
+		break;
+	case NN_MSG_NAME:
+		__nn_notify_name(ctx, buf, sz);
+		break;
+	case NN_MSG_BUNDLE:
+		__nn_notify_bundle(ctx, buf, sz, rx_ts);
+		break;
+	default:
+		wq_infolog64("unknown message. type=%u", hd->type);
+		break;
+	}
+}
+
 static void
-__nn_notify_update(struct nn_context *ctx, char *buf, uint32_t sz)
+__nn_notify_update(struct nn_context *ctx, char *buf, uint32_t sz, uint64_t rx_ts)
 {
 	// 通知された情報をバラシて指定ノード情報へ登録する。
 	// 登録されているuuid一覧をハッシュから取得する。
@@ -301,16 +2060,26 @@ __nn_notify_update(struct nn_context *ctx, char *buf, uint32_t sz)
 	// ノード数は数十万にも及ぶので、ハッシュを使わないと
 	// 検索コストが高くなる。
 	nn_msg_upd_header_t	*hd = (nn_msg_upd_header_t *)buf;
-	nn_msg_updobj_header_t	*objh;
+	nn_msg_updobj_header_t	oh, *objh = &oh;
 	uint32_t cnt;
 	uint32_t offset;
 	char *addr;
 	nn_d_uuid_t *d_uuid;
 	nn_d_object_t *d_object;
+	uint64_t applied;
+	uint64_t apply_ts = 0;
+	uint32_t notify_mask = 0;
+	int notify;
 
 	// uuidの構造体を取得
 	d_uuid = nn_get_duuid(hd->uuid);
-	memcpy(d_uuid->uuid, hd->uuid, sizeof hd->uuid);
+	if (!d_uuid) {
+		// メモリ予算を超えている。
+		return;
+	}
+	nn_touch_duuid(d_uuid);
+	d_uuid->hops = hd->hops;
+	notify = nn_notify_begin(ctx);
 
 	wq_infolog64("notify. uuid=%016lx-%016lx objects=%d buf=%p sz=%lu",
 		     *((uint64_t*)&hd->uuid[0]),
@@ -320,16 +2089,59 @@ __nn_notify_update(struct nn_context *ctx, char *buf, uint32_t sz)
 
 	for (cnt = 0, offset = sizeof(nn_msg_upd_header_t); cnt < hd->objects;
 	     cnt++, offset += sizeof(nn_msg_updobj_header_t) + objh->size) {
-		objh = (nn_msg_updobj_header_t *)&buf[offset];
 		addr = &buf[offset + sizeof(nn_msg_updobj_header_t)];
-		d_object = nn_get_dobject(d_uuid, objh->idx);
-		d_object->objtype	= objh->type;
-		d_object->idx		= objh->idx;
+		if (offset + sizeof(nn_msg_updobj_header_t) > sz) {
+			wq_infolog64("truncated object. cnt=%u offset=%u sz=%u", cnt, offset, sz);
+			break;
+		}
+		nn_wire_copy_updobj_header(objh, &buf[offset]);
+		if (offset + sizeof(nn_msg_updobj_header_t) + objh->size > sz) {
+			// データグラムからはみ出している。以降は信用できない。
+			wq_infolog64("truncated object. cnt=%u offset=%u sz=%u", cnt, offset, sz);
+			break;
+		}
+		if (objh->idx >= NN_DUUID_OBJECTS) {
+			wq_infolog64("invalid index. idx=%u", objh->idx);
+			continue;
+		}
+		if (nn_wire_check_payload(objh->type, objh->offset, objh->size)) {
+			wq_infolog64("unaligned range. idx=%u offset=%u size=%u",
+				     objh->idx, objh->offset, objh->size);
+			continue;
+		}
+		// 初めて受信したときは、この範囲が入る大きさで作成する。
+		d_object = nn_alloc_dobject(d_uuid, objh->idx, objh->type,
+					    (uint32_t)objh->offset + objh->size);
+		if (!d_object) {
+			continue;
+		}
+		if ((uint32_t)objh->offset + objh->size > d_object->capa) {
+			// 部分的な更新から作成した後に、容量より先の範囲が来た。
+			d_object = nn_grow_dobject(d_object, (uint32_t)objh->offset + objh->size);
+			if (!d_object) {
+				wq_infolog64("object too large. idx=%u offset=%u size=%u",
+					     objh->idx, objh->offset, objh->size);
+				continue;
+			}
+		}
+		nn_set_dobject_type(d_object, objh->type);
 
 		if (d_object->size < objh->offset + objh->size) {
 			d_object->size		= objh->offset + objh->size;
 		}
-		memcpy(&d_object->addr[objh->offset], addr, objh->size);
+		nn_wire_copy_payload(&d_object->addr[objh->offset], addr, objh->type, objh->offset, objh->size);
+		if (ctx->lat.enable && !apply_ts) {
+			// メッセージ内で最初に反映したオブジェクトから計る。
+			apply_ts = nn_lat_now();
+		}
+		nn_column_apply(d_object);
+		nn_dobject_changed(d_object);
+		if (__atomic_load_n(&ctx->hook.cb, __ATOMIC_ACQUIRE)) {
+			__nn_call_hook(ctx, d_object);
+		}
+		if (notify) {
+			notify_mask |= nn_notify_object(ctx, hd->uuid, objh->type);
+		}
 
 		wq_infolog64("index[%u] type=%u offset=%u size=%u",
 			     objh->idx, objh->type, objh->offset, objh->size);
@@ -353,5 +2165,22 @@ printf("\n");
 	}
 
 	nn_put_duuid(d_uuid);
+	if (notify) {
+		nn_notify_end(ctx, notify_mask);
+	}
+	if (apply_ts) {
+		// カラム、変更ジャーナル、フック、通知の待ち手まで渡し終えた。
+		nn_lat_hist_add(&ctx->lat.hist[NN_LAT_APPLY_DELIVER], nn_lat_now() - apply_ts);
+	}
+
+	if (ctx->lat.enable) {
+		applied = nn_lat_realtime();
+		if (rx_ts && applied > rx_ts) {
+			nn_lat_hist_add(&ctx->lat.hist[NN_LAT_RX_APPLY], applied - rx_ts);
+		}
+		if ((hd->flags & NN_MSG_FL_TSTAMP) && applied > nn_wire64(hd->tstamp)) {
+			nn_lat_hist_add(&ctx->lat.hist[NN_LAT_E2E], applied - nn_wire64(hd->tstamp));
+		}
+	}
 }
 
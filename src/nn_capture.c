@@ -0,0 +1,217 @@
+/* --
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2018 Abe Takafumi
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. *
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <nn.h>
+#include <nn_capture.h>
+#include <log/log.h>
+
+// 受信経路で書くので、stdioのバッファを大きめにとってwriteをまとめる。
+#define NN_CAPTURE_BUFSZ	(1024 * 1024)
+
+int
+nn_capture_start(nn_context_t *ctx, const char *path)
+{
+	struct nn_capture	*cap;
+	nn_capture_header_t	hd;
+	int			err;
+
+	if (__atomic_load_n(&ctx->capture.cap, __ATOMIC_ACQUIRE)) {
+		return -EBUSY;
+	}
+	cap = (struct nn_capture *)calloc(1, sizeof *cap);
+	if (!cap) {
+		return -ENOMEM;
+	}
+	cap->fp = fopen(path, "wb");
+	if (!cap->fp) {
+		err = errno;
+		wq_infolog64("fopen() error. errno=%d", err);
+		free(cap);
+		return -err;
+	}
+	setvbuf(cap->fp, NULL, _IOFBF, NN_CAPTURE_BUFSZ);
+
+	memset(&hd, 0, sizeof hd);
+	hd.magic = NN_CAPTURE_MAGIC;
+	hd.version = NN_CAPTURE_VERSION;
+	hd.hdrsz = sizeof hd;
+	hd.pktmaxsz = ctx->datagram.pktmaxsz;
+	hd.start = nn_lat_realtime();
+	if (fwrite(&hd, sizeof hd, 1, cap->fp) != 1) {
+		err = errno;
+		wq_infolog64("fwrite() error. errno=%d", err);
+		fclose(cap->fp);
+		free(cap);
+		return -err;
+	}
+
+	pthread_mutex_lock(&ctx->capture.lock);
+	if (ctx->capture.cap) {
+		// 並行して開始された。
+		pthread_mutex_unlock(&ctx->capture.lock);
+		fclose(cap->fp);
+		free(cap);
+		return -EBUSY;
+	}
+	__atomic_store_n(&ctx->capture.cap, cap, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&ctx->capture.lock);
+	return 0;
+}
+
+void
+nn_capture_stop(nn_context_t *ctx)
+{
+	struct nn_capture *cap;
+
+	// 外した後は、受信スレッドが記録中でないことをロックで保証してから解放する。
+	pthread_mutex_lock(&ctx->capture.lock);
+	cap = ctx->capture.cap;
+	__atomic_store_n(&ctx->capture.cap, NULL, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&ctx->capture.lock);
+	if (!cap) {
+		return;
+	}
+	wq_infolog64("capture stop. records=%lu bytes=%lu errors=%lu",
+		     cap->records, cap->bytes, cap->errors);
+	if (fclose(cap->fp)) {
+		wq_infolog64("fclose() error. errno=%d", errno);
+	}
+	free(cap);
+}
+
+void
+nn_capture_write(struct nn_capture *cap, const void *buf, uint32_t sz, uint64_t ts)
+{
+	static const char	pad[8];
+	nn_capture_rec_t	rec;
+	size_t			padsz = NN_CAPTURE_ALIGN(sz) - sz;
+
+	rec.ts = ts;
+	rec.len = sz;
+	rec.rsv = 0;
+	if (fwrite(&rec, sizeof rec, 1, cap->fp) != 1 ||
+	    fwrite(buf, 1, sz, cap->fp) != sz ||
+	    fwrite(pad, 1, padsz, cap->fp) != padsz) {
+		// ディスクが一杯など。途中までのレコードは再生側が切り捨てる。
+		cap->errors++;
+		return;
+	}
+	cap->records++;
+	cap->bytes += sz;
+}
+
+static void
+__nn_replay_wait(uint64_t until)
+{
+	struct timespec ts;
+
+	ts.tv_sec = until / 1000000000ull;
+	ts.tv_nsec = until % 1000000000ull;
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+int
+nn_replay(nn_context_t *ctx, const char *path, int mode, nn_replay_stat_t *stat)
+{
+	const nn_capture_header_t	*hd;
+	const nn_capture_rec_t		*rec;
+	struct stat			st;
+	uint64_t			base_ts = 0;
+	uint64_t			start;
+	size_t				pos;
+	char				*map;
+	int				fd;
+
+	memset(stat, 0, sizeof *stat);
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return -errno;
+	}
+	if (fstat(fd, &st) || st.st_size < sizeof *hd) {
+		close(fd);
+		return -EINVAL;
+	}
+	map = (char *)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		return -errno;
+	}
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	hd = (const nn_capture_header_t *)map;
+	if (hd->magic != NN_CAPTURE_MAGIC || hd->version != NN_CAPTURE_VERSION) {
+		wq_infolog64("unknown capture file. magic=%x version=%u", hd->magic, hd->version);
+		munmap(map, st.st_size);
+		return -EINVAL;
+	}
+	// レコードは8byte境界に並ぶので、ヘッダサイズも揃っていなければならない。
+	if (hd->hdrsz < sizeof *hd || hd->hdrsz != NN_CAPTURE_ALIGN(hd->hdrsz) ||
+	    hd->hdrsz > st.st_size) {
+		wq_infolog64("invalid capture header size. hdrsz=%u", hd->hdrsz);
+		munmap(map, st.st_size);
+		return -EINVAL;
+	}
+
+	start = nn_lat_now();
+	for (pos = hd->hdrsz; pos + sizeof *rec <= st.st_size;
+	     pos += sizeof *rec + NN_CAPTURE_ALIGN(rec->len)) {
+		rec = (const nn_capture_rec_t *)&map[pos];
+		if (pos + sizeof *rec + rec->len > st.st_size) {
+			// 記録途中で終わっている。
+			break;
+		}
+		if (mode == NN_REPLAY_REALTIME) {
+			if (!base_ts) {
+				base_ts = rec->ts;
+			}
+			__nn_replay_wait(start + (rec->ts - base_ts));
+		}
+		// MAP_PRIVATEなので受信処理がバッファを書き換えても元には影響しない。
+		nn_input_datagram(ctx, &map[pos + sizeof *rec], rec->len);
+		stat->datagrams++;
+		stat->bytes += rec->len;
+		if (rec->len >= sizeof(nn_msg_upd_header_t) &&
+		    ((const nn_msg_upd_header_t *)rec->data)->type == NN_MSG_UPDATE) {
+			stat->objects += ((const nn_msg_upd_header_t *)rec->data)->objects;
+		}
+	}
+	stat->elapsed = nn_lat_now() - start;
+
+	munmap(map, st.st_size);
+	return 0;
+}
@@ -0,0 +1,393 @@
+/* --
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2018 Abe Takafumi
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. *
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <nn_inode.h>
+#include <nn_column.h>
+#include <nn_sensor_data.h>
+#include <log/log.h>
+
+static int __nn_column_slot(uint16_t objtype);
+static int __nn_column_grow(nn_column_t *col);
+static void __nn_column_free(nn_column_t *col);
+static int __nn_column_import(nn_d_object_t *dent_object, void *arg);
+static void __nn_column_apply(nn_column_t *col, nn_d_object_t *dent_object);
+
+// カラムビューに対応する組み込みタイプ。
+// フィールドは全てint32なので、構造体サイズからフィールド数が決まる。
+static const struct {
+	uint16_t	objtype;
+	uint16_t	nfields;
+} __nn_column_types[] = {
+	{ NN_OBJTYPE_TOUCH,	  sizeof(nn_sensor_touch_t) / sizeof(int32_t) },
+	{ NN_OBJTYPE_GYRO,	  sizeof(nn_sensor_gyro_t) / sizeof(int32_t) },
+	{ NN_OBJTYPE_COLOR,	  sizeof(nn_sensor_color_t) / sizeof(int32_t) },
+	{ NN_OBJTYPE_LIGHT,	  sizeof(nn_sensor_light_t) / sizeof(int32_t) },
+	{ NN_OBJTYPE_USONIC,	  sizeof(nn_sensor_usonic_t) / sizeof(int32_t) },
+	{ NN_OBJTYPE_COLOR_LIGHT, sizeof(nn_sensor_light_color_t) / sizeof(int32_t) },
+};
+#define NN_COLUMN_TYPES	(sizeof __nn_column_types / sizeof __nn_column_types[0])
+
+static nn_column_t	*__columns[NN_COLUMN_TYPES];
+// 既にある行の書き換えは読み込みロックで並行して行う(行はノードごとなので重ならない)。
+// 行の追加・削除と配列の再確保は書き込みロック。ストアのロックより後に取る。
+static pthread_rwlock_t	__column_lock[NN_COLUMN_TYPES] = {
+	[0 ... NN_COLUMN_TYPES - 1] = PTHREAD_RWLOCK_INITIALIZER,
+};
+
+static int
+__nn_column_slot(uint16_t objtype)
+{
+	int i;
+
+	for (i = 0; i < NN_COLUMN_TYPES; i++) {
+		if (__nn_column_types[i].objtype == objtype) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static int
+__nn_column_grow(nn_column_t *col)
+{
+	uint32_t	cap = col->cap ? col->cap * 2 : 1024;
+	void		*ptr;
+	int		f;
+
+	// 各列はSIMDのロードが揃うようにアライメントして確保する。
+	for (f = 0; f < col->nfields; f++) {
+		if (posix_memalign(&ptr, NN_COLUMN_ALIGN, sizeof(int32_t) * cap)) {
+			return -ENOMEM;
+		}
+		if (col->field[f]) {
+			memcpy(ptr, col->field[f], sizeof(int32_t) * col->rows);
+			free(col->field[f]);
+		}
+		col->field[f] = (int32_t *)ptr;
+	}
+
+	ptr = realloc(col->node, sizeof(col->node[0]) * cap);
+	if (!ptr) {
+		return -ENOMEM;
+	}
+	col->node = (struct nn_d_uuid **)ptr;
+	ptr = realloc(col->owner, sizeof(col->owner[0]) * cap);
+	if (!ptr) {
+		return -ENOMEM;
+	}
+	col->owner = (struct nn_object **)ptr;
+	col->cap = cap;
+	return 0;
+}
+
+static void
+__nn_column_free(nn_column_t *col)
+{
+	uint32_t	row;
+	int		f;
+
+	for (row = 0; row < col->rows; row++) {
+		col->owner[row]->col_row = 0;
+	}
+	for (f = 0; f < col->nfields; f++) {
+		free(col->field[f]);
+	}
+	free(col->node);
+	free(col->owner);
+	free(col);
+}
+
+static int
+__nn_column_import(nn_d_object_t *dent_object, void *arg)
+{
+	__nn_column_apply((nn_column_t *)arg, dent_object);
+	return 0;
+}
+
+int
+nn_column_enable(uint16_t objtype)
+{
+	nn_column_t	*col;
+	int		slot;
+
+	slot = __nn_column_slot(objtype);
+	if (slot < 0) {
+		wq_infolog64("not builtin type. objtype=%u", objtype);
+		return -EINVAL;
+	}
+	if (__columns[slot]) {
+		return 0;
+	}
+
+	col = (nn_column_t *)calloc(1, sizeof *col);
+	if (!col) {
+		return -ENOMEM;
+	}
+	col->objtype = objtype;
+	col->nfields = __nn_column_types[slot].nfields;
+	if (__nn_column_grow(col)) {
+		__nn_column_free(col);
+		return -ENOMEM;
+	}
+	// 有効化以前に受信しているオブジェクトを取り込む。
+	nn_store_lock();
+	pthread_rwlock_wrlock(&__column_lock[slot]);
+	__columns[slot] = col;
+	nn_for_each_objtype(objtype, __nn_column_import, col);
+	pthread_rwlock_unlock(&__column_lock[slot]);
+	nn_store_unlock();
+	return 0;
+}
+
+void
+nn_column_disable(uint16_t objtype)
+{
+	int slot = __nn_column_slot(objtype);
+
+	if (slot < 0 || !__columns[slot]) {
+		return;
+	}
+	nn_store_lock();
+	pthread_rwlock_wrlock(&__column_lock[slot]);
+	__nn_column_free(__columns[slot]);
+	__columns[slot] = NULL;
+	pthread_rwlock_unlock(&__column_lock[slot]);
+	nn_store_unlock();
+}
+
+const nn_column_t *
+nn_column_read_lock(uint16_t objtype)
+{
+	int slot = __nn_column_slot(objtype);
+
+	if (slot < 0) {
+		return NULL;
+	}
+	pthread_rwlock_rdlock(&__column_lock[slot]);
+	if (!__columns[slot]) {
+		pthread_rwlock_unlock(&__column_lock[slot]);
+		return NULL;
+	}
+	return __columns[slot];
+}
+
+void
+nn_column_read_unlock(uint16_t objtype)
+{
+	int slot = __nn_column_slot(objtype);
+
+	if (slot < 0) {
+		return;
+	}
+	pthread_rwlock_unlock(&__column_lock[slot]);
+}
+
+static void
+__nn_column_apply(nn_column_t *col, nn_d_object_t *dent_object)
+{
+	uint32_t	row;
+	uint32_t	n;
+	int		f;
+
+	if (!dent_object->col_row) {
+		// 初めての反映なので末尾に行を追加する。
+		if (col->rows == col->cap && __nn_column_grow(col)) {
+			wq_infolog64("column grow error. objtype=%u", col->objtype);
+			return;
+		}
+		row = col->rows++;
+		col->node[row] = dent_object->d_uuid;
+		col->owner[row] = dent_object;
+		dent_object->col_row = row + 1;
+	}
+
+	// 受信したサイズが組み込みタイプより小さければ、残りのフィールドは0にする。
+	row = dent_object->col_row - 1;
+	n = dent_object->size < dent_object->capa ? dent_object->size : dent_object->capa;
+	n /= sizeof(int32_t);
+	for (f = 0; f < col->nfields; f++) {
+		if (f < n) {
+			memcpy(&col->field[f][row], &dent_object->addr[f * sizeof(int32_t)], sizeof(int32_t));
+		} else {
+			col->field[f][row] = 0;
+		}
+	}
+}
+
+void
+nn_column_apply(nn_d_object_t *dent_object)
+{
+	nn_column_t	*col;
+	int		slot;
+
+	slot = __nn_column_slot(dent_object->objtype);
+	if (slot < 0 || !__columns[slot]) {
+		return;
+	}
+	// 既に行があれば書き換えるだけ。ノードの反映は1つのスレッドが行うので、
+	// 反映スレッドどうしでストアのロックを取り合わない。
+	pthread_rwlock_rdlock(&__column_lock[slot]);
+	col = __columns[slot];
+	if (col && dent_object->col_row) {
+		__nn_column_apply(col, dent_object);
+		pthread_rwlock_unlock(&__column_lock[slot]);
+		return;
+	}
+	pthread_rwlock_unlock(&__column_lock[slot]);
+
+	// 行の追加で配列が再確保されるので、他のノードの反映と排他する。
+	nn_store_lock();
+	pthread_rwlock_wrlock(&__column_lock[slot]);
+	col = __columns[slot];
+	if (col) {
+		__nn_column_apply(col, dent_object);
+	}
+	pthread_rwlock_unlock(&__column_lock[slot]);
+	nn_store_unlock();
+}
+
+void
+nn_column_remove(nn_d_object_t *dent_object)
+{
+	nn_column_t	*col;
+	uint32_t	row;
+	uint32_t	last;
+	int		slot;
+	int		f;
+
+	if (!dent_object->col_row) {
+		return;
+	}
+	slot = __nn_column_slot(dent_object->objtype);
+	if (slot < 0) {
+		dent_object->col_row = 0;
+		return;
+	}
+	pthread_rwlock_wrlock(&__column_lock[slot]);
+	col = __columns[slot];
+	if (!col || !dent_object->col_row) {
+		dent_object->col_row = 0;
+		pthread_rwlock_unlock(&__column_lock[slot]);
+		return;
+	}
+
+	// 最終行を削除する行へ移動して、列を詰めたままにする。
+	row = dent_object->col_row - 1;
+	last = --col->rows;
+	if (row != last) {
+		for (f = 0; f < col->nfields; f++) {
+			col->field[f][row] = col->field[f][last];
+		}
+		col->node[row] = col->node[last];
+		col->owner[row] = col->owner[last];
+		col->owner[row]->col_row = row + 1;
+	}
+	dent_object->col_row = 0;
+	pthread_rwlock_unlock(&__column_lock[slot]);
+}
+
+int32_t
+nn_column_min(const int32_t *col, uint32_t n)
+{
+	int32_t		m = INT32_MAX;
+	uint32_t	i;
+
+	for (i = 0; i < n; i++) {
+		m = col[i] < m ? col[i] : m;
+	}
+	return m;
+}
+
+int32_t
+nn_column_max(const int32_t *col, uint32_t n)
+{
+	int32_t		m = INT32_MIN;
+	uint32_t	i;
+
+	for (i = 0; i < n; i++) {
+		m = col[i] > m ? col[i] : m;
+	}
+	return m;
+}
+
+int64_t
+nn_column_sum(const int32_t *col, uint32_t n)
+{
+	int64_t		s = 0;
+	uint32_t	i;
+
+	for (i = 0; i < n; i++) {
+		s += col[i];
+	}
+	return s;
+}
+
+void
+nn_column_minmaxsum(const int32_t *col, uint32_t n, nn_column_stat_t *stat)
+{
+	int32_t		mn = INT32_MAX;
+	int32_t		mx = INT32_MIN;
+	int64_t		s = 0;
+	uint32_t	i;
+
+	// 1パスで3つの集計を行う。メモリ帯域が律速なので
+	// 個別に3回舐めるより速い。
+	for (i = 0; i < n; i++) {
+		mn = col[i] < mn ? col[i] : mn;
+		mx = col[i] > mx ? col[i] : mx;
+		s += col[i];
+	}
+	stat->count = n;
+	stat->min = mn;
+	stat->max = mx;
+	stat->sum = s;
+}
+
+void
+nn_column_histogram(const int32_t *col, uint32_t n,
+		    int32_t lo, int32_t width,
+		    uint32_t *bins, uint32_t nbins)
+{
+	uint32_t	i;
+	int64_t		b;
+
+	if (!nbins || width <= 0) {
+		return;
+	}
+	// binへの加算はscatterになるためベクトル化されないが、
+	// bin番号の計算は分岐なしにしてある。
+	for (i = 0; i < n; i++) {
+		b = ((int64_t)col[i] - lo) / width;
+		b = b < 0 ? 0 : b;
+		b = b >= nbins ? nbins - 1 : b;
+		bins[b]++;
+	}
+}
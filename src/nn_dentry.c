@@ -0,0 +1,264 @@
+/* --
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2018 Abe Takafumi
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. *
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <uuid/uuid.h>
+#include <list.h>
+#include <nn_inode.h>
+#include <nn_dentry.h>
+#include <log/log.h>
+
+
+static list_head_t __dentry_hash[NN_DENTRY_HASHSZ];
+static int __dentry_init;
+
+static void
+__nn_dentry_init(void)
+{
+	int i;
+
+	if (__dentry_init) {
+		return;
+	}
+	for (i = 0; i < NN_DENTRY_HASHSZ; i++) {
+		init_list_head(&__dentry_hash[i]);
+	}
+	__dentry_init = 1;
+}
+
+// 親ノードのアドレスと名前からキーを作る(FNV-1a)。
+static uint32_t
+__nn_dentry_hashkey(const nn_d_uuid_t *dir, const char *name, uint32_t len)
+{
+	uintptr_t	p = (uintptr_t)dir;
+	uint32_t	key = 2166136261u;
+	uint32_t	i;
+
+	for (i = 0; i < sizeof p; i++, p >>= 8) {
+		key = (key ^ (p & 0xff)) * 16777619u;
+	}
+	for (i = 0; i < len; i++) {
+		key = (key ^ (uint8_t)name[i]) * 16777619u;
+	}
+	return key;
+}
+
+static nn_dentry_t *
+__nn_dentry_lookup(const nn_d_uuid_t *dir, const char *name, uint32_t len)
+{
+	uint32_t	key = __nn_dentry_hashkey(dir, name, len);
+	nn_dentry_t	*dentry;
+	list_head_t	*pos = NULL;
+
+	if (!__dentry_init) {
+		return NULL;
+	}
+	list_for_each(pos, &__dentry_hash[key % NN_DENTRY_HASHSZ]) {
+		dentry = list_entry(pos, nn_dentry_t, hash);
+		if (dentry->hashkey == key && dentry->dir == dir &&
+		    dentry->name_len == len && memcmp(dentry->name, name, len) == 0) {
+			return dentry;
+		}
+	}
+	return NULL;
+}
+
+static void
+__nn_dentry_put(nn_dentry_t *dentry)
+{
+	if (--dentry->ref) {
+		return;
+	}
+	nn_store_account(NULL, -(int32_t)sizeof(nn_dentry_t));
+	free(dentry);
+}
+
+// ハッシュとノードから外し、ハッシュが持っている参照を落とす。
+static void
+__nn_dentry_unhash(nn_dentry_t *dentry)
+{
+	list_del_init(&dentry->hash);
+	list_del_init(&dentry->sibling);
+	__atomic_sub_fetch(&dentry->d_uuid->memsz, sizeof(nn_dentry_t), __ATOMIC_RELAXED);
+	__atomic_store_n(&dentry->d_uuid, NULL, __ATOMIC_RELEASE);
+	dentry->dir = NULL;
+	__nn_dentry_put(dentry);
+}
+
+int
+nn_dentry_set(nn_d_uuid_t *dent_uuid, uint16_t idx, const char *name, uint32_t len)
+{
+	nn_d_uuid_t	*dir = (idx == NN_DENTRY_NODE) ? NULL : dent_uuid;
+	nn_dentry_t	*dentry;
+	list_head_t	*pos = NULL;
+	list_head_t	*n = NULL;
+
+	if (len == 0 || len > NN_NAME_MAX || memchr(name, '/', len) ||
+	    (idx != NN_DENTRY_NODE && idx >= NN_DUUID_OBJECTS)) {
+		return -EINVAL;
+	}
+
+	nn_store_lock();
+	__nn_dentry_init();
+	dentry = __nn_dentry_lookup(dir, name, len);
+	if (dentry && dentry->d_uuid == dent_uuid && dentry->idx == idx) {
+		// 再通知。変更なし。
+		nn_store_unlock();
+		return 0;
+	}
+	if (dentry) {
+		// 同名の別の対象は、新しい通知で置き換える。
+		__nn_dentry_unhash(dentry);
+	}
+	list_for_each_safe(pos, n, &dent_uuid->dentries) {
+		dentry = list_entry(pos, nn_dentry_t, sibling);
+		if (dentry->idx == idx) {
+			// 名前が変わった。
+			__nn_dentry_unhash(dentry);
+		}
+	}
+
+	dentry = (nn_dentry_t *)malloc(sizeof *dentry);
+	if (!dentry) {
+		nn_store_unlock();
+		return -ENOMEM;
+	}
+	memset(dentry, 0, sizeof *dentry);
+	init_list_head(&dentry->hash);
+	init_list_head(&dentry->sibling);
+	dentry->dir = dir;
+	dentry->d_uuid = dent_uuid;
+	dentry->hashkey = __nn_dentry_hashkey(dir, name, len);
+	dentry->ref = 1;
+	dentry->idx = idx;
+	dentry->name_len = len;
+	memcpy(dentry->name, name, len);
+	list_add_tail(&dentry->hash, &__dentry_hash[dentry->hashkey % NN_DENTRY_HASHSZ]);
+	list_add_tail(&dentry->sibling, &dent_uuid->dentries);
+	nn_store_account(dent_uuid, sizeof(nn_dentry_t));
+	nn_store_unlock();
+
+	wq_infolog64("dentry. idx=%u name=%.*s", idx, (int)len, name);
+	return 0;
+}
+
+void
+nn_dentry_evict(nn_d_uuid_t *dent_uuid)
+{
+	list_head_t	*pos = NULL;
+	list_head_t	*n = NULL;
+
+	// オブジェクトの名前は親も自分も同じノードなので、このリストだけで足りる。
+	list_for_each_safe(pos, n, &dent_uuid->dentries) {
+		__nn_dentry_unhash(list_entry(pos, nn_dentry_t, sibling));
+	}
+}
+
+static nn_dentry_t *
+__nn_dentry_get(nn_dentry_t *dentry)
+{
+	if (dentry) {
+		dentry->ref++;
+	}
+	return dentry;
+}
+
+nn_dentry_t *
+nn_lookup_name(nn_d_uuid_t *dent_uuid, const char *name)
+{
+	nn_dentry_t	*dentry;
+
+	nn_store_lock();
+	dentry = __nn_dentry_get(__nn_dentry_lookup(dent_uuid, name, strlen(name)));
+	nn_store_unlock();
+	return dentry;
+}
+
+nn_dentry_t *
+nn_lookup_path(const char *path)
+{
+	char		str[37];
+	uuid_t		uuid;
+	nn_d_uuid_t	*dir = NULL;
+	nn_dentry_t	*dentry = NULL;
+	const char	*comp;
+	const char	*end;
+
+	// "/<UUID またはノード名>/<オブジェクト名>"
+	if (*path != '/') {
+		return NULL;
+	}
+	comp = path + 1;
+	end = strchr(comp, '/');
+	if (!end || end == comp || strchr(end + 1, '/') || !end[1]) {
+		return NULL;
+	}
+
+	nn_store_lock();
+	if (end - comp == 36) {
+		memcpy(str, comp, 36);
+		str[36] = '\0';
+		if (uuid_parse(str, uuid) == 0) {
+			dir = nn_lookup_duuid(uuid);
+		}
+	}
+	if (!dir) {
+		dentry = __nn_dentry_lookup(NULL, comp, end - comp);
+		dir = dentry ? dentry->d_uuid : NULL;
+	}
+	dentry = NULL;
+	if (dir) {
+		dentry = __nn_dentry_get(__nn_dentry_lookup(dir, end + 1, strlen(end + 1)));
+	}
+	nn_store_unlock();
+	return dentry;
+}
+
+void
+nn_put_dentry(nn_dentry_t *dentry)
+{
+	nn_store_lock();
+	__nn_dentry_put(dentry);
+	nn_store_unlock();
+}
+
+nn_d_object_t *
+nn_dentry_get_object(const nn_dentry_t *dentry)
+{
+	nn_d_object_t	*dent_object;
+
+	// 追い出しはストアのロック中にd_uuidを外すので、参照の獲得までロックする。
+	nn_store_lock();
+	dent_object = nn_dentry_peek_object(dentry);
+	if (dent_object) {
+		nn_get_dobject_ref(dent_object);
+	}
+	nn_store_unlock();
+	return dent_object;
+}
@@ -0,0 +1,236 @@
+/* --
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2018 Abe Takafumi
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. *
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+#include <linux/sock_diag.h>
+#include <log/log.h>
+#include <nn.h>
+#include <nn_filter.h>
+
+// UDPソケットのフィルタはUDPヘッダの先頭から見える。
+#define NN_FILTER_UDPHDR	(8)
+#define NN_FILTER_HD(f)		(NN_FILTER_UDPHDR + offsetof(nn_msg_upd_header_t, f))
+#define NN_FILTER_ACCEPT	(0xffffffff)
+
+// スクラッチメモリ
+#define NN_FILTER_M_OBJECTS	(0)	// ヘッダのobjects
+#define NN_FILTER_M_OFFSET	(1)	// 見ているオブジェクトヘッダの位置
+#define NN_FILTER_M_TMP		(2)
+
+void
+nn_filter_init(nn_filter_t *filter)
+{
+	memset(filter, 0, sizeof *filter);
+}
+
+int
+nn_filter_add_uuid(nn_filter_t *filter, const uuid_t uuid)
+{
+	if (filter->nuuids >= NN_FILTER_MAXUUIDS) {
+		return -ENOSPC;
+	}
+	memcpy(filter->uuid[filter->nuuids++], uuid, sizeof(uuid_t));
+	return 0;
+}
+
+int
+nn_filter_add_type(nn_filter_t *filter, uint16_t objtype)
+{
+	if (filter->ntypes >= NN_FILTER_MAXTYPES) {
+		return -ENOSPC;
+	}
+	filter->type[filter->ntypes++] = objtype;
+	return 0;
+}
+
+// maxinsnsを超える前に-ENOSPCで抜ける。
+#define EMIT(c, t, f, k)						\
+	do {								\
+		struct sock_filter __i = BPF_JUMP(c, k, t, f);		\
+		if (n >= maxinsns) {					\
+			return -ENOSPC;					\
+		}							\
+		insns[n++] = __i;					\
+	} while (0)
+
+int
+nn_filter_compile(const nn_filter_t *filter, struct sock_filter *insns, uint32_t maxinsns)
+{
+	uint32_t	n = 0;
+	uint32_t	i, j, w;
+	uint32_t	word;
+
+	// NN_MSG_UPDATE以外は通す。
+	EMIT(BPF_LD|BPF_B|BPF_ABS, 0, 0, NN_FILTER_HD(type));
+	EMIT(BPF_JMP|BPF_JEQ|BPF_K, 1, 0, NN_MSG_UPDATE);
+	EMIT(BPF_RET|BPF_K, 0, 0, NN_FILTER_ACCEPT);
+
+	// UUIDの許可リスト。ワード単位に比べ、違えば次のUUIDへ進む。
+	// BPF_Wはネットワークバイトオーダで読むので、バイト列をそのまま組み立てる。
+	for (i = 0; i < filter->nuuids; i++) {
+		for (w = 0; w < 4; w++) {
+			const uint8_t *b = &filter->uuid[i][w * 4];
+
+			word = ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) |
+			       ((uint32_t)b[2] << 8) | b[3];
+			EMIT(BPF_LD|BPF_W|BPF_ABS, 0, 0, NN_FILTER_HD(uuid) + w * 4);
+			// 一致しなければ、残りの比較とjaを飛ばす。
+			EMIT(BPF_JMP|BPF_JEQ|BPF_K, 0, (3 - w) * 2 + 1, word);
+		}
+		// 一致したらタイプの判定へ。位置は後で埋める。
+		EMIT(BPF_JMP|BPF_JA, 0, 0, 0);
+	}
+	if (filter->nuuids) {
+		EMIT(BPF_RET|BPF_K, 0, 0, 0);
+	}
+	// 各UUIDのjaをタイプの判定の先頭へ向ける。
+	for (i = 0; i < n; i++) {
+		if (insns[i].code == (BPF_JMP|BPF_JA)) {
+			insns[i].k = n - (i + 1);
+		}
+	}
+
+	if (!filter->ntypes) {
+		EMIT(BPF_RET|BPF_K, 0, 0, NN_FILTER_ACCEPT);
+		return n;
+	}
+
+	// オブジェクトヘッダを順に辿る。オブジェクトの位置はXに置く。
+	EMIT(BPF_LD|BPF_B|BPF_ABS, 0, 0, NN_FILTER_HD(objects));
+	EMIT(BPF_ST, 0, 0, NN_FILTER_M_OBJECTS);
+	EMIT(BPF_LDX|BPF_W|BPF_IMM, 0, 0, NN_FILTER_UDPHDR + sizeof(nn_msg_upd_header_t));
+	for (i = 0; i < NN_FILTER_OBJECTS; i++) {
+		// 残りのオブジェクトがなければ捨てる。
+		EMIT(BPF_LD|BPF_MEM, 0, 0, NN_FILTER_M_OBJECTS);
+		EMIT(BPF_JMP|BPF_JEQ|BPF_K, 0, 1, i);
+		EMIT(BPF_RET|BPF_K, 0, 0, 0);
+
+		// タイプはリトルエンディアンで、BPF_Hはビッグエンディアンで読む。
+		EMIT(BPF_LD|BPF_H|BPF_IND, 0, 0, offsetof(nn_msg_updobj_header_t, type));
+		for (j = 0; j < filter->ntypes; j++) {
+			EMIT(BPF_JMP|BPF_JEQ|BPF_K, filter->ntypes - j, 0,
+			     __builtin_bswap16(filter->type[j]));
+		}
+		EMIT(BPF_JMP|BPF_JA, 0, 0, 1);
+		EMIT(BPF_RET|BPF_K, 0, 0, NN_FILTER_ACCEPT);
+
+		// 次のオブジェクトヘッダへ: X += sizeof(header) + size(LE)
+		EMIT(BPF_MISC|BPF_TXA, 0, 0, 0);
+		EMIT(BPF_ST, 0, 0, NN_FILTER_M_OFFSET);
+		EMIT(BPF_LD|BPF_B|BPF_IND, 0, 0, offsetof(nn_msg_updobj_header_t, size) + 1);
+		EMIT(BPF_ALU|BPF_LSH|BPF_K, 0, 0, 8);
+		EMIT(BPF_ST, 0, 0, NN_FILTER_M_TMP);
+		EMIT(BPF_LD|BPF_B|BPF_IND, 0, 0, offsetof(nn_msg_updobj_header_t, size));
+		EMIT(BPF_LDX|BPF_W|BPF_MEM, 0, 0, NN_FILTER_M_TMP);
+		EMIT(BPF_ALU|BPF_OR|BPF_X, 0, 0, 0);
+		EMIT(BPF_LDX|BPF_W|BPF_MEM, 0, 0, NN_FILTER_M_OFFSET);
+		EMIT(BPF_ALU|BPF_ADD|BPF_X, 0, 0, 0);
+		EMIT(BPF_ALU|BPF_ADD|BPF_K, 0, 0, sizeof(nn_msg_updobj_header_t));
+		EMIT(BPF_MISC|BPF_TAX, 0, 0, 0);
+	}
+	// 先頭より後ろにまだオブジェクトがあれば、ユーザ空間に任せる。
+	EMIT(BPF_LD|BPF_MEM, 0, 0, NN_FILTER_M_OBJECTS);
+	EMIT(BPF_JMP|BPF_JEQ|BPF_K, 0, 1, NN_FILTER_OBJECTS);
+	EMIT(BPF_RET|BPF_K, 0, 0, 0);
+	EMIT(BPF_RET|BPF_K, 0, 0, NN_FILTER_ACCEPT);
+	return n;
+}
+
+#undef EMIT
+
+static int
+__nn_filter_drops(nn_context_t *ctx, uint32_t *drops)
+{
+	uint32_t	meminfo[SK_MEMINFO_VARS];
+	socklen_t	len = sizeof meminfo;
+
+	if (getsockopt(ctx->datagram.sock, SOL_SOCKET, SO_MEMINFO, meminfo, &len) < 0) {
+		return -errno;
+	}
+	*drops = meminfo[SK_MEMINFO_DROPS];
+	return 0;
+}
+
+int
+nn_filter_attach(nn_context_t *ctx, const nn_filter_t *filter)
+{
+	struct sock_filter	insns[NN_FILTER_MAXINSNS];
+	struct sock_fprog	prog;
+	int			n;
+
+	n = nn_filter_compile(filter, insns, NN_FILTER_MAXINSNS);
+	if (n < 0) {
+		return n;
+	}
+	prog.len = n;
+	prog.filter = insns;
+	if (setsockopt(ctx->datagram.sock, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof prog) < 0) {
+		wq_infolog64("setsockopt(SO_ATTACH_FILTER) error. errno=%d", errno);
+		return -errno;
+	}
+	ctx->filter.attached = 1;
+	ctx->filter.delivered = 0;
+	ctx->filter.drops = 0;
+	__nn_filter_drops(ctx, &ctx->filter.drops);
+	wq_infolog64("filter attached. uuids=%u types=%u insns=%d",
+		     filter->nuuids, filter->ntypes, n);
+	return 0;
+}
+
+int
+nn_filter_detach(nn_context_t *ctx)
+{
+	int dummy = 0;
+
+	if (!ctx->filter.attached) {
+		return 0;
+	}
+	if (setsockopt(ctx->datagram.sock, SOL_SOCKET, SO_DETACH_FILTER, &dummy, sizeof dummy) < 0) {
+		return -errno;
+	}
+	ctx->filter.attached = 0;
+	return 0;
+}
+
+int
+nn_filter_get_stat(nn_context_t *ctx, nn_filter_stat_t *stat)
+{
+	uint32_t	drops;
+	int		ret;
+
+	ret = __nn_filter_drops(ctx, &drops);
+	if (ret) {
+		return ret;
+	}
+	stat->delivered = __atomic_load_n(&ctx->filter.delivered, __ATOMIC_RELAXED);
+	stat->dropped = (uint32_t)(drops - ctx->filter.drops);
+	return 0;
+}
@@ -29,10 +29,16 @@
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <pthread.h>
+#include <time.h>
 #include <uuid/uuid.h>
 #include <list.h>
 #include <slab.h>
 #include <nn_inode.h>
+#include <nn_column.h>
+#include <nn_dentry.h>
+#include <nn_sensor_data.h>
+#include <nn_motor_data.h>
 #include <log/log.h>
 
 
@@ -46,14 +52,38 @@ static int __nn_add_uuid(nn_d_uuidctx_t *ctx, uuid_t uuid, nn_d_uuid_t *dent_uui
 static int __nn_del_uuid(nn_d_uuid_t *dent_uuid);
 static int __nn_lookup_object(nn_d_uuid_t *dent_uuid, uint32_t idx, nn_d_object_t **dent_object);
 static int __nn_add_object(nn_d_uuid_t *dent_uuid, uint32_t idx, nn_d_object_t *dent_object);
+static nn_d_object_t *__nn_add_inline(nn_d_uuid_t *dent_uuid, uint32_t idx);
+static uint32_t __nn_objtype_size(uint16_t objtype);
 static int __nn_del_object(nn_d_uuid_t *dent_uuid, uint32_t idx);
+static uint32_t __nn_objtype2hashkey(uint16_t objtype);
+static nn_d_typeidx_t *__nn_lookup_typeidx(nn_d_uuidctx_t *ctx, uint16_t objtype, int create);
+static void __nn_del_typeidx(nn_d_uuidctx_t *ctx, nn_d_object_t *dent_object);
+static int __nn_store_reserve(nn_d_uuidctx_t *ctx, uint32_t need, uint32_t part, nn_d_uuid_t *exclude);
+static void __nn_evict_duuid(nn_d_uuidctx_t *ctx, nn_d_uuid_t *dent_uuid);
+static int __nn_add_ino(nn_d_uuidctx_t *ctx, nn_d_uuid_t *dent_uuid);
 
 
 static nn_d_uuidctx_t __uuid_ctx;
+static nn_journal_ent_t __journal[NN_JOURNAL_SZ];
+static pthread_mutex_t __store_lock = PTHREAD_MUTEX_INITIALIZER;
 
 // 1つ4MBのバッファを使う
 struct slab_cache __duuid_slab;
-struct slab_cache __dobject_slab;
+struct slab_cache __dobject_slab[NN_DOBJECT_CLASSES];
+
+// 組み込みタイプのサイズ。オブジェクト作成時の容量に使う。
+static const struct {
+	uint16_t	objtype;
+	uint16_t	size;
+} __nn_objtype_sizes[] = {
+	{ NN_OBJTYPE_TOUCH,	  sizeof(nn_sensor_touch_t) },
+	{ NN_OBJTYPE_GYRO,	  sizeof(nn_sensor_gyro_t) },
+	{ NN_OBJTYPE_COLOR,	  sizeof(nn_sensor_color_t) },
+	{ NN_OBJTYPE_LIGHT,	  sizeof(nn_sensor_light_t) },
+	{ NN_OBJTYPE_USONIC,	  sizeof(nn_sensor_usonic_t) },
+	{ NN_OBJTYPE_TACHO_MOTOR, sizeof(nn_motor_tacho_t) },
+	{ NN_OBJTYPE_COLOR_LIGHT, sizeof(nn_sensor_light_color_t) },
+};
 
 static void
 __nn_duuid_constructor(void *buf, size_t sz)
@@ -65,6 +95,8 @@ __nn_duuid_constructor(void *buf, size_t sz)
 	wq_infolog64("__nn_duuid_constructor");
 	init_list_head(&d_uuid->list);
 	init_list_head(&d_uuid->list_entries);
+	init_list_head(&d_uuid->lru);
+	init_list_head(&d_uuid->dentries);
 	d_uuid->ino = 0;
 }
 
@@ -73,21 +105,46 @@ __nn_duuid_destructor(void *buf, size_t sz)
 {
 	wq_infolog64("__nn_duuid_destructor");
 	nn_d_uuid_t *dent_uuid = (nn_d_uuid_t *)buf;
+	nn_d_object_t *dent_object;
+	uint32_t idx;
+
+	// インラインのオブジェクトはノードと一緒に解放される。
+	for (idx = 0; idx < NN_DUUID_OBJECTS; idx++) {
+		if (dent_uuid->map[idx] == NN_DMAP_NONE ||
+		    (dent_uuid->map[idx] & NN_DMAP_EXT)) {
+			continue;
+		}
+		dent_object = (nn_d_object_t *)dent_uuid->inl[dent_uuid->map[idx] - 1];
+		nn_column_remove(dent_object);
+		__nn_del_typeidx(&__uuid_ctx, dent_object);
+	}
+	__atomic_sub_fetch(&__uuid_ctx.memsz,
+			   sizeof(nn_d_uuid_t) + dent_uuid->extcnt * sizeof(nn_d_object_t *),
+			   __ATOMIC_RELAXED);
+	free(dent_uuid->ext);
 	__nn_del_uuid(dent_uuid);
 }
 
 static void
 __nn_dobject_constructor(void *buf, size_t sz)
 {
+	nn_d_object_t	*d_object = (nn_d_object_t *)buf;
+
 	memset(buf, 0, sz);
+	init_list_head(&d_object->type_list);
+	d_object->capa = sz - sizeof(nn_d_object_t);
 }
 
 static void
 __nn_dobject_destructor(void *buf, size_t sz)
 {
 	nn_d_object_t *dent_object = (nn_d_object_t *)buf;
-	__nn_del_object(dent_object->d_uuid, dent_object->idx);
+	nn_column_remove(dent_object);
+	__nn_del_typeidx(&__uuid_ctx, dent_object);
+	__atomic_sub_fetch(&__uuid_ctx.memsz, sz, __ATOMIC_RELAXED);
 	if (dent_object->d_uuid) {
+		__atomic_sub_fetch(&dent_object->d_uuid->memsz, sz, __ATOMIC_RELAXED);
+		__nn_del_object(dent_object->d_uuid, dent_object->idx);
 		slab_put(dent_object->d_uuid);
 	}
 }
@@ -98,19 +155,47 @@ nn_init(void)
 	nn_d_uuidctx_t *ctx = &__uuid_ctx;
 
 	INIT_SLAB_SZ(&__duuid_slab, sizeof(nn_d_uuid_t), 4194304);
-	INIT_SLAB_SZ(&__dobject_slab, 512, 4194304);
+	int c;
+	for (c = 0; c < NN_DOBJECT_CLASSES; c++) {
+		INIT_SLAB_SZ(&__dobject_slab[c], NN_DOBJECT_CLASSSZ(c), 4194304);
+		slab_set_constructor(&__dobject_slab[c], __nn_dobject_constructor);
+		slab_set_destructor(&__dobject_slab[c], __nn_dobject_destructor);
+	}
 
 	ctx->ino = 0;
 	int i;
-	for (i = 0; i < 256; i++) {
+	for (i = 0; i < NN_UUID_HASHSZ; i++) {
 		init_list_head(&ctx->uuid_hash[i]);
 	}
 	init_list_head(&ctx->list_entries);
+	for (i = 0; i < NN_TYPEIDX_HASHSZ; i++) {
+		init_list_head(&ctx->type_hash[i]);
+	}
+	for (i = 0; i < NN_STORE_LRUS; i++) {
+		init_list_head(&ctx->lru[i]);
+	}
+	ctx->owners = 1;
 
 	slab_set_constructor(&__duuid_slab, __nn_duuid_constructor);
 	slab_set_destructor(&__duuid_slab, __nn_duuid_destructor);
-	slab_set_constructor(&__dobject_slab, __nn_dobject_constructor);
-	slab_set_destructor(&__dobject_slab, __nn_dobject_destructor);
+}
+
+void
+nn_store_lock(void)
+{
+	pthread_mutex_lock(&__store_lock);
+}
+
+void
+nn_store_unlock(void)
+{
+	pthread_mutex_unlock(&__store_lock);
+}
+
+uint32_t
+nn_uuid_hashkey(uuid_t uuid)
+{
+	return __nn_uuid2hashkey(uuid) % NN_UUID_HASHSZ;
 }
 
 static uint32_t
@@ -146,7 +231,7 @@ __nn_lookup_uuid(nn_d_uuidctx_t *ctx, uuid_t uuid, nn_d_uuid_t **dent_uuid)
 {
 	int ret = -ENOENT;
 
-	uint32_t key = __nn_uuid2hashkey(uuid) & 0xff;
+	uint32_t key = __nn_uuid2hashkey(uuid) % NN_UUID_HASHSZ;
 	// UUIDのハッシュから指定された文字列のuuidを検索する。
 	// UUIDは16byteの値である。これを1byteのハッシュにする。
 	if (list_empty(&ctx->uuid_hash[key])) {
@@ -161,8 +246,7 @@ __nn_lookup_uuid(nn_d_uuidctx_t *ctx, uuid_t uuid, nn_d_uuid_t **dent_uuid)
 	list_for_each(pos, &ctx->uuid_hash[key]) {
 		d_uuid = list_entry(pos, nn_d_uuid_t, list);
 		if (uuid_compare(d_uuid->uuid, uuid) == 0) {
-			// 見つかった。
-			slab_get(d_uuid);
+			// 見つかった。参照は呼び出し元で獲得する。
 			*dent_uuid = d_uuid;
 			ret = 0;
 			break;
@@ -181,7 +265,7 @@ __nn_add_uuid(nn_d_uuidctx_t *ctx, uuid_t uuid, nn_d_uuid_t *dent_uuid)
 {
 	int ret = 0;
 
-	uint32_t key = __nn_uuid2hashkey(uuid) & 0xff;
+	uint32_t key = __nn_uuid2hashkey(uuid) % NN_UUID_HASHSZ;
 	wq_infolog64("uuid=%016lx-%016lx key=%u", *((uint64_t*)&uuid[0]), *((uint64_t*)&uuid[8]), key);
 	list_add_tail(&dent_uuid->list, &ctx->uuid_hash[key]);
 	list_add_tail(&dent_uuid->list_entries, &ctx->list_entries);
@@ -203,6 +287,7 @@ nn_get_duuid(uuid_t uuid)
 {
 	nn_d_uuidctx_t *ctx = &__uuid_ctx;
 	nn_d_uuid_t *dent_uuid;
+	uint32_t key;
 	int ret;
 
 	ret = __nn_lookup_uuid(ctx, uuid, &dent_uuid);
@@ -211,8 +296,33 @@ nn_get_duuid(uuid_t uuid)
 		goto fined;
 	}
 
+	// slabと全ノードのリストは共有なのでロックする。
+	// ハッシュのリストはキーごとに1スレッドしか更新しない。
+	key = nn_uuid_hashkey(uuid);
+	nn_store_lock();
+	if (__nn_store_reserve(ctx, sizeof(nn_d_uuid_t), key % NN_STORE_LRUS, NULL)) {
+		ctx->rejects++;
+		nn_store_unlock();
+		return NULL;
+	}
 	dent_uuid = (nn_d_uuid_t *)slab_alloc(&__duuid_slab);
+	if (!dent_uuid) {
+		nn_store_unlock();
+		return NULL;
+	}
+	memcpy(dent_uuid->uuid, uuid, sizeof(uuid_t));
+	dent_uuid->lrupart = key % NN_STORE_LRUS;
+	dent_uuid->memsz = sizeof(nn_d_uuid_t);
+	__atomic_add_fetch(&ctx->memsz, sizeof(nn_d_uuid_t), __ATOMIC_RELAXED);
+	if (__nn_add_ino(ctx, dent_uuid)) {
+		nn_store_unlock();
+		slab_put(dent_uuid);
+		return NULL;
+	}
+	ctx->nodes++;
 	__nn_add_uuid(ctx, uuid, dent_uuid);
+	nn_store_unlock();
+	nn_touch_duuid(dent_uuid);
 
 fined:
 	// 参照を獲得して返す
@@ -227,71 +337,394 @@ nn_put_duuid(nn_d_uuid_t *dent_uuid)
 	slab_put(dent_uuid);
 }
 
+// radix-treeのノードもストアの使用量に含める。
+static void
+__nn_ino_account(nn_d_uuidctx_t *ctx, uint64_t before)
+{
+	int64_t delta = (int64_t)(ctx->ino_tree.nodes - before) * sizeof(nn_radix_node_t);
+
+	__atomic_add_fetch(&ctx->memsz, delta, __ATOMIC_RELAXED);
+}
+
+// ノード番号を振ってradix-treeへ登録する。ストアのロック中に呼び出す。
+static int
+__nn_add_ino(nn_d_uuidctx_t *ctx, nn_d_uuid_t *dent_uuid)
+{
+	uint64_t before = ctx->ino_tree.nodes;
+	int ret;
+
+	ret = nn_radix_insert(&ctx->ino_tree, ctx->ino + 1, dent_uuid);
+	__nn_ino_account(ctx, before);
+	if (ret) {
+		wq_infolog64("nn_radix_insert() error. ret=%d", ret);
+		return ret;
+	}
+	dent_uuid->ino = NN_INO(++ctx->ino, NN_INO_NODE);
+	return 0;
+}
+
+static void
+__nn_del_ino(nn_d_uuidctx_t *ctx, nn_d_uuid_t *dent_uuid)
+{
+	uint64_t before = ctx->ino_tree.nodes;
+
+	nn_radix_delete(&ctx->ino_tree, NN_INO_NODENO(dent_uuid->ino));
+	__nn_ino_account(ctx, before);
+}
+
+// 追い出しはストアのロック中にradix-treeから外して参照を落とすので、
+// 検索から参照の獲得までをロックしておけば、解放中のノードを掴まない。
+// パイプラインの反映スレッドが並行して追い出す場合に必要。
+nn_d_uuid_t *
+nn_get_duuid_by_ino(uint64_t ino)
+{
+	nn_d_uuid_t *dent_uuid;
+
+	nn_store_lock();
+	dent_uuid = (nn_d_uuid_t *)nn_radix_lookup(&__uuid_ctx.ino_tree, NN_INO_NODENO(ino));
+	if (dent_uuid) {
+		slab_get(dent_uuid);
+	}
+	nn_store_unlock();
+	return dent_uuid;
+}
+
+nn_d_object_t *
+nn_get_by_ino(uint64_t ino)
+{
+	nn_d_uuid_t *dent_uuid;
+	nn_d_object_t *dent_object = NULL;
+
+	nn_store_lock();
+	dent_uuid = (nn_d_uuid_t *)nn_radix_lookup(&__uuid_ctx.ino_tree, NN_INO_NODENO(ino));
+	if (dent_uuid) {
+		dent_object = nn_peek_dobject(dent_uuid, NN_INO_IDX(ino));
+		if (dent_object) {
+			nn_get_dobject_ref(dent_object);
+		}
+	}
+	nn_store_unlock();
+	return dent_object;
+}
+
+nn_d_uuid_t *
+nn_lookup_duuid(uuid_t uuid)
+{
+	nn_d_uuid_t *dent_uuid;
+
+	if (__nn_lookup_uuid(&__uuid_ctx, uuid, &dent_uuid)) {
+		return NULL;
+	}
+	return dent_uuid;
+}
+
 static int
 __nn_lookup_object(nn_d_uuid_t *dent_uuid, uint32_t idx, nn_d_object_t **dent_object)
 {
 	int ret = 0;
 
-	if (idx >= 32) {
+	if (idx >= NN_DUUID_OBJECTS) {
 		return -1;
 	}
-	*dent_object = dent_uuid->objects[idx];
+	if (dent_uuid->map[idx] == NN_DMAP_NONE) {
+		*dent_object = NULL;
+	} else if (dent_uuid->map[idx] & NN_DMAP_EXT) {
+		*dent_object = dent_uuid->ext[dent_uuid->map[idx] & NN_DMAP_SLOT];
+	} else {
+		*dent_object = (nn_d_object_t *)dent_uuid->inl[dent_uuid->map[idx] - 1];
+	}
 	return ret;
 }
 
 static int
 __nn_add_object(nn_d_uuid_t *dent_uuid, uint32_t idx, nn_d_object_t *dent_object)
 {
+	nn_d_object_t **ext;
+	uint32_t slot;
 	int ret = 0;
 
-	if (idx >= 32) {
+	if (idx >= NN_DUUID_OBJECTS) {
 		return -1;
 	}
+	// 空きがなければ1つ伸ばす。大きなオブジェクトを持つノードは少ないので
+	// 必要な分だけ確保する。
+	for (slot = 0; slot < dent_uuid->extcnt; slot++) {
+		if (!dent_uuid->ext[slot]) {
+			break;
+		}
+	}
+	if (slot == dent_uuid->extcnt) {
+		ext = (nn_d_object_t **)realloc(dent_uuid->ext, (slot + 1) * sizeof(nn_d_object_t *));
+		if (!ext) {
+			return -ENOMEM;
+		}
+		dent_uuid->ext = ext;
+		dent_uuid->extcnt++;
+		dent_uuid->memsz += sizeof(nn_d_object_t *);
+		__atomic_add_fetch(&__uuid_ctx.memsz, sizeof(nn_d_object_t *), __ATOMIC_RELAXED);
+	}
 	slab_get(dent_uuid);
-	dent_uuid->objects[idx] = dent_object;
+	dent_uuid->ext[slot] = dent_object;
+	dent_uuid->map[idx] = NN_DMAP_EXT | slot;
 	dent_object->d_uuid = dent_uuid;
-	wq_infolog64("uuid=%p objects[%d]=%p", dent_uuid, idx, dent_uuid->objects[idx]);
+	dent_object->idx = idx;
+	dent_object->ino = NN_INO(NN_INO_NODENO(dent_uuid->ino), idx);
+	wq_infolog64("uuid=%p objects[%d]=%p", dent_uuid, idx, dent_object);
 	return ret;
 }
 
+// 空いているインラインの領域にオブジェクトを作成する。
+// 空きがなければNULLを返す。
+static nn_d_object_t *
+__nn_add_inline(nn_d_uuid_t *dent_uuid, uint32_t idx)
+{
+	nn_d_object_t *dent_object;
+	uint32_t used = dent_uuid->inlretired;
+	uint32_t i;
+
+	for (i = 0; i < NN_DUUID_OBJECTS; i++) {
+		if (dent_uuid->map[i] != NN_DMAP_NONE && !(dent_uuid->map[i] & NN_DMAP_EXT)) {
+			used |= 1u << (dent_uuid->map[i] - 1);
+		}
+	}
+	for (i = 0; i < NN_DUUID_INLINE; i++) {
+		if (!(used & (1u << i))) {
+			break;
+		}
+	}
+	if (i == NN_DUUID_INLINE) {
+		return NULL;
+	}
+
+	dent_object = (nn_d_object_t *)dent_uuid->inl[i];
+	memset(dent_object, 0, NN_DINLINE_SZ);
+	init_list_head(&dent_object->type_list);
+	dent_object->capa = NN_DINLINE_DATASZ;
+	dent_object->flags = NN_DOBJ_FL_INLINE;
+	dent_object->d_uuid = dent_uuid;
+	dent_object->idx = idx;
+	dent_object->ino = NN_INO(NN_INO_NODENO(dent_uuid->ino), idx);
+	dent_uuid->map[idx] = i + 1;
+	return dent_object;
+}
+
 static int
 __nn_del_object(nn_d_uuid_t *dent_uuid, uint32_t idx)
 {
 	int ret = 0;
 
-	if (idx >= 32) {
+	if (idx >= NN_DUUID_OBJECTS) {
 		return -1;
 	}
-	dent_uuid->objects[idx] = NULL;
+	if (dent_uuid->map[idx] & NN_DMAP_EXT) {
+		dent_uuid->ext[dent_uuid->map[idx] & NN_DMAP_SLOT] = NULL;
+	}
+	dent_uuid->map[idx] = NN_DMAP_NONE;
 	return ret;
 }
 
+// 参照を獲得する。
+// インラインのオブジェクトはノードの参照で代用する。
+void
+nn_get_dobject_ref(nn_d_object_t *dent_object)
+{
+	if (dent_object->flags & NN_DOBJ_FL_INLINE) {
+		slab_get(dent_object->d_uuid);
+	} else {
+		slab_get(dent_object);
+	}
+}
+
+static uint32_t
+__nn_objtype_size(uint16_t objtype)
+{
+	int i;
+
+	for (i = 0; i < sizeof __nn_objtype_sizes / sizeof __nn_objtype_sizes[0]; i++) {
+		if (__nn_objtype_sizes[i].objtype == objtype) {
+			return __nn_objtype_sizes[i].size;
+		}
+	}
+	return 0;
+}
+
+// sizeを格納できる最小のサイズクラス。収まらなければ-1。
+static int
+__nn_dobject_class(uint32_t size)
+{
+	int c;
+
+	for (c = 0; c < NN_DOBJECT_CLASSES; c++) {
+		if (size <= NN_DOBJECT_CLASSSZ(c) - sizeof(nn_d_object_t)) {
+			return c;
+		}
+	}
+	return -1;
+}
+
 nn_d_object_t *
-nn_get_dobject(nn_d_uuid_t *dent_uuid, uint32_t idx)
+nn_alloc_dobject(nn_d_uuid_t *dent_uuid, uint32_t idx, uint16_t objtype, uint32_t size)
 {
 	nn_d_object_t *dent_object;
+	uint32_t typesz;
 	int ret;
+	int c;
 
 	ret = __nn_lookup_object(dent_uuid, idx, &dent_object);
-	if (!ret && dent_object != NULL) {
+	if (ret) {
+		return NULL;
+	}
+	if (dent_object != NULL) {
 		// 取得できた。
 		goto fined;
 	}
 
-	dent_object = (nn_d_object_t *)slab_alloc(&__dobject_slab);
-	__nn_add_object(dent_uuid, idx, dent_object);
+	typesz = __nn_objtype_size(objtype);
+	if (size < typesz) {
+		size = typesz;
+	}
+	if (size <= NN_DINLINE_DATASZ) {
+		// インラインはノードの中なので、ノードを更新するスレッドだけで扱える。
+		dent_object = __nn_add_inline(dent_uuid, idx);
+		if (dent_object) {
+			goto fined;
+		}
+	}
+
+	c = __nn_dobject_class(size);
+	if (c < 0) {
+		wq_infolog64("object too large. idx=%u size=%u", idx, size);
+		return NULL;
+	}
+	nn_store_lock();
+	if (__nn_store_reserve(&__uuid_ctx, NN_DOBJECT_CLASSSZ(c) + sizeof(nn_d_object_t *),
+			       dent_uuid->lrupart, dent_uuid)) {
+		__uuid_ctx.rejects++;
+		nn_store_unlock();
+		return NULL;
+	}
+	dent_object = (nn_d_object_t *)slab_alloc(&__dobject_slab[c]);
+	if (dent_object) {
+		dent_object->sclass = c;
+		__atomic_add_fetch(&__uuid_ctx.memsz, NN_DOBJECT_CLASSSZ(c), __ATOMIC_RELAXED);
+		if (__nn_add_object(dent_uuid, idx, dent_object)) {
+			// 登録前なのでデストラクタでノードを触らせない。
+			dent_object->d_uuid = NULL;
+			slab_put(dent_object);
+			dent_object = NULL;
+		} else {
+			__atomic_add_fetch(&dent_uuid->memsz, NN_DOBJECT_CLASSSZ(c), __ATOMIC_RELAXED);
+		}
+	}
+	nn_store_unlock();
+	if (!dent_object) {
+		return NULL;
+	}
 
 fined:
-	// 参照を獲得して返す
-	slab_get(dent_object);
+	nn_get_dobject_ref(dent_object);
 	return dent_object;
 }
 
+nn_d_object_t *
+nn_grow_dobject(nn_d_object_t *dent_object, uint32_t size)
+{
+	nn_d_uuid_t	*dent_uuid = dent_object->d_uuid;
+	nn_d_object_t	*grown;
+	uint32_t	idx = dent_object->idx;
+	int		c;
+
+	if (size <= dent_object->capa) {
+		return dent_object;
+	}
+	c = __nn_dobject_class(size);
+	if (c < 0) {
+		wq_infolog64("object too large. idx=%u size=%u", idx, size);
+		nn_put_dobject(dent_object);
+		return NULL;
+	}
+
+	nn_store_lock();
+	// extが1つ伸びる場合に備えて、nn_alloc_dobject()と同じだけ予約する。
+	if (__nn_store_reserve(&__uuid_ctx, NN_DOBJECT_CLASSSZ(c) + sizeof(nn_d_object_t *),
+			       dent_uuid->lrupart, dent_uuid)) {
+		__uuid_ctx.rejects++;
+		nn_store_unlock();
+		nn_put_dobject(dent_object);
+		return NULL;
+	}
+	grown = (nn_d_object_t *)slab_alloc(&__dobject_slab[c]);
+	if (!grown) {
+		nn_store_unlock();
+		nn_put_dobject(dent_object);
+		return NULL;
+	}
+	grown->sclass = c;
+	grown->objtype = dent_object->objtype;
+	grown->size = dent_object->size;
+	grown->gen = dent_object->gen;
+	memcpy(grown->addr, dent_object->addr, dent_object->size);
+	__atomic_add_fetch(&__uuid_ctx.memsz, NN_DOBJECT_CLASSSZ(c), __ATOMIC_RELAXED);
+
+	// 古いオブジェクトを索引とノードから外す。参照が残っていても、
+	// 以降はノードと無関係のオブジェクトとして解放される。
+	nn_column_remove(dent_object);
+	__nn_del_typeidx(&__uuid_ctx, dent_object);
+	if (dent_object->flags & NN_DOBJ_FL_INLINE) {
+		// 参照の数が分からないので、領域はノードが解放されるまで空けておく。
+		dent_uuid->inlretired |= 1u << (dent_uuid->map[idx] - 1);
+	}
+	__nn_del_object(dent_uuid, idx);
+	if (!(dent_object->flags & NN_DOBJ_FL_INLINE)) {
+		__atomic_sub_fetch(&dent_uuid->memsz, NN_DOBJECT_CLASSSZ(dent_object->sclass),
+				   __ATOMIC_RELAXED);
+		dent_object->d_uuid = NULL;
+		slab_put(dent_uuid);
+	}
+
+	// 空いたスロットへ置き直す。inode番号は変わらない。
+	if (__nn_add_object(dent_uuid, idx, grown)) {
+		// 登録前なのでデストラクタでノードを触らせない。
+		grown->d_uuid = NULL;
+		slab_put(grown);
+		grown = NULL;
+	} else {
+		__atomic_add_fetch(&dent_uuid->memsz, NN_DOBJECT_CLASSSZ(c), __ATOMIC_RELAXED);
+	}
+	nn_store_unlock();
+
+	if (dent_object->flags & NN_DOBJ_FL_INLINE) {
+		// インラインの参照はノードの参照。
+		slab_put(dent_uuid);
+	} else {
+		// ノードが持っていた参照と、呼び出し元の参照を落とす。
+		slab_put(dent_object);
+		slab_put(dent_object);
+	}
+	if (!grown) {
+		return NULL;
+	}
+	nn_set_dobject_type(grown, grown->objtype);
+	nn_get_dobject_ref(grown);
+	wq_infolog64("object grown. idx=%u size=%u class=%d", idx, size, c);
+	return grown;
+}
+
+nn_d_object_t *
+nn_get_dobject(nn_d_uuid_t *dent_uuid, uint32_t idx)
+{
+	return nn_alloc_dobject(dent_uuid, idx, NN_OBJTYPE_RAW, 0);
+}
+
 // inode開放
 void
 nn_put_dobject(nn_d_object_t *dent_object)
 {
-	slab_put(dent_object);
+	if (dent_object->flags & NN_DOBJ_FL_INLINE) {
+		slab_put(dent_object->d_uuid);
+	} else {
+		slab_put(dent_object);
+	}
 }
 
 // inode開放
@@ -325,6 +758,7 @@ nn_read_objects(uuid_t uuid, nn_d_object_t *object)
 {
 	nn_d_uuidctx_t *ctx = &__uuid_ctx;
 	nn_d_uuid_t *dent_uuid;
+	nn_d_object_t *next;
 	int ret;
 
 	ret = __nn_lookup_uuid(ctx, uuid, &dent_uuid);
@@ -335,13 +769,479 @@ nn_read_objects(uuid_t uuid, nn_d_object_t *object)
 	}
 
 	if (object == NULL) {
-		return dent_uuid->objects[0];
+		__nn_lookup_object(dent_uuid, 0, &next);
+		return next;
 	} else {
 		if (object->d_uuid != dent_uuid) {
 			wq_infolog64("error. unmatch.");
 			// 第一引数と第二引数が矛盾している。
 			return NULL;
 		}
-		return object->d_uuid->objects[object->idx + 1];
+		if (object->idx + 1 >= NN_DUUID_OBJECTS) {
+			return NULL;
+		}
+		__nn_lookup_object(dent_uuid, object->idx + 1, &next);
+		return next;
+	}
+}
+
+static uint32_t
+__nn_objtype2hashkey(uint16_t objtype)
+{
+	// タイプは 0x0000～, 0x0400～, 0x8000～ に固まっているので
+	// 上位bitを畳み込んでからハッシュにする。
+	return (objtype ^ (objtype >> 6) ^ (objtype >> 12)) % NN_TYPEIDX_HASHSZ;
+}
+
+static nn_d_typeidx_t *
+__nn_lookup_typeidx(nn_d_uuidctx_t *ctx, uint16_t objtype, int create)
+{
+	uint32_t key = __nn_objtype2hashkey(objtype);
+	nn_d_typeidx_t *typeidx;
+	list_head_t *pos = NULL;
+
+	list_for_each(pos, &ctx->type_hash[key]) {
+		typeidx = list_entry(pos, nn_d_typeidx_t, list);
+		if (typeidx->objtype == objtype) {
+			return typeidx;
+		}
+	}
+	if (!create) {
+		return NULL;
+	}
+
+	// タイプの種類は少ないので、初めて見つかったときに作成し
+	// 以降は解放しない。
+	typeidx = (nn_d_typeidx_t *)malloc(sizeof *typeidx);
+	if (!typeidx) {
+		wq_infolog64("malloc() error. objtype=%u", objtype);
+		return NULL;
+	}
+	init_list_head(&typeidx->list);
+	init_list_head(&typeidx->objects);
+	typeidx->objtype = objtype;
+	typeidx->count = 0;
+	list_add_tail(&typeidx->list, &ctx->type_hash[key]);
+	return typeidx;
+}
+
+static void
+__nn_del_typeidx(nn_d_uuidctx_t *ctx, nn_d_object_t *dent_object)
+{
+	nn_d_typeidx_t *typeidx;
+
+	if (list_empty(&dent_object->type_list)) {
+		// インデックスに登録されていない。
+		return;
+	}
+	typeidx = __nn_lookup_typeidx(ctx, dent_object->objtype, 0);
+	if (typeidx) {
+		typeidx->count--;
+	}
+	list_del_init(&dent_object->type_list);
+}
+
+void
+nn_set_dobject_type(nn_d_object_t *dent_object, uint16_t objtype)
+{
+	nn_d_uuidctx_t *ctx = &__uuid_ctx;
+	nn_d_typeidx_t *typeidx;
+
+	if (!list_empty(&dent_object->type_list) &&
+	    dent_object->objtype == objtype) {
+		// 変更なし。更新のたびに通るので、ここで抜ける。
+		return;
+	}
+
+	nn_store_lock();
+	nn_column_remove(dent_object);
+	__nn_del_typeidx(ctx, dent_object);
+	dent_object->objtype = objtype;
+	typeidx = __nn_lookup_typeidx(ctx, objtype, 1);
+	if (typeidx) {
+		list_add_tail(&dent_object->type_list, &typeidx->objects);
+		typeidx->count++;
+	}
+	nn_store_unlock();
+}
+
+nn_d_object_t *
+nn_read_objtype(uint16_t objtype, nn_d_object_t *object)
+{
+	nn_d_uuidctx_t *ctx = &__uuid_ctx;
+	nn_d_typeidx_t *typeidx;
+
+	typeidx = __nn_lookup_typeidx(ctx, objtype, 0);
+	if (!typeidx) {
+		return NULL;
+	}
+
+	if (object == NULL) {
+		return list_first_entry_or_null(&typeidx->objects, nn_d_object_t, type_list);
+	} else {
+		if (object->objtype != objtype || list_empty(&object->type_list)) {
+			wq_infolog64("error. unmatch.");
+			// 第一引数と第二引数が矛盾している。
+			return NULL;
+		}
+		return list_next_entry_or_null(&object->type_list, &typeidx->objects, nn_d_object_t, type_list);
+	}
+}
+
+uint32_t
+nn_count_objtype(uint16_t objtype)
+{
+	nn_d_typeidx_t *typeidx;
+	uint32_t count;
+
+	nn_store_lock();
+	typeidx = __nn_lookup_typeidx(&__uuid_ctx, objtype, 0);
+	count = typeidx ? typeidx->count : 0;
+	nn_store_unlock();
+	return count;
+}
+
+int
+nn_for_each_objtype(uint16_t objtype, int (*cb)(nn_d_object_t *, void *), void *arg)
+{
+	nn_d_typeidx_t *typeidx;
+	list_head_t *pos = NULL;
+	list_head_t *n = NULL;
+	int ret;
+
+	typeidx = __nn_lookup_typeidx(&__uuid_ctx, objtype, 0);
+	if (!typeidx) {
+		return 0;
+	}
+	list_for_each_safe(pos, n, &typeidx->objects) {
+		ret = cb(list_entry(pos, nn_d_object_t, type_list), arg);
+		if (ret) {
+			return ret;
+		}
+	}
+	return 0;
+}
+
+// ---------------------------------------------------------------------------
+// 世代と変更の記録
+
+uint64_t
+nn_dobject_changed(nn_d_object_t *dent_object)
+{
+	nn_journal_ent_t	*ent;
+	uint64_t		gen;
+
+	gen = __atomic_add_fetch(&__uuid_ctx.gen, 1, __ATOMIC_RELAXED);
+	ent = &__journal[gen & (NN_JOURNAL_SZ - 1)];
+	// 読み出し側はgenを前後で読み比べ、書き込み中の要素を使わない。
+	__atomic_store_n(&ent->gen, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&ent->ino, dent_object->ino, __ATOMIC_RELAXED);
+	__atomic_store_n(&ent->gen, gen, __ATOMIC_RELEASE);
+
+	__atomic_store_n(&dent_object->gen, gen, __ATOMIC_RELEASE);
+	__atomic_store_n(&dent_object->d_uuid->gen, gen, __ATOMIC_RELEASE);
+	return gen;
+}
+
+uint64_t
+nn_get_generation(void)
+{
+	return __atomic_load_n(&__uuid_ctx.gen, __ATOMIC_ACQUIRE);
+}
+
+// 変更のあったオブジェクト。ストアのロック中に参照を獲得して集め、
+// ロックを外してからcbを呼び出す。cbはストアのロックを取る関数を呼んでよい。
+struct __nn_changed_set {
+	nn_d_object_t	**obj;
+	uint64_t	*gen;		// 呼び出し後に返す世代
+	uint32_t	cnt;
+	uint32_t	cap;
+};
+
+static int
+__nn_changed_push(struct __nn_changed_set *set, nn_d_object_t *dent_object, uint64_t gen)
+{
+	uint32_t	cap;
+	void		*obj, *g;
+
+	if (set->cnt == set->cap) {
+		cap = set->cap ? set->cap * 2 : 256;
+		obj = realloc(set->obj, sizeof(set->obj[0]) * cap);
+		if (!obj) {
+			return -ENOMEM;
+		}
+		set->obj = (nn_d_object_t **)obj;
+		g = realloc(set->gen, sizeof(set->gen[0]) * cap);
+		if (!g) {
+			return -ENOMEM;
+		}
+		set->gen = (uint64_t *)g;
+		set->cap = cap;
+	}
+	nn_get_dobject_ref(dent_object);
+	set->obj[set->cnt] = dent_object;
+	set->gen[set->cnt] = gen;
+	set->cnt++;
+	return 0;
+}
+
+static int
+__nn_changed_skip(nn_d_object_t *dent_object, void *arg)
+{
+	return 0;
+}
+
+// 集めたオブジェクトに対してcbを呼び出して参照を返す。
+// cbが中断したらその要素の世代を*genへ入れて0以外を返す。
+static int
+__nn_changed_deliver(struct __nn_changed_set *set, int (*cb)(nn_d_object_t *, void *),
+		     void *arg, uint64_t *gen)
+{
+	uint32_t	i;
+	int		stop = 0;
+
+	for (i = 0; i < set->cnt; i++) {
+		if (!stop && cb(set->obj[i], arg)) {
+			*gen = set->gen[i];
+			stop = 1;
+		}
+		nn_put_dobject(set->obj[i]);
+	}
+	free(set->obj);
+	free(set->gen);
+	return stop;
+}
+
+// リングから外れた場合。ノードのgenで絞ってからオブジェクトを見る。
+static uint64_t
+__nn_changed_scan(uint64_t gen, uint64_t cur, int (*cb)(nn_d_object_t *, void *), void *arg)
+{
+	struct __nn_changed_set set = { NULL, NULL, 0, 0 };
+	list_head_t	*pos;
+	nn_d_uuid_t	*dent_uuid;
+	nn_d_object_t	*dent_object;
+	uint64_t	ret = cur;
+	uint32_t	idx;
+	int		err = 0;
+
+	nn_store_lock();
+	list_for_each(pos, &__uuid_ctx.list_entries) {
+		dent_uuid = list_entry(pos, nn_d_uuid_t, list_entries);
+		if (__atomic_load_n(&dent_uuid->gen, __ATOMIC_ACQUIRE) <= gen) {
+			continue;
+		}
+		for (idx = 0; idx < NN_DUUID_OBJECTS && !err; idx++) {
+			dent_object = nn_peek_dobject(dent_uuid, idx);
+			if (dent_object && __atomic_load_n(&dent_object->gen, __ATOMIC_ACQUIRE) > gen) {
+				// 中断したらどこまで済んだかわからないので、次も全体を走査させる。
+				err = __nn_changed_push(&set, dent_object, gen);
+			}
+		}
+		if (err) {
+			break;
+		}
+	}
+	nn_store_unlock();
+
+	if (err) {
+		wq_infolog64("changed scan. no memory. cnt=%u", set.cnt);
+		ret = gen;
+	}
+	__nn_changed_deliver(&set, cb, arg, &ret);
+	return ret;
+}
+
+uint64_t
+nn_changed_since(uint64_t gen, int (*cb)(nn_d_object_t *, void *), void *arg)
+{
+	struct __nn_changed_set set = { NULL, NULL, 0, 0 };
+	nn_journal_ent_t	*ent;
+	nn_d_uuid_t		*dent_uuid;
+	nn_d_object_t		*dent_object;
+	uint64_t		cur, g, g1, g2, ino;
+	uint64_t		ret;
+
+	cur = nn_get_generation();
+	if (cur - gen > NN_JOURNAL_SZ) {
+		return __nn_changed_scan(gen, cur, cb, arg);
+	}
+
+	// ジャーナルの解決は1回のロックでまとめて行う。
+	ret = cur;
+	nn_store_lock();
+	for (g = gen + 1; g <= cur; g++) {
+		ent = &__journal[g & (NN_JOURNAL_SZ - 1)];
+		g1 = __atomic_load_n(&ent->gen, __ATOMIC_ACQUIRE);
+		ino = __atomic_load_n(&ent->ino, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		g2 = __atomic_load_n(&ent->gen, __ATOMIC_RELAXED);
+		if (g1 != g2 || g1 != g) {
+			if (g1 > g || g2 > g) {
+				// 読んでいる間に上書きされた。
+				nn_store_unlock();
+				__nn_changed_deliver(&set, __nn_changed_skip, NULL, &ret);
+				return __nn_changed_scan(gen, cur, cb, arg);
+			}
+			// まだ書き込み中。次の呼び出しで続きから読む。
+			ret = g - 1;
+			break;
+		}
+		dent_uuid = (nn_d_uuid_t *)nn_radix_lookup(&__uuid_ctx.ino_tree, NN_INO_NODENO(ino));
+		dent_object = dent_uuid ? nn_peek_dobject(dent_uuid, NN_INO_IDX(ino)) : NULL;
+		// 追い出されていれば飛ばす。後の世代でも反映されていれば、そちらで呼び出す。
+		if (!dent_object || __atomic_load_n(&dent_object->gen, __ATOMIC_ACQUIRE) != g) {
+			continue;
+		}
+		if (__nn_changed_push(&set, dent_object, g)) {
+			// 集めた分だけ呼び出し、続きは次の呼び出しで読む。
+			ret = g - 1;
+			break;
+		}
+	}
+	nn_store_unlock();
+
+	__nn_changed_deliver(&set, cb, arg, &ret);
+	return ret;
+}
+
+// ---------------------------------------------------------------------------
+// メモリ予算とLRU
+
+static inline uint64_t
+__nn_store_now(void)
+{
+	struct timespec ts;
+
+	// 追い出しの順番に使うだけなので粗い時計で十分。
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void
+nn_touch_duuid(nn_d_uuid_t *dent_uuid)
+{
+	dent_uuid->atime = __nn_store_now();
+	list_move_tail(&dent_uuid->lru, &__uuid_ctx.lru[dent_uuid->lrupart]);
+}
+
+// partと同じスレッドが担当するLRUの先頭から、一番古いノードを選ぶ。
+static nn_d_uuid_t *
+__nn_lru_victim(nn_d_uuidctx_t *ctx, uint32_t part, nn_d_uuid_t *exclude)
+{
+	nn_d_uuid_t *victim = NULL;
+	nn_d_uuid_t *d_uuid;
+	uint32_t mask = ctx->owners - 1;
+	uint32_t i;
+
+	for (i = part & mask; i < NN_STORE_LRUS; i += mask + 1) {
+		d_uuid = list_first_entry_or_null(&ctx->lru[i], nn_d_uuid_t, lru);
+		if (d_uuid && d_uuid == exclude) {
+			// 反映中のノードは末尾にいるので、次を見る。
+			d_uuid = list_next_entry_or_null(&d_uuid->lru, &ctx->lru[i], nn_d_uuid_t, lru);
+		}
+		if (d_uuid && (!victim || d_uuid->atime < victim->atime)) {
+			victim = d_uuid;
+		}
 	}
+	return victim;
+}
+
+// ノードをストアから外す。参照が残っていれば、解放はそれがなくなったとき。
+static void
+__nn_evict_duuid(nn_d_uuidctx_t *ctx, nn_d_uuid_t *dent_uuid)
+{
+	nn_d_object_t *dent_object;
+	uint32_t idx;
+
+	ctx->evictions++;
+	ctx->evicted_bytes += dent_uuid->memsz;
+	ctx->nodes--;
+	list_del_init(&dent_uuid->lru);
+	nn_dentry_evict(dent_uuid);
+	__nn_del_ino(ctx, dent_uuid);
+	for (idx = 0; idx < NN_DUUID_OBJECTS; idx++) {
+		__nn_lookup_object(dent_uuid, idx, &dent_object);
+		if (!dent_object) {
+			continue;
+		}
+		nn_column_remove(dent_object);
+		__nn_del_typeidx(ctx, dent_object);
+		if (!(dent_object->flags & NN_DOBJ_FL_INLINE)) {
+			// ノードが持っている参照を落とす。
+			slab_put(dent_object);
+		}
+	}
+	__nn_del_uuid(dent_uuid);
+	// ハッシュが持っている参照を落とす。
+	slab_put(dent_uuid);
+}
+
+static int
+__nn_store_reserve(nn_d_uuidctx_t *ctx, uint32_t need, uint32_t part, nn_d_uuid_t *exclude)
+{
+	nn_d_uuid_t *victim;
+
+	while (ctx->budget &&
+	       __atomic_load_n(&ctx->memsz, __ATOMIC_RELAXED) + need > ctx->budget) {
+		victim = __nn_lru_victim(ctx, part, exclude);
+		if (!victim) {
+			return -ENOMEM;
+		}
+		wq_infolog64("evict. uuid=%016lx-%016lx memsz=%u",
+			     *((uint64_t*)&victim->uuid[0]),
+			     *((uint64_t*)&victim->uuid[8]),
+			     victim->memsz);
+		__nn_evict_duuid(ctx, victim);
+	}
+	return 0;
+}
+
+void
+nn_set_store_budget(uint64_t budget)
+{
+	nn_d_uuidctx_t *ctx = &__uuid_ctx;
+	uint32_t part;
+
+	nn_store_lock();
+	ctx->budget = budget;
+	// 既に超えていれば、ここで収める。
+	for (part = 0; part < NN_STORE_LRUS && ctx->owners == 1; part++) {
+		if (__nn_store_reserve(ctx, 0, part, NULL)) {
+			break;
+		}
+	}
+	nn_store_unlock();
+}
+
+void
+nn_store_account(nn_d_uuid_t *dent_uuid, int32_t delta)
+{
+	if (dent_uuid) {
+		__atomic_add_fetch(&dent_uuid->memsz, delta, __ATOMIC_RELAXED);
+	}
+	__atomic_add_fetch(&__uuid_ctx.memsz, (int64_t)delta, __ATOMIC_RELAXED);
+}
+
+void
+nn_store_set_owners(uint32_t owners)
+{
+	nn_store_lock();
+	__uuid_ctx.owners = owners ? owners : 1;
+	nn_store_unlock();
+}
+
+void
+nn_get_store_stat(nn_store_stat_t *stat)
+{
+	nn_d_uuidctx_t *ctx = &__uuid_ctx;
+
+	nn_store_lock();
+	stat->budget		= ctx->budget;
+	stat->memsz		= __atomic_load_n(&ctx->memsz, __ATOMIC_RELAXED);
+	stat->nodes		= ctx->nodes;
+	stat->evictions		= ctx->evictions;
+	stat->evicted_bytes	= ctx->evicted_bytes;
+	stat->rejects		= ctx->rejects;
+	nn_store_unlock();
 }
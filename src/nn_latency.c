@@ -0,0 +1,95 @@
+/* --
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2018 Abe Takafumi
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. *
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <nn_latency.h>
+
+static const char *__nn_lat_stage_names[NN_LAT_STAGES] = {
+	"enqueue->flush",
+	"flush->sendto",
+	"kernel-rx->apply",
+	"apply->subscriber",
+	"send->apply",
+};
+
+// bucket番号から、そのbinに入る最大値を求める。
+static uint64_t
+__nn_lat_bucket_upper(uint32_t b)
+{
+	uint32_t msb;
+	uint64_t sub;
+
+	if (b + 1 < (1 << NN_LAT_SUBBITS)) {
+		return b;
+	}
+	b++;
+	msb = (b >> NN_LAT_SUBBITS) + NN_LAT_SUBBITS - 1;
+	sub = b & ((1 << NN_LAT_SUBBITS) - 1);
+	if (msb >= 64) {
+		return UINT64_MAX;
+	}
+	return (((1ull << NN_LAT_SUBBITS) | sub) << (msb - NN_LAT_SUBBITS)) - 1;
+}
+
+void
+nn_lat_hist_clear(nn_lat_hist_t *hist)
+{
+	memset(hist, 0, sizeof *hist);
+}
+
+uint64_t
+nn_lat_hist_percentile(const nn_lat_hist_t *hist, double p)
+{
+	uint64_t	target;
+	uint64_t	acc = 0;
+	uint32_t	b;
+
+	if (!hist->count) {
+		return 0;
+	}
+	target = (uint64_t)(p * hist->count);
+	if (target >= hist->count) {
+		return hist->max;
+	}
+	for (b = 0; b < NN_LAT_BUCKETS; b++) {
+		acc += hist->bucket[b];
+		if (acc > target) {
+			uint64_t upper = __nn_lat_bucket_upper(b);
+			return upper < hist->max ? upper : hist->max;
+		}
+	}
+	return hist->max;
+}
+
+const char *
+nn_lat_stage_name(int stage)
+{
+	if (stage < 0 || stage >= NN_LAT_STAGES) {
+		return "unknown";
+	}
+	return __nn_lat_stage_names[stage];
+}
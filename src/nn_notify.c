@@ -0,0 +1,209 @@
+/* --
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2018 Abe Takafumi
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. *
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <uuid/uuid.h>
+#include <log/log.h>
+#include <nn.h>
+#include <nn_notify.h>
+
+_Static_assert(sizeof(((nn_context_t *)0)->notify.slot) / sizeof(struct nn_notifier *) == NN_NOTIFY_MAX,
+	       "notify.slot must hold NN_NOTIFY_MAX entries");
+
+struct nn_notifier {
+	int			fd;		// eventfd
+	int			slot;		// ctx->notify.slot[]の位置
+	int			any_node;	// すべてのノード
+	int			objtype;	// NN_NOTIFY_ANY_TYPEまたはタイプ
+	uuid_t			uuid;
+	int			armed;		// 次の反映でeventfdへ書き込む
+	uint64_t		events;		// consumeされていない反映数
+	uint64_t		wakeups;
+};
+
+nn_notifier_t *
+nn_notifier_open(nn_context_t *ctx, const uuid_t uuid, int objtype)
+{
+	nn_notifier_t	*n;
+	int		i;
+
+	n = (nn_notifier_t *)calloc(1, sizeof *n);
+	if (!n) {
+		return NULL;
+	}
+	n->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (n->fd < 0) {
+		wq_infolog64("eventfd() error. errno=%d", errno);
+		free(n);
+		return NULL;
+	}
+	n->any_node = uuid == NULL;
+	if (uuid) {
+		memcpy(n->uuid, uuid, sizeof n->uuid);
+	}
+	n->objtype = objtype;
+	n->armed = 1;
+
+	pthread_rwlock_wrlock(&ctx->notify.lock);
+	for (i = 0; i < NN_NOTIFY_MAX; i++) {
+		if (!ctx->notify.slot[i]) {
+			break;
+		}
+	}
+	if (i == NN_NOTIFY_MAX) {
+		pthread_rwlock_unlock(&ctx->notify.lock);
+		close(n->fd);
+		free(n);
+		return NULL;
+	}
+	n->slot = i;
+	ctx->notify.slot[i] = n;
+	__atomic_add_fetch(&ctx->notify.cnt, 1, __ATOMIC_RELEASE);
+	pthread_rwlock_unlock(&ctx->notify.lock);
+	return n;
+}
+
+void
+nn_notifier_close(nn_context_t *ctx, nn_notifier_t *n)
+{
+	// 反映側は読み込みロックの間だけ参照するので、外した後は解放してよい。
+	pthread_rwlock_wrlock(&ctx->notify.lock);
+	ctx->notify.slot[n->slot] = NULL;
+	__atomic_sub_fetch(&ctx->notify.cnt, 1, __ATOMIC_RELEASE);
+	pthread_rwlock_unlock(&ctx->notify.lock);
+	close(n->fd);
+	free(n);
+}
+
+int
+nn_notifier_fd(const nn_notifier_t *n)
+{
+	return n->fd;
+}
+
+uint64_t
+nn_notifier_consume(nn_notifier_t *n)
+{
+	uint64_t v;
+
+	// eventfdを空にしてから再び有効にし、最後に反映数を取り出す。
+	// 有効にする前の反映はeventsに残り、後の反映は新しく書き込むので、
+	// 取りこぼしはない(余分な起床はあり得る)。
+	if (read(n->fd, &v, sizeof v) < 0 && errno != EAGAIN) {
+		wq_infolog64("eventfd read error. errno=%d", errno);
+	}
+	__atomic_store_n(&n->armed, 1, __ATOMIC_SEQ_CST);
+	return __atomic_exchange_n(&n->events, 0, __ATOMIC_SEQ_CST);
+}
+
+uint64_t
+nn_notifier_wait(nn_notifier_t *n, int timeout_ms)
+{
+	struct pollfd pfd;
+
+	pfd.fd = n->fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	if (poll(&pfd, 1, timeout_ms) <= 0) {
+		return 0;
+	}
+	return nn_notifier_consume(n);
+}
+
+uint64_t
+nn_notifier_wakeups(const nn_notifier_t *n)
+{
+	return __atomic_load_n(&n->wakeups, __ATOMIC_RELAXED);
+}
+
+// 通知フックから登録や解除ができるように、読み込みロックは
+// nn_notify_object()とnn_notify_end()の中でだけ取る。
+int
+nn_notify_begin(nn_context_t *ctx)
+{
+	return __atomic_load_n(&ctx->notify.cnt, __ATOMIC_ACQUIRE) != 0;
+}
+
+uint32_t
+nn_notify_object(nn_context_t *ctx, const uuid_t uuid, uint16_t objtype)
+{
+	nn_notifier_t	*n;
+	uint32_t	mask = 0;
+	int		i;
+
+	pthread_rwlock_rdlock(&ctx->notify.lock);
+	for (i = 0; i < NN_NOTIFY_MAX; i++) {
+		n = ctx->notify.slot[i];
+		if (!n) {
+			continue;
+		}
+		if (n->objtype != NN_NOTIFY_ANY_TYPE && n->objtype != objtype) {
+			continue;
+		}
+		if (!n->any_node && memcmp(n->uuid, uuid, sizeof n->uuid) != 0) {
+			continue;
+		}
+		__atomic_add_fetch(&n->events, 1, __ATOMIC_SEQ_CST);
+		mask |= 1u << i;
+	}
+	pthread_rwlock_unlock(&ctx->notify.lock);
+	return mask;
+}
+
+// データグラム1つ分の反映が終わってから、まとめて起こす。
+// 間に解除されたスロットは飛ばす。同じスロットへ登録し直されていれば
+// 余分に起こすことになるが、consumeが0を返すだけなので構わない。
+void
+nn_notify_end(nn_context_t *ctx, uint32_t mask)
+{
+	nn_notifier_t	*n;
+	uint64_t	one = 1;
+	int		i;
+
+	if (!mask) {
+		return;
+	}
+	pthread_rwlock_rdlock(&ctx->notify.lock);
+	while (mask) {
+		i = __builtin_ctz(mask);
+		mask &= mask - 1;
+		n = ctx->notify.slot[i];
+		if (n && __atomic_exchange_n(&n->armed, 0, __ATOMIC_SEQ_CST)) {
+			if (write(n->fd, &one, sizeof one) < 0) {
+				wq_infolog64("eventfd write error. errno=%d", errno);
+			}
+			__atomic_add_fetch(&n->wakeups, 1, __ATOMIC_RELAXED);
+		}
+	}
+	pthread_rwlock_unlock(&ctx->notify.lock);
+}
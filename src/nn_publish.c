@@ -0,0 +1,303 @@
+/* --
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2018 Abe Takafumi
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. *
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <wq/wq.h>
+#include <log/log.h>
+#include <bitops.h>
+#include <nn.h>
+#include <nn_publish.h>
+
+struct nn_publish_shadow {
+	struct nn_context_object	*obj;	// シャドウを取ったオブジェクト
+	uint32_t			sz;	// シャドウのサイズ(0は未取得)
+	char				*data;
+};
+
+struct nn_publish {
+	nn_context_t			*ctx;
+	uint32_t			tick_us;
+	int				stop;
+	wq_item_t			timer;
+	uint32_t			maxrange;	// 1つの範囲の最大サイズ
+	struct nn_publish_shadow	shadow[NN_CTX_OBJECTS];
+	nn_publish_stat_t		stat;
+};
+
+#define NN_PUBLISH_BLOCK	(32)
+
+static inline uint64_t
+__nn_publish_load64(const char *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof v);
+	return v;
+}
+
+// [pos, sz)でa,bが最初に異なる位置を返す。なければszを返す。
+static uint32_t
+__nn_publish_diff(const char *a, const char *b, uint32_t pos, uint32_t sz)
+{
+	uint64_t x;
+
+	// 変化のないブロックを4ワードずつまとめて飛ばす。
+	for (; pos + NN_PUBLISH_BLOCK <= sz; pos += NN_PUBLISH_BLOCK) {
+		x  = __nn_publish_load64(a + pos) ^ __nn_publish_load64(b + pos);
+		x |= __nn_publish_load64(a + pos + 8) ^ __nn_publish_load64(b + pos + 8);
+		x |= __nn_publish_load64(a + pos + 16) ^ __nn_publish_load64(b + pos + 16);
+		x |= __nn_publish_load64(a + pos + 24) ^ __nn_publish_load64(b + pos + 24);
+		if (x) {
+			break;
+		}
+	}
+	for (; pos + 8 <= sz; pos += 8) {
+		x = __nn_publish_load64(a + pos) ^ __nn_publish_load64(b + pos);
+		if (x) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+			return pos + (__builtin_clzll(x) >> 3);
+#else
+			return pos + (__builtin_ctzll(x) >> 3);
+#endif
+		}
+	}
+	for (; pos < sz && a[pos] == b[pos]; pos++) {
+	}
+	return pos;
+}
+
+// posから変化が続く範囲の終わりを返す。
+// NN_PUBLISH_GAP byte以上一致が続いたところを終わりとする。
+static uint32_t
+__nn_publish_same(const char *a, const char *b, uint32_t pos, uint32_t sz)
+{
+	uint32_t same = 0;
+	uint64_t x;
+
+	for (; pos + 8 <= sz; pos += 8) {
+		x = __nn_publish_load64(a + pos) ^ __nn_publish_load64(b + pos);
+		if (!x) {
+			same += 8;
+		} else {
+			// ワード内で最後に異なるバイトより後ろの一致したバイト数
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+			same = __builtin_ctzll(x) >> 3;
+#else
+			same = __builtin_clzll(x) >> 3;
+#endif
+		}
+		if (same >= NN_PUBLISH_GAP) {
+			return pos + 8 - same;
+		}
+	}
+	for (; pos < sz; pos++) {
+		if (a[pos] != b[pos]) {
+			same = 0;
+		} else if (++same >= NN_PUBLISH_GAP) {
+			return pos + 1 - same;
+		}
+	}
+	return sz - same;
+}
+
+static int
+__nn_publish_range(struct nn_publish *pub, struct nn_publish_shadow *sh,
+		   uint32_t start, uint32_t end)
+{
+	uint32_t size;
+	int ret = 0;
+
+	// ワード単位で送れるように4byte境界へ広げる。
+	start &= ~3u;
+	end = (end + 3) & ~3u;
+	if (end > sh->sz) {
+		end = sh->sz;
+	}
+	for (; start < end; start += size) {
+		size = end - start < pub->maxrange ? end - start : pub->maxrange;
+		if (nn_update_object(pub->ctx, sh->obj, start, size)) {
+			// シャドウは古いままにして、次の走査で送り直す。
+			pub->stat.errors++;
+			ret = -ENOSPC;
+			continue;
+		}
+		// 送信キューへ入った範囲だけシャドウへ反映する。
+		memcpy(sh->data + start, sh->obj->addr + start, size);
+		pub->stat.changed += size;
+		pub->stat.ranges++;
+	}
+	return ret;
+}
+
+// シャドウをオブジェクトに合わせる。取り直したら1を返す。
+static int
+__nn_publish_attach(struct nn_publish_shadow *sh, struct nn_context_object *obj)
+{
+	char		*data;
+	uint32_t	i;
+
+	if (sh->obj == obj && sh->sz == obj->sz) {
+		return 0;
+	}
+	data = (char *)realloc(sh->data, obj->sz ? obj->sz : 1);
+	if (!data) {
+		return -ENOMEM;
+	}
+	// 送信できなかった範囲が次の比較で必ず差分になるよう、
+	// 実データの反転で埋めておく。
+	for (i = 0; i < obj->sz; i++) {
+		data[i] = ~((const char *)obj->addr)[i];
+	}
+	sh->data = data;
+	sh->obj = obj;
+	sh->sz = obj->sz;
+	return 1;
+}
+
+int
+nn_publish_dirty(nn_context_t *ctx)
+{
+	struct nn_publish		*pub = ctx->publish;
+	struct nn_publish_shadow	*sh;
+	struct nn_context_object	*obj;
+	uint32_t			start, end;
+	int				bit, ret, ranges = 0;
+
+	if (!pub) {
+		return -EINVAL;
+	}
+	pub->stat.ticks++;
+	for_each_set_bit64(bit, &ctx->objects.used_bmp) {
+		if (bit >= NN_CTX_OBJECTS) {
+			break;
+		}
+		obj = ctx->objects.object[bit];
+		sh = &pub->shadow[bit];
+		ret = __nn_publish_attach(sh, obj);
+		if (ret < 0) {
+			return ret;
+		}
+		if (ret) {
+			// 新しく登録されたオブジェクトは全体を送る。
+			__nn_publish_range(pub, sh, 0, sh->sz);
+			ranges++;
+			continue;
+		}
+		pub->stat.compared += sh->sz;
+		for (start = 0; ; start = end) {
+			start = __nn_publish_diff(obj->addr, sh->data, start, sh->sz);
+			if (start >= sh->sz) {
+				break;
+			}
+			end = __nn_publish_same(obj->addr, sh->data, start, sh->sz);
+			__nn_publish_range(pub, sh, start, end);
+			ranges++;
+			// 4byte境界へ広げた分はシャドウに反映済み。
+			end = (end + 3) & ~3u;
+		}
+	}
+	return ranges;
+}
+
+static void
+__nn_publish_free(struct nn_publish *pub)
+{
+	int i;
+
+	for (i = 0; i < NN_CTX_OBJECTS; i++) {
+		free(pub->shadow[i].data);
+	}
+	free(pub);
+}
+
+static void
+__nn_publish_timer(wq_item_t *item, wq_arg_t arg)
+{
+	struct nn_publish *pub = (struct nn_publish *)arg;
+
+	if (pub->stop) {
+		__nn_publish_free(pub);
+		return;
+	}
+	nn_publish_dirty(pub->ctx);
+	wq_timer_sched(&pub->timer, WQ_TIME_US(pub->tick_us), __nn_publish_timer, pub);
+}
+
+int
+nn_publish_start(nn_context_t *ctx, uint32_t tick_us)
+{
+	struct nn_publish *pub;
+
+	if (ctx->publish) {
+		return -EBUSY;
+	}
+	pub = (struct nn_publish *)calloc(1, sizeof *pub);
+	if (!pub) {
+		return -ENOMEM;
+	}
+	pub->ctx = ctx;
+	pub->tick_us = tick_us;
+	// 送信バッファに1つで入る大きさ。4byte境界に揃える。
+	pub->maxrange = (ctx->datagram.pktmaxsz - sizeof(nn_msg_upd_header_t)
+			 - sizeof(nn_msg_updobj_header_t)) & ~3u;
+	ctx->publish = pub;
+
+	if (tick_us) {
+		wq_init_item(&pub->timer);
+		wq_timer_sched(&pub->timer, WQ_TIME_US(tick_us), __nn_publish_timer, pub);
+	}
+	wq_infolog64("publish start. tick_us=%u", tick_us);
+	return 0;
+}
+
+void
+nn_publish_stop(nn_context_t *ctx)
+{
+	struct nn_publish *pub = ctx->publish;
+
+	if (!pub) {
+		return;
+	}
+	ctx->publish = NULL;
+	if (pub->tick_us) {
+		pub->stop = 1;
+	} else {
+		__nn_publish_free(pub);
+	}
+}
+
+int
+nn_get_publish_stat(nn_context_t *ctx, nn_publish_stat_t *stat)
+{
+	if (!ctx->publish) {
+		return -EINVAL;
+	}
+	*stat = ctx->publish->stat;
+	return 0;
+}
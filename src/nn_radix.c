@@ -0,0 +1,143 @@
+/* --
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2018 Abe Takafumi
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. *
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <nn_radix.h>
+
+
+static nn_radix_node_t *
+__nn_radix_alloc(nn_radix_t *tree, uint32_t shift)
+{
+	nn_radix_node_t *node;
+
+	node = (nn_radix_node_t *)calloc(1, sizeof *node);
+	if (!node) {
+		return NULL;
+	}
+	node->shift = shift;
+	tree->nodes++;
+	return node;
+}
+
+static void
+__nn_radix_free(nn_radix_t *tree, nn_radix_node_t *node)
+{
+	tree->nodes--;
+	free(node);
+}
+
+int
+nn_radix_insert(nn_radix_t *tree, uint64_t key, void *item)
+{
+	nn_radix_node_t	*node;
+	nn_radix_node_t	*child;
+	uint32_t	idx;
+
+	if (!tree->root) {
+		node = __nn_radix_alloc(tree, 0);
+		if (!node) {
+			return -ENOMEM;
+		}
+		__atomic_store_n(&tree->root, node, __ATOMIC_RELEASE);
+	}
+	// 高さが足りなければ根の上にノードを足す。
+	// 新しい根を作り終えてから差し替えるので、検索は古い根のままでも正しい。
+	while (__nn_radix_over(tree->root, key)) {
+		node = __nn_radix_alloc(tree, tree->root->shift + NN_RADIX_BITS);
+		if (!node) {
+			return -ENOMEM;
+		}
+		node->slot[0] = tree->root;
+		node->count = 1;
+		__atomic_store_n(&tree->root, node, __ATOMIC_RELEASE);
+	}
+
+	node = tree->root;
+	while (node->shift) {
+		idx = (key >> node->shift) & NN_RADIX_MASK;
+		child = (nn_radix_node_t *)node->slot[idx];
+		if (!child) {
+			child = __nn_radix_alloc(tree, node->shift - NN_RADIX_BITS);
+			if (!child) {
+				return -ENOMEM;
+			}
+			__atomic_store_n(&node->slot[idx], child, __ATOMIC_RELEASE);
+			node->count++;
+		}
+		node = child;
+	}
+	idx = key & NN_RADIX_MASK;
+	if (node->slot[idx]) {
+		return -EEXIST;
+	}
+	__atomic_store_n(&node->slot[idx], item, __ATOMIC_RELEASE);
+	node->count++;
+	return 0;
+}
+
+void *
+nn_radix_delete(nn_radix_t *tree, uint64_t key)
+{
+	nn_radix_node_t	*path[NN_RADIX_MAXDEPTH];
+	nn_radix_node_t	*node = tree->root;
+	void		*item;
+	int		depth = 0;
+
+	if (!node || __nn_radix_over(node, key)) {
+		return NULL;
+	}
+	for (;;) {
+		path[depth++] = node;
+		if (!node->shift) {
+			break;
+		}
+		node = (nn_radix_node_t *)node->slot[(key >> node->shift) & NN_RADIX_MASK];
+		if (!node) {
+			return NULL;
+		}
+	}
+	item = node->slot[key & NN_RADIX_MASK];
+	if (!item) {
+		return NULL;
+	}
+
+	// 葉から順にslotを空け、空になったノードは解放して親のslotも空ける。
+	while (depth--) {
+		node = path[depth];
+		__atomic_store_n(&node->slot[(key >> node->shift) & NN_RADIX_MASK], NULL, __ATOMIC_RELEASE);
+		if (--node->count) {
+			break;
+		}
+		if (!depth) {
+			__atomic_store_n(&tree->root, NULL, __ATOMIC_RELEASE);
+		}
+		__nn_radix_free(tree, node);
+	}
+	return item;
+}
@@ -0,0 +1,399 @@
+/* --
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2018 Abe Takafumi
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. *
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <uuid/uuid.h>
+#include <wq/wq.h>
+#include <log/log.h>
+#include <nn.h>
+#include <nn_inode.h>
+#include <nn_wire.h>
+#include <nn_relay.h>
+
+
+// 窓の間に更新されたノード。inode番号で開番地法のハッシュに置く。
+// ノードを指すポインタは持たないので、窓の間に追い出されても安全。
+struct nn_relay_dirty {
+	uint64_t		ino;		// ノードのinode番号(0は空き)
+	uint32_t		mask;		// 更新されたオブジェクトのindex
+	uint32_t		rsv;
+};
+
+struct nn_relay_set {
+	struct nn_relay_dirty	*ent;
+	uint32_t		size;		// 2の累乗
+	uint32_t		cnt;
+};
+
+struct nn_relay {
+	nn_context_t		*down;
+	nn_context_t		*up;
+	nn_relay_param_t	param;
+	nn_notify_hook_t	prev_cb;
+	void			*prev_arg;
+	pthread_mutex_t		lock;		// 集約中の集合の排他(反映側と窓のタイマ)
+	pthread_mutex_t		flush_lock;	// 送信側の排他(タイマとnn_relay_flush)
+	struct nn_relay_set	set[2];		// 集約中と送信中を入れ替えて使う
+	uint32_t		cur;
+	int			stop;
+	wq_item_t		timer;
+	char			*pkt;		// 上流へのデータグラム
+	uint32_t		pktsz;		// pktの使用量
+	uint32_t		pktmaxsz;
+	uint32_t		inner;		// 組み立て中の内側メッセージの位置(0はなし)
+	nn_relay_stat_t		stat;
+};
+
+#define NN_RELAY_SET_INIT	(1024)
+
+void
+nn_relay_param_init(nn_relay_param_t *param)
+{
+	param->window_us	= 100000;
+	param->maxhops		= 4;
+	param->prio		= NN_PRIO_NORMAL;
+}
+
+static inline uint32_t
+__nn_relay_slot(const struct nn_relay_set *set, uint64_t ino)
+{
+	// ノード番号は連番なので、乗算で散らす。
+	return (uint32_t)((NN_INO_NODENO(ino) * 0x9e3779b97f4a7c15ull) >> 32) & (set->size - 1);
+}
+
+static struct nn_relay_dirty *
+__nn_relay_find(struct nn_relay_set *set, uint64_t ino)
+{
+	uint32_t i = __nn_relay_slot(set, ino);
+	uint32_t n;
+
+	for (n = 0; n < set->size; n++) {
+		if (!set->ent[i].ino || set->ent[i].ino == ino) {
+			return &set->ent[i];
+		}
+		i = (i + 1) & (set->size - 1);
+	}
+	// 満杯で見つからない。
+	return NULL;
+}
+
+static int
+__nn_relay_grow(struct nn_relay_set *set)
+{
+	struct nn_relay_set	old = *set;
+	struct nn_relay_dirty	*d;
+	uint32_t		i;
+
+	set->ent = (struct nn_relay_dirty *)calloc(old.size * 2, sizeof *set->ent);
+	if (!set->ent) {
+		*set = old;
+		return -ENOMEM;
+	}
+	set->size = old.size * 2;
+	for (i = 0; i < old.size; i++) {
+		if (old.ent[i].ino) {
+			d = __nn_relay_find(set, old.ent[i].ino);
+			*d = old.ent[i];
+		}
+	}
+	free(old.ent);
+	return 0;
+}
+
+static void
+__nn_relay_hook(nn_context_t *ctx, struct nn_object *obj, void *arg)
+{
+	nn_relay_t		*relay = (nn_relay_t *)arg;
+	nn_d_uuid_t		*d_uuid = obj->d_uuid;
+	struct nn_relay_set	*set;
+	struct nn_relay_dirty	*d;
+	int			room;
+
+	pthread_mutex_lock(&relay->lock);
+	relay->stat.updates++;
+	if (d_uuid->hops >= relay->param.maxhops) {
+		relay->stat.hops_drop++;
+	} else if (uuid_compare(d_uuid->uuid, relay->up->node.uuid) != 0) {
+		set = &relay->set[relay->cur];
+		room = set->cnt * 2 < set->size || !__nn_relay_grow(set);
+		d = __nn_relay_find(set, d_uuid->ino);
+		if (d && !d->ino && !room) {
+			// 広げられなければ、既にあるノードの更新だけを受け付ける。
+			d = NULL;
+		}
+		if (!d) {
+			relay->stat.nomem_drop++;
+		} else {
+			if (!d->ino) {
+				d->ino = d_uuid->ino;
+				d->mask = 0;
+				set->cnt++;
+			}
+			d->mask |= 1u << obj->idx;
+		}
+	}
+	pthread_mutex_unlock(&relay->lock);
+
+	if (relay->prev_cb) {
+		relay->prev_cb(ctx, obj, relay->prev_arg);
+	}
+}
+
+// ---------------------------------------------------------------------------
+// 束の組み立て
+
+static void
+__nn_relay_send(nn_relay_t *relay)
+{
+	nn_msg_upd_header_t *hd = (nn_msg_upd_header_t *)relay->pkt;
+
+	if (hd->objects) {
+		nn_send_datagram(relay->up, relay->param.prio, relay->pkt, relay->pktsz);
+		relay->stat.datagrams++;
+		relay->stat.bytes += relay->pktsz;
+	}
+	memset(hd, 0, sizeof *hd);
+	memcpy(hd->uuid, relay->up->node.uuid, sizeof hd->uuid);
+	hd->type = NN_MSG_BUNDLE;
+	hd->version = NN_WIRE_VERSION;
+	relay->pktsz = sizeof *hd;
+	relay->inner = 0;
+}
+
+// 組み立て中の内側メッセージを閉じる。
+static void
+__nn_relay_close(nn_relay_t *relay)
+{
+	nn_msg_bundle_entry_t	ent;
+	uint32_t		off = relay->inner;
+
+	if (!off) {
+		return;
+	}
+	memset(&ent, 0, sizeof ent);
+	ent.size = nn_wire16(relay->pktsz - off - sizeof ent);
+	memcpy(&relay->pkt[off], &ent, sizeof ent);
+	((nn_msg_upd_header_t *)relay->pkt)->objects++;
+	relay->inner = 0;
+}
+
+// ノードの内側メッセージを開く。入らなければ先に送信する。
+static int
+__nn_relay_open(nn_relay_t *relay, nn_d_uuid_t *d_uuid, uint32_t need)
+{
+	nn_msg_upd_header_t	*inner;
+	uint32_t		hdrsz = sizeof(nn_msg_bundle_entry_t) + sizeof(nn_msg_upd_header_t);
+
+	if (relay->pktsz + hdrsz + need > relay->pktmaxsz) {
+		__nn_relay_send(relay);
+		if (relay->pktsz + hdrsz + need > relay->pktmaxsz) {
+			return -EMSGSIZE;
+		}
+	}
+	relay->inner = relay->pktsz;
+	inner = (nn_msg_upd_header_t *)&relay->pkt[relay->pktsz + sizeof(nn_msg_bundle_entry_t)];
+	memset(inner, 0, sizeof *inner);
+	memcpy(inner->uuid, d_uuid->uuid, sizeof inner->uuid);
+	inner->type = NN_MSG_UPDATE;
+	inner->version = NN_WIRE_VERSION;
+	inner->hops = d_uuid->hops + 1;
+	relay->pktsz += hdrsz;
+	return 0;
+}
+
+static void
+__nn_relay_add_node(nn_relay_t *relay, nn_d_uuid_t *d_uuid, uint32_t mask)
+{
+	nn_msg_upd_header_t	*inner;
+	nn_msg_updobj_header_t	*objh;
+	nn_d_object_t		*d_object;
+	uint32_t		idx;
+	uint32_t		need;
+
+	relay->stat.nodes++;
+	for (idx = 0; idx < NN_DUUID_OBJECTS; idx++) {
+		if (!(mask & (1u << idx)) || !(d_object = nn_peek_dobject(d_uuid, idx))) {
+			continue;
+		}
+		if (nn_wire_check_payload(d_object->objtype, 0, d_object->size)) {
+			// RAWで受けた後にタイプが変わると大きさが揃っていないことがある。
+			continue;
+		}
+		need = sizeof *objh + d_object->size;
+		if (relay->inner && relay->pktsz + need > relay->pktmaxsz) {
+			// 続きは次のデータグラムで、同じノードの別メッセージとして送る。
+			__nn_relay_close(relay);
+			__nn_relay_send(relay);
+		}
+		if (!relay->inner && __nn_relay_open(relay, d_uuid, need)) {
+			wq_infolog64("object too large to relay. idx=%u size=%u", idx, d_object->size);
+			continue;
+		}
+		objh = (nn_msg_updobj_header_t *)&relay->pkt[relay->pktsz];
+		objh->idx = nn_wire16(idx);
+		objh->type = nn_wire16(d_object->objtype);
+		objh->offset = 0;
+		objh->size = nn_wire16(d_object->size);
+		nn_wire_copy_payload(objh + 1, d_object->addr, d_object->objtype, 0, d_object->size);
+		relay->pktsz += need;
+		inner = (nn_msg_upd_header_t *)&relay->pkt[relay->inner + sizeof(nn_msg_bundle_entry_t)];
+		inner->objects++;
+		relay->stat.objects++;
+	}
+	__nn_relay_close(relay);
+}
+
+void
+nn_relay_flush(nn_relay_t *relay)
+{
+	struct nn_relay_set	*set;
+	nn_d_uuid_t		*d_uuid;
+	uint32_t		i;
+
+	// 集約中の集合を入れ替え、反映側を待たせずに組み立てる。
+	pthread_mutex_lock(&relay->flush_lock);
+	pthread_mutex_lock(&relay->lock);
+	set = &relay->set[relay->cur];
+	relay->cur ^= 1;
+	pthread_mutex_unlock(&relay->lock);
+
+	if (!set->cnt) {
+		pthread_mutex_unlock(&relay->flush_lock);
+		return;
+	}
+	for (i = 0; i < set->size; i++) {
+		if (!set->ent[i].ino) {
+			continue;
+		}
+		d_uuid = nn_get_duuid_by_ino(set->ent[i].ino);
+		if (d_uuid) {
+			__nn_relay_add_node(relay, d_uuid, set->ent[i].mask);
+			nn_put_duuid(d_uuid);
+		}
+		set->ent[i].ino = 0;
+	}
+	set->cnt = 0;
+	__nn_relay_send(relay);
+	pthread_mutex_unlock(&relay->flush_lock);
+}
+
+static void
+__nn_relay_free(nn_relay_t *relay)
+{
+	pthread_mutex_destroy(&relay->lock);
+	pthread_mutex_destroy(&relay->flush_lock);
+	free(relay->set[0].ent);
+	free(relay->set[1].ent);
+	free(relay->pkt);
+	free(relay);
+}
+
+static void
+__nn_relay_timer(wq_item_t *item, wq_arg_t arg)
+{
+	nn_relay_t *relay = (nn_relay_t *)arg;
+
+	nn_relay_flush(relay);
+	if (__atomic_load_n(&relay->stop, __ATOMIC_ACQUIRE)) {
+		__nn_relay_free(relay);
+		return;
+	}
+	wq_timer_sched(&relay->timer, WQ_TIME_US(relay->param.window_us), __nn_relay_timer, relay);
+}
+
+nn_relay_t *
+nn_relay_start(nn_context_t *down, nn_context_t *up, const nn_relay_param_t *param)
+{
+	nn_relay_t	*relay;
+	int		i;
+
+	if (!param->window_us) {
+		return NULL;
+	}
+	relay = (nn_relay_t *)calloc(1, sizeof *relay);
+	if (!relay) {
+		return NULL;
+	}
+	relay->down = down;
+	relay->up = up;
+	relay->param = *param;
+	relay->pktmaxsz = up->datagram.pktmaxsz;
+	relay->pkt = (char *)malloc(relay->pktmaxsz);
+	for (i = 0; i < 2; i++) {
+		relay->set[i].size = NN_RELAY_SET_INIT;
+		relay->set[i].ent = (struct nn_relay_dirty *)calloc(NN_RELAY_SET_INIT,
+								     sizeof(struct nn_relay_dirty));
+	}
+	pthread_mutex_init(&relay->lock, NULL);
+	pthread_mutex_init(&relay->flush_lock, NULL);
+	if (!relay->pkt || !relay->set[0].ent || !relay->set[1].ent) {
+		__nn_relay_free(relay);
+		return NULL;
+	}
+	__nn_relay_send(relay);
+
+	// 読んでから置き換えるまでに変更されていれば読み直す。
+	do {
+		relay->prev_cb = __atomic_load_n(&down->hook.cb, __ATOMIC_ACQUIRE);
+		relay->prev_arg = __atomic_load_n(&down->hook.arg, __ATOMIC_RELAXED);
+	} while (nn_replace_notify_hook(down, relay->prev_cb, relay->prev_arg,
+					__nn_relay_hook, relay));
+
+	wq_init_item(&relay->timer);
+	wq_timer_sched(&relay->timer, WQ_TIME_US(param->window_us), __nn_relay_timer, relay);
+	return relay;
+}
+
+int
+nn_relay_stop(nn_relay_t *relay)
+{
+	int ret;
+
+	// 後から設定されたフックを消さないように、中継のフックのときだけ戻す。
+	// 戻った時点で中継のフックの呼び出しは終わっているので、タイマで解放してよい。
+	ret = nn_replace_notify_hook(relay->down, __nn_relay_hook, relay,
+				     relay->prev_cb, relay->prev_arg);
+	if (ret) {
+		wq_infolog64("notify hook replaced after relay start.");
+		return ret;
+	}
+	__atomic_store_n(&relay->stop, 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+void
+nn_relay_get_stat(nn_relay_t *relay, nn_relay_stat_t *stat)
+{
+	pthread_mutex_lock(&relay->flush_lock);
+	pthread_mutex_lock(&relay->lock);
+	*stat = relay->stat;
+	pthread_mutex_unlock(&relay->lock);
+	pthread_mutex_unlock(&relay->flush_lock);
+}
@@ -0,0 +1,292 @@
+/* --
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2018 Abe Takafumi
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. *
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <list.h>
+#include <wq/wq.h>
+#include <log/log.h>
+#include <nn.h>
+#include <nn_latency.h>
+#include <nn_timer.h>
+
+// ---------------------------------------------------------------------------
+// 階層タイマホイール
+
+void
+nn_twheel_init(nn_twheel_t *wheel, uint64_t now)
+{
+	int l, i;
+
+	wheel->now = now;
+	for (l = 0; l < NN_TWHEEL_LEVELS; l++) {
+		for (i = 0; i < NN_TWHEEL_SLOTS; i++) {
+			init_list_head(&wheel->slot[l][i]);
+		}
+	}
+}
+
+void
+nn_twheel_add(nn_twheel_t *wheel, nn_timer_t *timer, uint64_t expires)
+{
+	uint64_t	delta, pos;
+	int		l;
+
+	if (expires <= wheel->now) {
+		expires = wheel->now + 1;
+	}
+	delta = expires - wheel->now;
+	for (l = 0; l < NN_TWHEEL_LEVELS - 1; l++) {
+		if (delta < (1ull << (NN_TWHEEL_BITS * (l + 1)))) {
+			break;
+		}
+	}
+	pos = expires;
+	if (delta >= (1ull << (NN_TWHEEL_BITS * NN_TWHEEL_LEVELS))) {
+		// 範囲外は最上位で最後に下ろされるスロットに置き、カスケードで置き直す。
+		pos = wheel->now + (1ull << (NN_TWHEEL_BITS * NN_TWHEEL_LEVELS)) - 1;
+	}
+	timer->expires = expires;
+	list_del_init(&timer->list);
+	list_add_tail(&timer->list,
+		      &wheel->slot[l][(pos >> (NN_TWHEEL_BITS * l)) & NN_TWHEEL_MASK]);
+}
+
+void
+nn_twheel_del(nn_timer_t *timer)
+{
+	list_del_init(&timer->list);
+}
+
+// レベルlの現在のスロットのタイマを置き直す。
+// 今のtickが期限のもの(境界ちょうど)は、nn_twheel_add()では次のtickへ
+// ずれてしまうので、このtickで取り出されるレベル0のスロットへ直接置く。
+static void
+__nn_twheel_cascade(nn_twheel_t *wheel, int l)
+{
+	list_head_t	*slot = &wheel->slot[l][(wheel->now >> (NN_TWHEEL_BITS * l)) & NN_TWHEEL_MASK];
+	nn_timer_t	*timer;
+
+	while (!list_empty(slot)) {
+		timer = list_first_entry(slot, nn_timer_t, list);
+		if (timer->expires <= wheel->now) {
+			list_move_tail(&timer->list, &wheel->slot[0][wheel->now & NN_TWHEEL_MASK]);
+		} else {
+			nn_twheel_add(wheel, timer, timer->expires);
+		}
+	}
+}
+
+void
+nn_twheel_advance(nn_twheel_t *wheel, list_head_t *expired)
+{
+	list_head_t	*slot;
+	int		l;
+
+	wheel->now++;
+	// 上位のレベルから順に、境界に来たスロットを下ろす。
+	for (l = NN_TWHEEL_LEVELS - 1; l > 0; l--) {
+		if (!(wheel->now & ((1ull << (NN_TWHEEL_BITS * l)) - 1))) {
+			__nn_twheel_cascade(wheel, l);
+		}
+	}
+	slot = &wheel->slot[0][wheel->now & NN_TWHEEL_MASK];
+	while (!list_empty(slot)) {
+		list_move_tail(slot->next, expired);
+	}
+}
+
+// ---------------------------------------------------------------------------
+// オブジェクトごとの送信周期
+
+struct nn_sched_obj {
+	nn_timer_t			timer;
+	struct nn_context_object	*obj;
+	uint32_t			period;		// 周期(tick, 0は停止)
+};
+
+struct nn_sched {
+	nn_context_t			*ctx;
+	uint32_t			tick_us;
+	int				stop;
+	wq_item_t			item;
+	uint64_t			base;		// tick 0の時刻(ns)
+	nn_twheel_t			wheel;
+	struct nn_sched_obj		ent[NN_CTX_OBJECTS];
+	nn_sched_stat_t			stat;
+};
+
+int
+nn_sched_advance(nn_context_t *ctx, uint32_t ticks)
+{
+	struct nn_sched		*sched = ctx->sched;
+	struct nn_sched_obj	*ent;
+	list_head_t		expired;
+	uint64_t		target, next, missed;
+	int			fired = 0;
+
+	if (!sched) {
+		return -EINVAL;
+	}
+	init_list_head(&expired);
+	target = sched->wheel.now + ticks;
+	while (ticks--) {
+		nn_twheel_advance(&sched->wheel, &expired);
+		sched->stat.ticks++;
+		// 同じtickのオブジェクトを続けて入れ、1つのデータグラムにまとめる。
+		while (!list_empty(&expired)) {
+			ent = list_entry(expired.next, struct nn_sched_obj, timer.list);
+			list_del_init(&ent->timer.list);
+			if (nn_update_object(ctx, ent->obj, 0, ent->obj->sz)) {
+				sched->stat.errors++;
+			} else {
+				sched->stat.fired++;
+				fired++;
+			}
+			// 期限から数えて次を決めるので、処理の遅れで周期がずれない。
+			// 遅れて追いついている間に過ぎた周期は送り直さず(同じ内容を
+			// 続けて送るだけになる)、targetより後の最初の期限まで飛ばす。
+			next = ent->timer.expires + ent->period;
+			if (next <= target) {
+				missed = (target - next) / ent->period + 1;
+				next += missed * ent->period;
+				sched->stat.skipped += missed;
+			}
+			nn_twheel_add(&sched->wheel, &ent->timer, next);
+		}
+	}
+	return fired;
+}
+
+static void
+__nn_sched_free(struct nn_sched *sched)
+{
+	free(sched);
+}
+
+static void
+__nn_sched_timer(wq_item_t *item, wq_arg_t arg)
+{
+	struct nn_sched	*sched = (struct nn_sched *)arg;
+	uint64_t	now;
+	uint32_t	ticks;
+
+	if (sched->stop) {
+		__nn_sched_free(sched);
+		return;
+	}
+	// タイマが遅れた分もまとめて進める。
+	now = (nn_lat_now() - sched->base) / ((uint64_t)sched->tick_us * 1000);
+	ticks = now > sched->wheel.now ? (uint32_t)(now - sched->wheel.now) : 0;
+	if (ticks > 1) {
+		sched->stat.late += ticks - 1;
+	}
+	nn_sched_advance(sched->ctx, ticks);
+	wq_timer_sched(&sched->item, WQ_TIME_US(sched->tick_us), __nn_sched_timer, sched);
+}
+
+int
+nn_sched_start(nn_context_t *ctx, uint32_t tick_us)
+{
+	struct nn_sched	*sched;
+	int		i;
+
+	if (!tick_us) {
+		return -EINVAL;
+	}
+	if (ctx->sched) {
+		return -EBUSY;
+	}
+	sched = (struct nn_sched *)calloc(1, sizeof *sched);
+	if (!sched) {
+		return -ENOMEM;
+	}
+	sched->ctx = ctx;
+	sched->tick_us = tick_us;
+	sched->base = nn_lat_now();
+	nn_twheel_init(&sched->wheel, 0);
+	for (i = 0; i < NN_CTX_OBJECTS; i++) {
+		nn_timer_init(&sched->ent[i].timer);
+	}
+	ctx->sched = sched;
+
+	wq_init_item(&sched->item);
+	wq_timer_sched(&sched->item, WQ_TIME_US(tick_us), __nn_sched_timer, sched);
+	wq_infolog64("sched start. tick_us=%u", tick_us);
+	return 0;
+}
+
+void
+nn_sched_stop(nn_context_t *ctx)
+{
+	struct nn_sched *sched = ctx->sched;
+
+	if (!sched) {
+		return;
+	}
+	ctx->sched = NULL;
+	sched->stop = 1;
+}
+
+int
+nn_set_publish_period(nn_context_t *ctx, struct nn_context_object *obj, uint32_t period_us)
+{
+	struct nn_sched		*sched = ctx->sched;
+	struct nn_sched_obj	*ent;
+	uint32_t		period;
+
+	if (!sched) {
+		return -EINVAL;
+	}
+	if (obj->idx >= NN_CTX_OBJECTS || ctx->objects.object[obj->idx] != obj) {
+		return -ENOENT;
+	}
+	ent = &sched->ent[obj->idx];
+	nn_twheel_del(&ent->timer);
+	period = (period_us + sched->tick_us - 1) / sched->tick_us;
+	if (!period) {
+		ent->period = 0;
+		ent->obj = NULL;
+		return 0;
+	}
+	ent->obj = obj;
+	ent->period = period;
+	// 周期が同じオブジェクトは同じtickに揃え、まとめて送る。
+	nn_twheel_add(&sched->wheel, &ent->timer,
+		      (sched->wheel.now / period + 1) * period);
+	return 0;
+}
+
+int
+nn_get_sched_stat(nn_context_t *ctx, nn_sched_stat_t *stat)
+{
+	if (!ctx->sched) {
+		return -EINVAL;
+	}
+	*stat = ctx->sched->stat;
+	return 0;
+}
@@ -0,0 +1,530 @@
+/* --
+ *
+ * MIT License
+ * 
+ * Copyright (c) 2018 Abe Takafumi
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE. *
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <linux/io_uring.h>
+#include <log/log.h>
+#include <nn_uring.h>
+
+#define NN_URING_BGID		(0)		// 受信バッファのグループ
+#define NN_URING_RECV		(0ull)		// user_data: 受信
+#define NN_URING_SEND		(1ull << 63)	// user_data: 送信(下位は送信スロット)
+
+// 送信中のsendmsg。完了するまでmsghdrと宛先を保持する。
+struct nn_uring_send {
+	struct msghdr		msg;
+	struct iovec		iov;
+	struct sockaddr_in	addr;
+	void			*buf;
+};
+
+struct nn_uring {
+	int			fd;
+	int			sock;
+	// 投入キュー
+	unsigned		*sq_head;
+	unsigned		*sq_tail;
+	unsigned		*sq_array;
+	unsigned		sq_mask;
+	unsigned		sq_entries;
+	unsigned		sq_local;	// 投入キューへ入れた位置(未submitを含む)
+	unsigned		sq_submitted;
+	struct io_uring_sqe	*sqes;
+	// 完了キュー
+	unsigned		*cq_head;
+	unsigned		*cq_tail;
+	unsigned		cq_mask;
+	struct io_uring_cqe	*cqes;
+	void			*sq_ptr;
+	size_t			sq_sz;
+	void			*cq_ptr;
+	size_t			cq_sz;
+	size_t			sqes_sz;
+	// 受信バッファのリング
+	struct io_uring_buf_ring *br;
+	size_t			br_sz;
+	uint16_t		br_tail;
+	uint32_t		nbufs;
+	uint32_t		bufsz;		// 受信バッファ1つの大きさ
+	char			*bufs;
+	struct msghdr		recv_msg;	// マルチショット受信の雛形(名前と制御の長さ)
+	int			recv_armed;
+	// 送信スロット
+	struct nn_uring_send	*send;
+	uint32_t		*send_free;
+	uint32_t		nfree;
+	nn_uring_stat_t		stat;
+};
+
+static inline int
+__nn_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int
+__nn_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static inline int
+__nn_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static struct io_uring_sqe *
+__nn_uring_get_sqe(struct nn_uring *ring)
+{
+	unsigned		head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	unsigned		idx;
+	struct io_uring_sqe	*sqe;
+
+	if (ring->sq_local - head >= ring->sq_entries) {
+		return NULL;
+	}
+	idx = ring->sq_local & ring->sq_mask;
+	ring->sq_array[idx] = idx;
+	ring->sq_local++;
+	sqe = &ring->sqes[idx];
+	memset(sqe, 0, sizeof *sqe);
+	return sqe;
+}
+
+int
+nn_uring_submit(struct nn_uring *ring)
+{
+	unsigned	n = ring->sq_local - ring->sq_submitted;
+	int		rc;
+
+	if (!n) {
+		return 0;
+	}
+	__atomic_store_n(ring->sq_tail, ring->sq_local, __ATOMIC_RELEASE);
+	rc = __nn_uring_enter(ring->fd, n, 0, 0);
+	ring->stat.enters++;
+	if (rc < 0) {
+		wq_infolog64("io_uring_enter() error. errno=%d", errno);
+		return -errno;
+	}
+	ring->sq_submitted += rc;
+	return rc;
+}
+
+uint32_t
+nn_uring_send_space(const struct nn_uring *ring)
+{
+	unsigned	head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	uint32_t	sq = ring->sq_entries - (ring->sq_local - head);
+
+	// マルチショット受信を投入し直す分を1つ残す。
+	sq = sq ? sq - 1 : 0;
+	return sq < ring->nfree ? sq : ring->nfree;
+}
+
+static void
+__nn_uring_add_buf(struct nn_uring *ring, uint16_t bid)
+{
+	struct io_uring_buf *b = &ring->br->bufs[ring->br_tail & (ring->nbufs - 1)];
+
+	b->addr = (uint64_t)(uintptr_t)&ring->bufs[(size_t)bid * ring->bufsz];
+	b->len = ring->bufsz;
+	b->bid = bid;
+	ring->br_tail++;
+}
+
+static inline void
+__nn_uring_commit_bufs(struct nn_uring *ring)
+{
+	__atomic_store_n(&ring->br->tail, ring->br_tail, __ATOMIC_RELEASE);
+}
+
+static int
+__nn_uring_arm_recv(struct nn_uring *ring)
+{
+	struct io_uring_sqe *sqe = __nn_uring_get_sqe(ring);
+
+	if (!sqe) {
+		return -EBUSY;
+	}
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = ring->sock;
+	sqe->addr = (uint64_t)(uintptr_t)&ring->recv_msg;
+	sqe->len = 1;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = NN_URING_BGID;
+	sqe->user_data = NN_URING_RECV;
+	ring->recv_armed = 1;
+	return 0;
+}
+
+int
+nn_uring_sendmsg(struct nn_uring *ring, int sock, void *buf,
+		 void *data, uint32_t sz, const struct sockaddr_in *addr)
+{
+	struct io_uring_sqe	*sqe;
+	struct nn_uring_send	*s;
+	uint32_t		slot;
+
+	if (!ring->nfree) {
+		return -EBUSY;
+	}
+	sqe = __nn_uring_get_sqe(ring);
+	if (!sqe) {
+		return -EBUSY;
+	}
+	slot = ring->send_free[--ring->nfree];
+	s = &ring->send[slot];
+	s->buf = buf;
+	s->addr = *addr;
+	s->iov.iov_base = data;
+	s->iov.iov_len = sz;
+	memset(&s->msg, 0, sizeof s->msg);
+	s->msg.msg_name = &s->addr;
+	s->msg.msg_namelen = sizeof s->addr;
+	s->msg.msg_iov = &s->iov;
+	s->msg.msg_iovlen = 1;
+
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = sock;
+	sqe->addr = (uint64_t)(uintptr_t)&s->msg;
+	sqe->len = 1;
+	sqe->user_data = NN_URING_SEND | slot;
+	ring->stat.sends++;
+	return 0;
+}
+
+static void
+__nn_uring_recv_cqe(struct nn_uring *ring, struct io_uring_cqe *cqe,
+		    nn_uring_recv_t recv, void *arg)
+{
+	struct io_uring_recvmsg_out	*out;
+	struct msghdr			msg;
+	struct cmsghdr			*cmsg;
+	struct timespec			ts;
+	uint64_t			rx_ts = 0;
+	uint16_t			bid;
+	char				*p;
+
+	if (!(cqe->flags & IORING_CQE_F_MORE)) {
+		// マルチショットが終わった(バッファ切れなど)。後で投入し直す。
+		ring->recv_armed = 0;
+	}
+	if (cqe->res == -ENOBUFS) {
+		ring->stat.nobufs++;
+		return;
+	}
+	if (!(cqe->flags & IORING_CQE_F_BUFFER)) {
+		if (cqe->res < 0) {
+			wq_infolog64("recvmsg error. res=%d", cqe->res);
+		}
+		return;
+	}
+	bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+	p = &ring->bufs[(size_t)bid * ring->bufsz];
+	out = (struct io_uring_recvmsg_out *)p;
+	if (cqe->res >= 0 && !(out->flags & MSG_TRUNC)) {
+		if (out->controllen) {
+			memset(&msg, 0, sizeof msg);
+			msg.msg_control = p + sizeof *out + ring->recv_msg.msg_namelen;
+			msg.msg_controllen = out->controllen;
+			for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+				if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+					memcpy(&ts, CMSG_DATA(cmsg), sizeof ts);
+					rx_ts = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+				}
+			}
+		}
+		ring->stat.recvs++;
+		recv(arg, p + sizeof *out + ring->recv_msg.msg_namelen + ring->recv_msg.msg_controllen,
+		     out->payloadlen, rx_ts);
+	} else if (cqe->res >= 0) {
+		ring->stat.truncated++;
+	}
+	// 反映が終わったのでバッファを返す。
+	__nn_uring_add_buf(ring, bid);
+}
+
+int
+nn_uring_reap(struct nn_uring *ring, nn_uring_recv_t recv, void *arg)
+{
+	struct io_uring_cqe	*cqe;
+	struct nn_uring_send	*s;
+	unsigned		head = *ring->cq_head;
+	unsigned		tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	int			n = 0;
+	uint32_t		slot;
+
+	for (; head != tail; head++, n++) {
+		cqe = &ring->cqes[head & ring->cq_mask];
+		if (cqe->user_data & NN_URING_SEND) {
+			slot = (uint32_t)(cqe->user_data & ~NN_URING_SEND);
+			s = &ring->send[slot];
+			if (cqe->res < 0) {
+				ring->stat.send_errors++;
+				wq_infolog64("sendmsg error. res=%d", cqe->res);
+			}
+			free(s->buf);
+			s->buf = NULL;
+			ring->send_free[ring->nfree++] = slot;
+		} else {
+			__nn_uring_recv_cqe(ring, cqe, recv, arg);
+		}
+		// 次の完了を取り出すまでに空きを返し、カーネルが上書きできるようにする。
+		if (((head + 1) & 15) == 0) {
+			__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+		}
+	}
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	__nn_uring_commit_bufs(ring);
+
+	if (!ring->recv_armed && !__nn_uring_arm_recv(ring)) {
+		ring->stat.rearms++;
+		nn_uring_submit(ring);
+	}
+	return n;
+}
+
+static void
+__nn_uring_unmap(struct nn_uring *ring)
+{
+	if (ring->sqes) {
+		munmap(ring->sqes, ring->sqes_sz);
+	}
+	if (ring->cq_ptr && ring->cq_ptr != ring->sq_ptr) {
+		munmap(ring->cq_ptr, ring->cq_sz);
+	}
+	if (ring->sq_ptr) {
+		munmap(ring->sq_ptr, ring->sq_sz);
+	}
+	if (ring->br) {
+		munmap(ring->br, ring->br_sz);
+	}
+}
+
+void
+nn_uring_free(struct nn_uring *ring)
+{
+	uint32_t i;
+
+	if (ring->fd >= 0) {
+		close(ring->fd);
+	}
+	__nn_uring_unmap(ring);
+	if (ring->send) {
+		for (i = 0; i < ring->sq_entries; i++) {
+			free(ring->send[i].buf);
+		}
+	}
+	free(ring->send);
+	free(ring->send_free);
+	free(ring->bufs);
+	free(ring);
+}
+
+static int
+__nn_uring_map(struct nn_uring *ring, struct io_uring_params *p)
+{
+	char *sq, *cq;
+
+	ring->sq_sz = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+	ring->cq_sz = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+	if (p->features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_sz > ring->sq_sz) {
+			ring->sq_sz = ring->cq_sz;
+		}
+		ring->cq_sz = ring->sq_sz;
+	}
+	ring->sq_ptr = mmap(NULL, ring->sq_sz, PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ptr == MAP_FAILED) {
+		ring->sq_ptr = NULL;
+		return -errno;
+	}
+	if (p->features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_ptr = ring->sq_ptr;
+	} else {
+		ring->cq_ptr = mmap(NULL, ring->cq_sz, PROT_READ | PROT_WRITE,
+				    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cq_ptr == MAP_FAILED) {
+			ring->cq_ptr = NULL;
+			return -errno;
+		}
+	}
+	ring->sqes_sz = p->sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqes_sz, PROT_READ | PROT_WRITE,
+						 MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		return -errno;
+	}
+
+	sq = (char *)ring->sq_ptr;
+	cq = (char *)ring->cq_ptr;
+	ring->sq_head = (unsigned *)(sq + p->sq_off.head);
+	ring->sq_tail = (unsigned *)(sq + p->sq_off.tail);
+	ring->sq_mask = *(unsigned *)(sq + p->sq_off.ring_mask);
+	ring->sq_entries = *(unsigned *)(sq + p->sq_off.ring_entries);
+	ring->sq_array = (unsigned *)(sq + p->sq_off.array);
+	ring->sq_local = ring->sq_submitted = *ring->sq_tail;
+	ring->cq_head = (unsigned *)(cq + p->cq_off.head);
+	ring->cq_tail = (unsigned *)(cq + p->cq_off.tail);
+	ring->cq_mask = *(unsigned *)(cq + p->cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + p->cq_off.cqes);
+	return 0;
+}
+
+static int
+__nn_uring_setup_bufs(struct nn_uring *ring, uint32_t pktmaxsz)
+{
+	struct io_uring_buf_reg	reg;
+	uint32_t		i;
+
+	// バッファ: io_uring_recvmsg_out, 送信元アドレス, 制御メッセージ, データグラム
+	ring->recv_msg.msg_namelen = sizeof(struct sockaddr_in);
+	ring->recv_msg.msg_controllen = CMSG_SPACE(sizeof(struct timespec));
+	ring->bufsz = (sizeof(struct io_uring_recvmsg_out) + ring->recv_msg.msg_namelen +
+		       ring->recv_msg.msg_controllen + pktmaxsz + 63) & ~63u;
+	ring->bufs = (char *)malloc((size_t)ring->nbufs * ring->bufsz);
+	if (!ring->bufs) {
+		return -ENOMEM;
+	}
+
+	ring->br_sz = ring->nbufs * sizeof(struct io_uring_buf);
+	ring->br = (struct io_uring_buf_ring *)mmap(NULL, ring->br_sz, PROT_READ | PROT_WRITE,
+						    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ring->br == MAP_FAILED) {
+		ring->br = NULL;
+		return -errno;
+	}
+	memset(&reg, 0, sizeof reg);
+	reg.ring_addr = (uint64_t)(uintptr_t)ring->br;
+	reg.ring_entries = ring->nbufs;
+	reg.bgid = NN_URING_BGID;
+	if (__nn_uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		wq_infolog64("IORING_REGISTER_PBUF_RING error. errno=%d", errno);
+		return -errno;
+	}
+	ring->br_tail = 0;
+	for (i = 0; i < ring->nbufs; i++) {
+		__nn_uring_add_buf(ring, i);
+	}
+	__nn_uring_commit_bufs(ring);
+	return 0;
+}
+
+int
+nn_uring_init(struct nn_uring **pring, int sock, uint32_t entries, uint32_t pktmaxsz)
+{
+	struct io_uring_params	p;
+	struct nn_uring		*ring;
+	uint32_t		i;
+	int			rc;
+
+	if (entries < 8) {
+		entries = 8;
+	}
+	if (entries > 32768) {
+		entries = 32768;
+	}
+	entries = 1u << (32 - __builtin_clz(entries - 1));
+
+	ring = (struct nn_uring *)calloc(1, sizeof *ring);
+	if (!ring) {
+		return -ENOMEM;
+	}
+	ring->sock = sock;
+	ring->nbufs = entries;
+
+	// マルチショット受信は1つの投入から多くの完了を出すので、完了キューを大きくとる。
+	memset(&p, 0, sizeof p);
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = entries * 4;
+	ring->fd = __nn_uring_setup(entries, &p);
+	if (ring->fd < 0) {
+		rc = -errno;
+		wq_infolog64("io_uring_setup() error. errno=%d", errno);
+		ring->fd = -1;
+		goto err;
+	}
+	rc = __nn_uring_map(ring, &p);
+	if (rc) {
+		goto err;
+	}
+	rc = __nn_uring_setup_bufs(ring, pktmaxsz);
+	if (rc) {
+		goto err;
+	}
+
+	ring->send = (struct nn_uring_send *)calloc(ring->sq_entries, sizeof *ring->send);
+	ring->send_free = (uint32_t *)malloc(ring->sq_entries * sizeof *ring->send_free);
+	if (!ring->send || !ring->send_free) {
+		rc = -ENOMEM;
+		goto err;
+	}
+	// 受信用に1つ残しておく。
+	for (i = 0; i < ring->sq_entries - 1; i++) {
+		ring->send_free[ring->nfree++] = i;
+	}
+
+	rc = __nn_uring_arm_recv(ring);
+	if (!rc) {
+		rc = nn_uring_submit(ring);
+	}
+	if (rc < 0) {
+		goto err;
+	}
+	wq_infolog64("io_uring ready. entries=%u bufsz=%u", entries, ring->bufsz);
+	*pring = ring;
+	return 0;
+
+err:
+	nn_uring_free(ring);
+	return rc;
+}
+
+int
+nn_uring_fd(const struct nn_uring *ring)
+{
+	return ring->fd;
+}
+
+void
+nn_uring_get_stat(const struct nn_uring *ring, nn_uring_stat_t *stat)
+{
+	*stat = ring->stat;
+}